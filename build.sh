@@ -11,11 +11,12 @@ CPP=clang++
 #CC=/usr/local/bin/gcc-11
 #CPP=/usr/local/bin/g++-11
 
-compile="$CPP -std=c++17 -I . -I core -I values -I compiler -Wall -Wno-sign-compare"
+# Extra flags can be passed in $CXXFLAGS, e.g. `CXXFLAGS=-DENABLE_TOS_REGISTER ./build.sh`
+compile="$CPP -std=c++17 -I . -I core -I values -I compiler -Wall -Wno-sign-compare $CXXFLAGS"
 
 # Compile core_words.cc with special flags to suppress unnecessary stack frames
 $compile -c -O3 -fomit-frame-pointer -fno-stack-check -fno-stack-protector \
-    core/core_words.cc more_words.cc
+    core/core_words.cc core/generated_superinstructions.cc more_words.cc
 
 $compile -c {values,compiler}/*.cc
 
@@ -0,0 +1,39 @@
+#! /bin/bash -e
+# Profiles a workload and regenerates src/core/generated_superinstructions.cc from it.
+# Usage: ./gen_superinstructions.sh [-n COUNT] [WORKLOAD ...]
+#   -n COUNT    Maximum number of superinstructions to generate (default 8)
+#   WORKLOAD    Files of Tails source code, one line at a time (default workloads/*.tails)
+# Rebuild afterwards with ./build.sh to use the new superinstructions.
+
+COUNT=8
+if [ "$1" == "-n" ]; then
+    COUNT=$2
+    shift 2
+fi
+WORKLOADS=${@:-workloads/*.tails}
+
+CPP=${CPP:-clang++}
+compile="$CPP -std=c++17 -I $PWD/src -I $PWD/src/core -I $PWD/src/values -I $PWD/src/compiler -Wall -Wno-sign-compare -DENABLE_TRACING $CXXFLAGS"
+
+echo "Building profiler ..."
+BUILD=$(mktemp -d)
+trap "rm -rf $BUILD" EXIT
+# Build with an empty set of generated superinstructions, so old ones can't affect the profile:
+cat > $BUILD/empty_superinstructions.cc <<'END'
+#include "core_words.hh"
+namespace tails::core_words {
+    const Word* const kGeneratedWords[] = {nullptr};
+    const Fusion kGeneratedFusions[] = {{nullptr, nullptr, nullptr}};
+}
+END
+cd $BUILD
+$compile -c -O3 -fomit-frame-pointer -fno-stack-check -fno-stack-protector \
+    $OLDPWD/src/core/core_words.cc $OLDPWD/src/more_words.cc empty_superinstructions.cc
+$compile -c -O3 $OLDPWD/src/{values,compiler}/*.cc
+$compile -O3 *.o $OLDPWD/src/profile_superinstructions.cc -o profiler
+cd $OLDPWD
+
+echo "Profiling $WORKLOADS ..."
+$BUILD/profiler -n $COUNT -o src/core/generated_superinstructions.cc $WORKLOADS
+
+echo "Done."
@@ -0,0 +1,105 @@
+//
+// arena.hh
+//
+// Copyright (C) 2021 Jens Alfke. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+
+namespace tails {
+
+    /// A simple "bump" allocator, for many short-lived allocations that are all freed at once when
+    /// the Arena is destructed. Individual deallocations are ignored.
+    /// The Compiler allocates its intermediate representation from one, so compiling a word
+    /// costs a few big allocations instead of several per instruction.
+    class Arena {
+    public:
+        explicit Arena(size_t chunkSize = 16 * 1024)   :_chunkSize(chunkSize) { }
+
+        ~Arena() {
+            while (_chunk) {
+                Chunk *prev = _chunk->prev;
+                ::free(_chunk);
+                _chunk = prev;
+            }
+        }
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+            uintptr_t p = alignUp(_next, align);
+            if (!_next || p + size > uintptr_t(_end)) {
+                addChunk(size + align);
+                p = alignUp(_next, align);
+            }
+            _next = (char*)(p + size);
+            return (void*)p;
+        }
+
+    private:
+        struct alignas(std::max_align_t) Chunk {
+            Chunk* prev;
+        };
+
+        static uintptr_t alignUp(char *p, size_t align) {
+            return (uintptr_t(p) + align - 1) & ~uintptr_t(align - 1);
+        }
+
+        void addChunk(size_t minSize) {
+            size_t size = std::max(_chunkSize, minSize) + sizeof(Chunk);
+            auto chunk = (Chunk*)::malloc(size);
+            if (!chunk)
+                throw std::bad_alloc();
+            chunk->prev = _chunk;
+            _chunk = chunk;
+            _next = (char*)(chunk + 1);
+            _end = (char*)chunk + size;
+        }
+
+        size_t _chunkSize;
+        Chunk* _chunk = nullptr;
+        char*  _next = nullptr;
+        char*  _end = nullptr;
+    };
+
+
+    /// An STL allocator that allocates from an Arena, for use with containers like std::vector.
+    template <class T>
+    class ArenaAllocator {
+    public:
+        using value_type = T;
+
+        ArenaAllocator(Arena &arena)                                :_arena(&arena) { }
+        template <class U> ArenaAllocator(const ArenaAllocator<U> &a) :_arena(a._arena) { }
+
+        T* allocate(size_t n)                   {return (T*)_arena->allocate(n * sizeof(T), alignof(T));}
+        void deallocate(T*, size_t)             { }
+
+        template <class U> bool operator==(const ArenaAllocator<U> &a) const {return _arena == a._arena;}
+        template <class U> bool operator!=(const ArenaAllocator<U> &a) const {return _arena != a._arena;}
+
+    private:
+        template <class U> friend class ArenaAllocator;
+        Arena* _arena;
+    };
+
+}
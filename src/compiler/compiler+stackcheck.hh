@@ -17,8 +17,10 @@
 //
 
 #pragma once
+#include "arena.hh"
 #include "core_words.hh"
 #include "utils.hh"
+#include <iterator>
 #include <optional>
 #include <sstream>
 #include <string>
@@ -38,7 +40,9 @@ namespace tails {
         // A stack item can be either a TypeSet (set of types) or a literal Value.
         using Item = variant<TypeSet,Value>;
 
-        EffectStack(const StackEffect &initial) {
+        EffectStack(const StackEffect &initial, Arena &arena)
+        :_stack(ArenaAllocator<Item>(arena))
+        {
             auto inputs = initial.inputs();
             for (auto i = inputs.rbegin(); i != inputs.rend(); ++i)
                 _stack.emplace_back(*i);
@@ -53,6 +57,9 @@ namespace tails {
             return _stack[_stack.size() - 1 - i];
         }
 
+        /// The set of types the item at depth `i` can have.
+        TypeSet typesAt(size_t i) const {return itemTypes(at(i));}
+
         optional<Value> literalAt(size_t i) const {
             if (i < depth()) {
                 if (auto valP = std::get_if<Value>(&at(i)); valP)
@@ -65,9 +72,9 @@ namespace tails {
             return _stack == other._stack;
         }
 
-        /// Adds the stack effect of calling a word. Throws an exception on failure.
-        void add(const Word *word, const StackEffect &effect, const char *sourceCode) {
-            // Check that the inputs match what's on the stack:
+        /// Checks that the stack has the inputs of a word with the given effect. Throws an
+        /// exception on failure.
+        void checkInputs(const Word *word, const StackEffect &effect, const char *sourceCode) const {
             const auto nInputs = effect.inputCount();
             if (nInputs > depth())
                 throw compile_error(format("Calling `%s` would underflow (%zu needed, %zu available)",
@@ -78,9 +85,15 @@ namespace tails {
                 throw compile_error(format("Type mismatch passing %s to `%s` (depth %i)",
                                            Value::typeName(*badType), word->name(), i),
                                     sourceCode);
+        }
+
+        /// Adds the stack effect of calling a word. Throws an exception on failure.
+        void add(const Word *word, const StackEffect &effect, const char *sourceCode) {
+            checkInputs(word, effect, sourceCode);
 
+            const auto nInputs = effect.inputCount();
             Item inputs[max(nInputs, 1)];
-            for (i = 0; i < nInputs; ++i)
+            for (int i = 0; i < nInputs; ++i)
                 inputs[i] = at(i);
 
             _maxDepth = max(_maxDepth, depth() + effect.max());
@@ -88,13 +101,19 @@ namespace tails {
             // Pop the inputs off the stack:
             _stack.resize(depth() - nInputs);
 
+            // If the word is pure and its inputs are literals, its outputs are literals too:
+            if (word->hasFlag(Word::Pure) && foldingEnabled && evaluate(word, effect, inputs))
+                return;
+
             // Push the outputs to the stack:
             for (int i = effect.outputCount() - 1; i >= 0; --i) {
                 TypeSet ef = effect.outputs()[i];
-                if (auto in = ef.inputMatch(); in >= 0)
-                    _stack.emplace_back(inputs[in]);
-                else
+                if (auto in = ef.inputMatch(); in < 0)
                     _stack.emplace_back(ef);
+                else if (ef.canBeAnyType())
+                    _stack.emplace_back(inputs[in]);    // (a stack shuffle passes it through)
+                else
+                    _stack.emplace_back((itemTypes(inputs[in]) & ef).promoted()); // (like `+`)
             }
         }
 
@@ -111,16 +130,25 @@ namespace tails {
         }
 
         /// Merges myself with another stack -- used when two flows of control join.
-        void mergeWith(const EffectStack &other, const char *sourceCode) {
+        /// Returns true if any of my items changed (widened.)
+        bool mergeWith(const EffectStack &other, const char *sourceCode) {
             size_t d = depth();
             if (d != other.depth())
                 throw compile_error("Inconsistent stack depth", sourceCode);
+            bool changed = false;
             for (size_t i = 0; i < d; ++i) {
                 Item &mine = _stack[_stack.size() - 1 - i];
-                const Item others = other.at(i);
-                if (others != mine)
-                    mine = itemTypes(mine) | itemTypes(others);
+                const Item &others = other.at(i);
+                if (others != mine) {
+                    Item merged = itemTypes(mine) | itemTypes(others);
+                    if (merged != mine) {
+                        mine = merged;
+                        changed = true;
+                    }
+                }
             }
+            _maxDepth = max(_maxDepth, other._maxDepth);
+            return changed;
         }
 
         /// Checks whether the current stack matches a StackEffect's outputs.
@@ -148,9 +176,37 @@ namespace tails {
         }
 
     private:
+        static constexpr size_t kMaxEvalDepth = 8;
+
+        /// Runs a pure word on literal inputs, and pushes its results as literals.
+        /// Returns false if not all the inputs are literals, or if the word throws.
+        bool evaluate(const Word *word, const StackEffect &effect, const Item inputs[]) {
+            const auto nInputs = effect.inputCount(), nOutputs = effect.outputCount();
+            if (nInputs + effect.max() > kMaxEvalDepth)
+                return false;
+            Value stack[1 + kMaxEvalDepth];         // (`call` may access the slot below the base)
+            for (int i = 0; i < nInputs; ++i) {
+                auto valP = std::get_if<Value>(&inputs[i]);
+                if (!valP)
+                    return false;
+                stack[nInputs - i] = *valP;
+            }
+            const Instruction code[2] = {*word, _RETURN};
+            Value *sp;
+            try {
+                sp = call(&stack[nInputs], code);
+            } catch (const std::exception&) {
+                return false;                       // Leave the error for runtime
+            }
+            assert(sp == &stack[nOutputs]);
+            for (int i = 1; i <= nOutputs; ++i)
+                _stack.emplace_back(stack[i]);
+            return true;
+        }
+
         static TypeSet itemTypes(const Item &item) {
             if (auto valP = std::get_if<Value>(&item); valP)
-                return TypeSet(valP->type());
+                return TypeSet::of(*valP);
             else
                 return std::get<TypeSet>(item);
         }
@@ -168,7 +224,7 @@ namespace tails {
             return std::nullopt;
         }
 
-        std::vector<Item> _stack;
+        std::vector<Item, ArenaAllocator<Item>> _stack;
         size_t            _initialDepth = 0;
         size_t            _maxDepth = 0;
     };
@@ -178,22 +234,21 @@ namespace tails {
 
 
     /// Extension of WordRef that adds private fields used by the compiler.
+    /// Optimization passes remove an instruction by setting its `word` to null; then
+    /// `Compiler::compact` erases it.
     struct Compiler::SourceWord : public Compiler::WordRef {
         SourceWord(const WordRef &ref, const char *source =nullptr)
         :WordRef(ref)
         ,sourceCode(source)
         { }
 
-        void branchesTo(InstructionPos pos) {
-            branchTo = pos;
-            pos->isBranchDestination = true;
-        }
-
         const char*  sourceCode;                        // Points to source code where word appears
         std::optional<EffectStack> knownStack;          // Stack effect at this point, once known
-        std::optional<InstructionPos> branchTo;         // Points to where a branch goes
+        std::optional<InstructionPos> branchTo;         // Index of the instruction a branch goes to
+        TypeSet operandTypes[2];                        // Types of top 2 stack items, once known
         int pc;                                         // Relative address during code-gen
         const Word* interpWord = nullptr;               // Which INTERP-family word to use
+        const Word* inlinedWord = nullptr;              // Inlined word whose code starts here
         bool isBranchDestination = false;               // True if a branch points here
     };
 
@@ -201,73 +256,96 @@ namespace tails {
 #pragma mark - COMPILER STACK CHECKER:
 
 
-    // Computes the stack effect of the word, throwing if it's inconsistent.
-    void Compiler::computeEffect() {
-        computeEffect(_words.begin(), EffectStack(_effect));
+    // If we are parsing code with unknown inputs, i.e. a quotation, and a word with the given
+    // effect takes more inputs than are on the stack, makes them inputs of this code.
+    void Compiler::addMissingInputs(const StackEffect &effect, EffectStack &curStack) {
+        if (_effectCanAddInputs) {
+            const auto nInputs = effect.inputCount();
+            auto nAvailable = curStack.depth();
+            for (auto i = int(nAvailable); i < nInputs; ++i) {
+                auto entry = effect.inputs()[i];
+                curStack.addAtBottom(entry);
+                _effect.addInputAtBottom(entry);
+            }
+        }
     }
 
 
-    // Subroutine that traces control flow, memoizing stack effects at each instruction.
-    // @param i  The item in `_words` to start at
-    // @param curStack  The known stack before the word at `i`
-    // @param finalEffect  The cumulative stack effect will be stored here.
-    // @throw compile_error if stack is inconsistent or there's an invalid branch offset.
-    void Compiler::computeEffect(InstructionPos i, EffectStack curStack)
+    // Subroutine of computeEffect that simulates a straight run of instructions, starting at `i`
+    // with the stack `curStack`, and ending at a RETURN, an unconditional branch, or a join point.
+    // It stores the known stack before each instruction along the way. When it reaches a branch
+    // or join point, it calls `mergeInto` with the destination and the stack.
+    template <class MERGE>
+    void Compiler::computeEffect(InstructionPos i, EffectStack &curStack,
+                                 const vector<bool, ArenaAllocator<bool>> &isJoin,
+                                 MERGE mergeInto)
     {
+        const InstructionPos start = i;
         while (true) {
-            assert(i != _words.end());
-            // Store (memoize) the current stack at i, or verify it matches a previously stored one:
-            if (i->knownStack) {
-                if (*i->knownStack == curStack)
-                    return;         // Nothing to do: already handled this control flow + types
+            assert(i < _words.size());
+            SourceWord &w = _words[i];
+            if (i != start) {
+                if (isJoin[i]) {
+                    mergeInto(i, curStack);
+                    return;
+                }
+                // Only one path leads here, so just store the stack:
+                if (w.knownStack)
+                    *w.knownStack = curStack;
                 else
-                    curStack.mergeWith(*i->knownStack, i->sourceCode);
+                    w.knownStack = curStack;
+            }
+            // Record the types of the items the word may operate on, for specializeInstructions.
+            // (Since the stacks only widen at each revisit, the last visit records every path.)
+            for (size_t n = 0; n < std::size(w.operandTypes); ++n)
+                w.operandTypes[n] = (n < curStack.depth()) ? curStack.typesAt(n) : TypeSet();
+
+            // An inlined word's declared inputs may be stricter than what its code implies, so
+            // check them where its code starts:
+            if (w.inlinedWord) {
+                StackEffect declared = w.inlinedWord->stackEffect();
+                addMissingInputs(declared, curStack);
+                curStack.checkInputs(w.inlinedWord, declared, w.sourceCode);
             }
-            i->knownStack = curStack;
 
             // apply the instruction's effect:
-            if (i->word == &_LITERAL) {
+            if (w.word == &_LITERAL) {
                 // A literal, just push it
-                curStack.add(i->param.literal);
+                curStack.add(w.param.literal);
             } else {
                 // Determine the effect of a word:
-                StackEffect nextEffect = i->word->stackEffect();
+                StackEffect nextEffect = w.word->stackEffect();
                 if (nextEffect.isWeird()) {
-                    if (i->word == &_RECURSE) {
+                    if (w.word == &_RECURSE) {
                         if (_effectCanAddInputs || _effectCanAddOutputs)
                             throw compile_error("RECURSE requires an explicit stack effect declaration",
-                                                i->sourceCode);
+                                                w.sourceCode);
                         nextEffect = _effect;
-                        if (!returnsImmediately(next(i))) {
+                        if (!returnsImmediately(i + 1)) {
                             if (_flags & Word::Inline)
                                 throw compile_error("Illegal recursion in an inline word",
-                                                    i->sourceCode);
-                            nextEffect = nextEffect.withUnknownMax();   // non-tail recursion
+                                                    w.sourceCode);
+                            // Non-tail recursion. The recursive call's stack growth doesn't
+                            // count toward this word's max, since `_RECURSE` moves to a new
+                            // stack segment if there isn't room for it.
+                            nextEffect = nextEffect.withMinimalMax();
                         }
-                    } else if (i->word == &IFELSE) {
+                    } else if (w.word == &IFELSE) {
                         nextEffect = effectOfIFELSE(i, curStack);
+                    } else if (w.word == &_SHUFFLE) {
+                        nextEffect = effectOfShuffle(w.param.shuffle);
                     } else {
-                        throw compile_error("Oops, don't know word's stack effect", i->sourceCode);
+                        throw compile_error("Oops, don't know word's stack effect", w.sourceCode);
                     }
                 }
 
-                if (_effectCanAddInputs) {
-                    // We are parsing code with unknown inputs, i.e. a quotation. If the word being
-                    // called takes more inputs than are on the stack, make them inputs of this code.
-                    const auto nInputs = nextEffect.inputCount();
-                    auto nAvailable = curStack.depth();
-                    for (auto i = int(nAvailable); i < nInputs; ++i) {
-                        auto entry = nextEffect.inputs()[i];
-                        curStack.addAtBottom(entry);
-                        _effect.addInputAtBottom(entry);
-                    }
-                }
+                addMissingInputs(nextEffect, curStack);
 
                 // apply the word's effect:
-                curStack.add(i->word, nextEffect, i->sourceCode);
+                curStack.add(w.word, nextEffect, w.sourceCode);
             }
 
-            if (i->word == &_RETURN) {
+            if (w.word == &_RETURN) {
                 // The stack when RETURN is reached determines the word's output effect.
                 curStack.checkOutputs(_effect, _effectCanAddOutputs);
                 _effectCanAddOutputs = false;
@@ -275,23 +353,97 @@ namespace tails {
                     _effect = _effect.withMax(int(curStack.maxGrowth()));
                 return;
 
-            } else if (i->word == &_BRANCH || i->word == &_ZBRANCH) {
-                assert(i->branchTo);
-                // If this is a 0BRANCH, recurse to follow the non-branch case too:
-                if (i->word == &_ZBRANCH)
-                    computeEffect(next(i), curStack);
+            } else if (w.word == &_BRANCH || w.word == &_ZBRANCH || w.word == &_DO
+                                              || w.word == &_LOOP || w.word == &_PLUSLOOP) {
+                assert(w.branchTo);
+                mergeInto(*w.branchTo, curStack);
+                // If this is a conditional branch, continue with the non-branch case too:
+                if (w.word == &_BRANCH)
+                    return;
+            }
+            ++i;
+        }
+    }
+
+
+    // Computes the stack effect of the word, throwing if it's inconsistent.
+    // This is a forward dataflow analysis: the known stack before each instruction is stored in
+    // its `knownStack`. Where control flow joins, at a branch destination, the incoming stacks are
+    // merged; the instruction is only (re)visited when that widens its stack. Pending join points
+    // are visited in order, so in code without loops each one is visited once, after all the
+    // paths into it have been merged; a loop revisits its body only until its types stabilize.
+    // @throw compile_error if stack is inconsistent or there's an invalid branch offset.
+    void Compiler::computeEffect() {
+        auto isBranch = [](const Word *word) {
+            return word == &_BRANCH || word == &_ZBRANCH || word == &_DO
+                || word == &_LOOP || word == &_PLUSLOOP;
+        };
+
+        // Find the join points, and make sure no stacks are left from a previous run:
+        vector<bool, ArenaAllocator<bool>> isJoin(_words.size(), false, *_arena);
+        for (auto &w : _words) {
+            w.knownStack = nullopt;
+            if (isBranch(w.word)) {
+                assert(w.branchTo);
+                isJoin[*w.branchTo] = true;
+            }
+        }
 
-                // Follow the branch:
-                i = *i->branchTo;
+        // The join points waiting to be visited, as a min-heap:
+        vector<InstructionPos, ArenaAllocator<InstructionPos>> pending(*_arena);
+        vector<bool, ArenaAllocator<bool>> isPending(_words.size(), false, *_arena);
+        auto addPending = [&](InstructionPos i) {
+            if (!isPending[i]) {
+                isPending[i] = true;
+                pending.push_back(i);
+                std::push_heap(pending.begin(), pending.end(), std::greater<>());
+            }
+        };
 
+        // Merges a stack into the known stack of a join point:
+        auto mergeInto = [&](InstructionPos i, const EffectStack &stack) {
+            auto &known = _words[i].knownStack;
+            if (!known) {
+                known = stack;
+                addPending(i);
+            } else if (known->mergeWith(stack, _words[i].sourceCode)) {
+                addPending(i);
             } else {
-                // Continue to next instruction:
-                ++i;
+                // Nothing new to visit. But the path that got here (e.g. a loop body) may have
+                // grown the stack more:
+                if (stack.maxGrowth() > _effect.max())
+                    _effect = _effect.withMax(int(stack.maxGrowth()));
             }
+        };
+
+        EffectStack curStack(_effect, *_arena);     // (reused for each visit)
+        _words[0].knownStack = curStack;
+        addPending(0);
+        while (!pending.empty()) {
+            std::pop_heap(pending.begin(), pending.end(), std::greater<>());
+            InstructionPos i = pending.back();
+            pending.pop_back();
+            isPending[i] = false;
+            curStack = *_words[i].knownStack;
+            computeEffect(i, curStack, isJoin, mergeInto);
         }
     }
 
 
+    // The stack effect of a `_SHUFFLE` (which can appear in an inlined word): each output
+    // matches the input it's a copy of.
+    StackEffect Compiler::effectOfShuffle(ShuffleParam shuffle) {
+        assert(shuffle.inputs <= kMaxShuffleInputs
+               && shuffle.inputs + shuffle.outputs <= StackEffect::kMaxEntries);
+        StackEffect effect;
+        for (int i = 0; i < shuffle.inputs; ++i)
+            effect.addInput(TypeSet::anyType());
+        for (int i = shuffle.outputs - 1; i >= 0; --i)
+            effect.addOutput(TypeSet::anyType() / shuffle.source(i));
+        return effect.withMax(max(0, shuffle.outputs - shuffle.inputs));
+    }
+
+
     StackEffect Compiler::effectOfIFELSE(InstructionPos pos, EffectStack &curStack) {
         // Special case for IFELSE, which has a non-constant stack effect.
         // The two top stack items must be literal quotation values (not just types):
@@ -300,7 +452,7 @@ namespace tails {
                 if (auto quote = valP->asQuote(); quote)
                     return quote->stackEffect();
             }
-            throw compile_error("IFELSE must be preceded by two quotations", pos->sourceCode);
+            throw compile_error("IFELSE must be preceded by two quotations", _words[pos].sourceCode);
         };
         StackEffect a = getQuoteEffect(1), b = getQuoteEffect(0);
 
@@ -316,7 +468,7 @@ namespace tails {
                 entry = entry & result.inputs()[i];
                 if (!entry)
                     throw compile_error(format("IFELSE quotes have incompatible parameter #%d", i),
-                                        pos->sourceCode);
+                                        _words[pos].sourceCode);
                 result.inputs()[i] = entry;
             } else {
                 result.addInput(entry);
@@ -20,13 +20,18 @@
 #include "compiler+stackcheck.hh"
 #include "disassembler.hh"
 #include "core_words.hh"
+#include "native_code.hh"
+#include "register_code.hh"
 #include "stack_effect_parser.hh"
 #include "utils.hh"
 #include "vocabulary.hh"
+#include <algorithm>
+#include <array>
 #include <optional>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 
 
 namespace tails {
@@ -38,32 +43,85 @@ namespace tails {
 
 
     CompiledWord::CompiledWord(string &&name, StackEffect effect, vector<Instruction> &&instrs)
+    :CompiledWord(Unregistered{}, move(name), effect, move(instrs))
+    {
+        translate();
+        addToVocabulary();
+    }
+
+
+    CompiledWord::CompiledWord(Unregistered, string &&name, StackEffect effect,
+                               vector<Instruction> &&instrs)
     :_nameStr(toupper(name))
     ,_instrs(move(instrs))
     {
         _effect = effect;
         _instr = &_instrs.front();
-        if (!_nameStr.empty()) {
+        _instrCount = uint32_t(_instrs.size());
+        if (!_nameStr.empty())
             _name = _nameStr.c_str();
+    }
+
+
+    // Adds a named word to the current vocabulary. This must come after anything that changes
+    // its instructions, since the vocabulary indexes words by their first instruction.
+    void CompiledWord::addToVocabulary() {
+        if (!_nameStr.empty())
             Compiler::activeVocabularies.current()->add(*this);
-        }
     }
 
 
     CompiledWord::CompiledWord(Compiler &&compiler)
-    :CompiledWord(move(compiler._name), {}, compiler.generateInstructions())
+    :CompiledWord(Unregistered{}, move(compiler._name), {}, compiler.generateInstructions())
     {
         // Compiler's flags & effect are not valid until after generateInstructions(), above.
         assert((compiler._flags & ~(Word::Inline | Word::Recursive | Word::Magic)) == 0);
         _flags = compiler._flags;
         _effect = compiler._effect;
+        _inlined = move(compiler._inlined);
+        translate();
+        addToVocabulary();
     }
 
 
     CompiledWord::CompiledWord(const CompiledWord &word, std::string &&name)
-    :CompiledWord(move(name), word.stackEffect(), vector<Instruction>(word._instrs))
+    :CompiledWord(Unregistered{}, move(name), word.stackEffect(), word.threadedCode())
     {
         _flags = word._flags;
+        _inlined = word._inlined;
+        translate();
+        addToVocabulary();
+    }
+
+
+    // Returns a copy of the instructions, minus the `_JIT` or `_REGS` prologue if any.
+    vector<Instruction> CompiledWord::threadedCode() const {
+        auto begin = _instrs.begin();
+        if (_registers)
+            begin += 2;
+#ifdef ENABLE_NATIVE_CODEGEN
+        else if (_native)
+            begin += 2;
+#endif
+        return vector<Instruction>(begin, _instrs.end());
+    }
+
+
+    // Translates the code to register code, or failing that to native code, if those are enabled,
+    // and prepends the `_REGS` or `_JIT` instruction that runs the translation. (This has to wait
+    // until the stack effect is known, since register code needs it.)
+    void CompiledWord::translate() {
+        auto prepend = [&](Instruction op, Instruction param) {
+            _instrs.insert(_instrs.begin(), {op, param});
+            _instr = &_instrs.front();
+            _instrCount = uint32_t(_instrs.size());
+        };
+        if ((_registers = RegisterCode::translate(_instrs, _effect)))
+            prepend(_REGS, Instruction::withRegisters(_registers.get()));
+#ifdef ENABLE_NATIVE_CODEGEN
+        else if ((_native = NativeCode::translate(_instrs)))
+            prepend(_JIT, _native->entryPoint());
+#endif
     }
 
 
@@ -73,8 +131,12 @@ namespace tails {
     VocabularyStack Compiler::activeVocabularies;
 
 
-    Compiler::Compiler() {
+    Compiler::Compiler()
+    :_arena(make_unique<Arena>())
+    ,_words(ArenaAllocator<SourceWord>(*_arena))
+    {
         assert(activeVocabularies.current() != nullptr);
+        _words.reserve(64);
         _words.push_back({NOP});
     }
 
@@ -102,43 +164,220 @@ namespace tails {
 
 
     Compiler::InstructionPos Compiler::add(const WordRef &ref, const char *source) {
-        auto i = prev(_words.end());
-        bool isDst = i->isBranchDestination;
-        *i = SourceWord(ref, source);
-        i->isBranchDestination = isDst;  // preserve this flag
+        InstructionPos i = _words.size() - 1;
+        bool isDst = _words[i].isBranchDestination;
+        const Word *inlinedWord = _words[i].inlinedWord;
+        _words[i] = SourceWord(ref, source);
+        _words[i].isBranchDestination = isDst;  // preserve these
+        _words[i].inlinedWord = inlinedWord;
 
         _words.push_back({NOP});
         return i;
     }
 
 
+    // Returns the first fusion rule, built-in or generated, for which `pred` returns true.
+    template <class PRED>
+    static const Fusion* findFusionWhere(PRED pred) {
+        for (auto rules : {kFusions, kGeneratedFusions}) {
+            for (auto f = rules; f->fused; ++f) {
+                if (pred(*f))
+                    return f;
+            }
+        }
+        return nullptr;
+    }
+
+
+    // Returns the rule that fuses `first` followed by `second`, or nullptr.
+    static const Fusion* findFusion(const Word *first, const Word *second) {
+        // `0` and `1` are literals too:
+        if (first == &ZERO || first == &ONE)
+            first = &_LITERAL;
+        if (second == &ZERO || second == &ONE)
+            second = &_LITERAL;
+        return findFusionWhere([=](const Fusion &f) {
+            return f.first == first && f.second == second;
+        });
+    }
+
+
+    // Returns the rule that produces the superinstruction `fused`, or nullptr.
+    static const Fusion* findFusionFor(const Word *fused) {
+        return findFusionWhere([=](const Fusion &f) {return f.fused == fused;});
+    }
+
+
+    // Returns the numbers-only specialization that `word` is the generic word or a variant of.
+    static const Specialization* findSpecialization(const Word *word) {
+        for (auto s = kNumericSpecializations; s->numeric; ++s) {
+            if (s->generic == word || s->isVariant(word))
+                return s;
+        }
+        return nullptr;
+    }
+
+
+    // Returns the quickening rule involving `word` in any role, or nullptr.
+    static const Quickening* findQuickening(const Word *word) {
+        for (auto q = kQuickenings; q->generic; ++q) {
+            if (q->generic == word || q->quickening == word || q->quickened == word)
+                return q;
+        }
+        return nullptr;
+    }
+
+
+    // Adds an instruction, first splitting a superinstruction back into its components, so that
+    // the stack checker sees the literal and so it can be fused again in its new context.
+    // Likewise, a numbers-only or quickening word reverts to its generic form, to be specialized
+    // again in its new context.
+    void Compiler::addUnfused(const WordRef &ref, const char *source) {
+        if (auto spec = findSpecialization(ref.word); spec && spec->isVariant(ref.word)) {
+            WordRef generic = ref;
+            generic.word = spec->generic;
+            addUnfused(generic, source);
+        } else if (auto q = findQuickening(ref.word); q && ref.word != q->generic) {
+            add({*q->generic}, source);
+        } else if (auto fusion = findFusionFor(ref.word); fusion) {
+            for (const Word *part : {fusion->first, fusion->second}) {
+                if (part->parameters())
+                    addUnfused(WordRef(*part, ref.param), source);
+                else
+                    addUnfused(WordRef(*part), source);
+            }
+        } else {
+            add(ref, source);
+        }
+    }
+
+
     void Compiler::addInline(const Word &word, const char *source) {
         if (word.isNative()) {
             add({word});
-        } else {
-            Disassembler dis(word.instruction().word);
-            while (true) {
-                WordRef ref = dis.next();
-                if (ref.word == &_RETURN)
-                    break;
-                add(ref, source);
+            return;
+        }
+        // The stack checker checks the word's declared inputs where its code starts. (If another
+        // inlined word with no code already starts there, just call this one.)
+        if (_words.back().inlinedWord) {
+            add({word}, source);
+            return;
+        }
+        _words.back().inlinedWord = &word;
+        // Remember where each of the word's instructions ends up, and which of them branch where,
+        // so the branches can be pointed at their new destinations afterwards:
+        vector<pair<const Instruction*, InstructionPos>> positions;
+        vector<pair<InstructionPos, const Instruction*>> branches;
+        Disassembler dis(word);
+        const Instruction *end = word.instruction().word + word.instructionCount();
+        while (dis) {
+            const Instruction *pc = dis.pc();
+            WordRef ref = dis.next();
+            positions.push_back({pc, _words.size() - 1});
+            if (ref.word == &_REGS)
+                continue;
+#ifdef ENABLE_NATIVE_CODEGEN
+            if (ref.word == &_JIT)
+                continue;
+#endif
+            if (ref.word == &_RETURN) {
+                // Returning means going on to whatever's added after the word:
+                if (dis)
+                    branches.push_back({add({_BRANCH, intptr_t(-1)}, source), end});
+                continue;
             }
+            addUnfused(ref, source);
+            if (ref.word->hasIntParams()) {
+                // A superinstruction is split up, but the branch, if any, is its last part:
+                InstructionPos last = _words.size() - 2;
+                auto branch = _words[last].word;
+                if (branch == &_BRANCH || branch == &_ZBRANCH || branch == &_DO
+                                       || branch == &_LOOP || branch == &_PLUSLOOP)
+                    branches.push_back({last, pc + 2 + ref.param.offset});
+            }
+        }
+        positions.push_back({end, _words.size() - 1});
+        for (auto [src, dst] : branches) {
+            auto i = find_if(positions.begin(), positions.end(),
+                             [=](auto &pos) {return pos.first == dst;});
+            assert(i != positions.end());
+            setBranch(src, i->second);
+        }
+        _inlined.push_back(&word);
+    }
+
+
+    bool Compiler::shouldInline(const Word &word) const {
+        if (word.hasFlag(Word::Inline))
+            return true;
+        if (word.isNative() || word.hasFlag(Word::Recursive) || inlineBudget == 0)
+            return false;
+        size_t size = _words.size() - 1;
+        size_t budget = inlineBudget * kFullInlineBudgetSize / max(size, kFullInlineBudgetSize);
+        size_t count = 0;
+        for (Disassembler dis(word); dis;) {
+            WordRef ref = dis.next();
+            if (ref.word == &_RECURSE)
+                return false;
+            if (ref.word == &_REGS)
+                continue;
+#ifdef ENABLE_NATIVE_CODEGEN
+            if (ref.word == &_JIT)
+                continue;
+#endif
+            if ((ref.word != &_RETURN || dis) && ++count > budget)
+                return false;
         }
+        return true;
     }
 
 
     void Compiler::addRecurse() {
-        add({_RECURSE, intptr_t(-1)})->branchesTo(_words.begin());
+        setBranch(add({_RECURSE, intptr_t(-1)}), 0);
     }
 
 
     void Compiler::addBranchBackTo(InstructionPos pos) {
-        add({_BRANCH, intptr_t(-1)})->branchesTo(pos);
+        setBranch(add({_BRANCH, intptr_t(-1)}), pos);
     }
 
 
     void Compiler::fixBranch(InstructionPos src) {
-        src->branchesTo(prev(_words.end()));
+        setBranch(src, _words.size() - 1);
+    }
+
+
+    void Compiler::setBranch(InstructionPos src, InstructionPos dst) {
+        _words[src].branchTo = dst;
+        _words[dst].isBranchDestination = true;
+    }
+
+
+    /// Adds a `_LOOP` or `_PLUSLOOP` that branches back to the start of the innermost DO loop,
+    /// and points the `_DO` and any `LEAVE` branches out of the loop to the next instruction.
+    void Compiler::addLoopEnd(const Word &loopWord, const char *source) {
+        auto depth = loopDepth();
+        auto doPos = popBranch("d");
+        setBranch(add({loopWord, intptr_t(-1)}, source), doPos + 1);
+        fixBranch(doPos);
+        for (auto i = _leaves.begin(); i != _leaves.end();) {
+            if (i->first == depth) {
+                fixBranch(i->second);
+                i = _leaves.erase(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+
+
+    /// Adds a `_UNLOOP` and a `BRANCH` out of the innermost DO loop, to be fixed by addLoopEnd.
+    void Compiler::addLeave(const char *source) {
+        auto depth = loopDepth();
+        if (depth == 0)
+            throw compile_error("LEAVE must be inside a DO loop", source);
+        add({_UNLOOP}, source);
+        _leaves.push_back({depth, add({_BRANCH, intptr_t(-1)}, source)});
     }
 
 
@@ -149,7 +388,7 @@ namespace tails {
         if (branch)
             branchRef = add({*branch, intptr_t(-1)}, _curToken.data());
         else
-            branchRef = prev(_words.end()); // Will point to next word to be added
+            branchRef = _words.size() - 1;  // Will point to next word to be added
         _controlStack.push_back({identifier, branchRef});
     }
 
@@ -166,95 +405,623 @@ namespace tails {
         throw compile_error("no matching IF or WHILE", _curToken.data());
     }
 
+    /// The number of DO loops the next instruction is nested in.
+    size_t Compiler::loopDepth() const {
+        return std::count_if(_controlStack.begin(), _controlStack.end(),
+                             [](const BranchTarget &b) {return b.first == 'd';});
+    }
+
 
     // Returns true if this instruction a RETURN, or a BRANCH to a RETURN.
     bool Compiler::returnsImmediately(Compiler::InstructionPos pos) {
-        if (pos->word == &_BRANCH)
-            return returnsImmediately(*pos->branchTo);
+        auto &w = _words[pos];
+        if (w.word == &_BRANCH)
+            return returnsImmediately(*w.branchTo);
         else
-            return (pos->word == &_RETURN);
+            return (w.word == &_RETURN);
+    }
+
+
+    // Replaces each pure word whose inputs are pushed by literals just before it with literals
+    // of its results, which the stack checker has already computed; `60 60 * 1000 *` becomes
+    // `3600000`. Removes a `0BRANCH` whose condition is a literal, or makes it a `BRANCH`.
+    // Returns true if anything changed, in which case the stack effects must be recomputed.
+    bool Compiler::foldConstants() {
+        if (!foldingEnabled)
+            return false;
+        auto isConstant = [](const SourceWord &w) {
+            return w.word == &_LITERAL || (w.word->hasFlag(Word::Pure)
+                                                && w.word->stackEffect().inputCount() == 0);
+        };
+
+        bool changed = false;
+        // The consecutive literal-pushing instructions just before `i`:
+        vector<InstructionPos, ArenaAllocator<InstructionPos>> constants(*_arena);
+        for (InstructionPos i = 0; i < _words.size(); ++i) {
+            auto &w = _words[i];
+            if (!w.word)
+                continue;
+            if (w.isBranchDestination || !w.knownStack)
+                constants.clear();
+            if (!w.knownStack)
+                continue;                                   // unreachable
+            if (isConstant(w)) {
+                constants.push_back(i);
+                continue;
+            }
+
+            auto effect = w.word->stackEffect();
+            auto nInputs = effect.isWeird() ? SIZE_MAX : size_t(effect.inputCount());
+            auto nOutputs = effect.isWeird() ? SIZE_MAX : size_t(effect.outputCount());
+            if (w.word->hasFlag(Word::Pure) && nInputs <= constants.size()
+                                            && nOutputs <= nInputs + 1) {
+                // The inputs' instructions and this one are replaced by the outputs' literals:
+                const EffectStack &after = *_words[i + 1].knownStack;
+                assert(nInputs < StackEffect::kMaxEntries);
+                std::array<InstructionPos, StackEffect::kMaxEntries + 1> slots;
+                std::copy(constants.end() - nInputs, constants.end(), slots.begin());
+                slots[nInputs] = i;
+                bool ok = (nOutputs > 0 || !_words[slots[0]].isBranchDestination);
+                for (size_t n = 0; n < nOutputs; ++n)
+                    ok = ok && after.literalAt(n);
+                if (ok) {
+                    constants.resize(constants.size() - nInputs);
+                    for (size_t n = 0; n <= nInputs; ++n) {
+                        auto &s = _words[slots[n]];
+                        if (n < nOutputs) {
+                            s.word = &_LITERAL;
+                            s.param = *after.literalAt(nOutputs - 1 - n);
+                            constants.push_back(slots[n]);
+                        } else {
+                            s.word = nullptr;
+                        }
+                    }
+                    changed = true;
+                    continue;
+                }
+            } else if (w.word == &_ZBRANCH && !constants.empty()
+                                           && !_words[constants.back()].isBranchDestination) {
+                // The condition is a literal, so the branch is either always or never taken:
+                Value cond = *w.knownStack->literalAt(0);
+                _words[constants.back()].word = nullptr;
+                constants.pop_back();
+                changed = true;
+                if (cond) {
+                    w.word = nullptr;
+                    continue;
+                }
+                w.word = &_BRANCH;  // (and the literals before it can't flow past it)
+            }
+            constants.clear();
+        }
+        if (!changed)
+            return false;
+
+        // Some instructions may no longer be branched to, making code after them unreachable:
+        for (auto &w : _words)
+            w.isBranchDestination = false;
+        for (auto &w : _words) {
+            if (w.word && w.branchTo)
+                _words[*w.branchTo].isBranchDestination = true;
+        }
+        compact();
+        for (auto &w : _words) {
+            w.knownStack = nullopt;
+            std::fill(std::begin(w.operandTypes), std::end(w.operandTypes), TypeSet());
+        }
+        return true;
+    }
+
+
+    // The stack-shuffling words simplifyStackOps understands, indexed by op number.
+    static const Word* const kShuffleWords[] = {&DUP, &DROP, &SWAP, &OVER, &ROT};
+    static constexpr int kPushLiteral = std::size(kShuffleWords);  // +n pushes literal #n
+
+    // A simulated stack, bottom first. An item is an input (0 is the top one) or a literal,
+    // which is `kLiteralItem` + its index.
+    using ShuffleStack = string;
+    static constexpr char kLiteralItem = 64;
+
+    // True if a word just rearranges stack items. (An output's input match only says that it
+    // has the same type as that input, but for these words it's a copy of it.)
+    static bool isShuffleWord(const Word *word) {
+        return std::find(std::begin(kShuffleWords), std::end(kShuffleWords), word)
+                    != std::end(kShuffleWords);
+    }
+
+    // Applies the effect of a stack-shuffling word to a simulated stack, by way of its outputs'
+    // input matches. Returns false if it would underflow the stack.
+    static bool applyShuffle(ShuffleStack &s, const StackEffect &effect) {
+        const size_t nInputs = effect.inputCount();
+        if (s.size() < nInputs)
+            return false;
+        char in[StackEffect::kMaxEntries];
+        for (size_t i = 0; i < nInputs; ++i)
+            in[i] = s[s.size() - 1 - i];
+        s.resize(s.size() - nInputs);
+        for (int i = effect.outputCount() - 1; i >= 0; --i)
+            s.push_back(in[effect.outputs()[i].inputMatch()]);
+        return true;
+    }
+
+    // Applies a stack-shuffling op, or pushes a literal, to a simulated stack.
+    // Returns false if the op would underflow it.
+    static bool applyShuffle(ShuffleStack &s, int op) {
+        if (op >= kPushLiteral) {
+            s.push_back(char(kLiteralItem + op - kPushLiteral));
+            return true;
+        }
+        return applyShuffle(s, kShuffleWords[op]->stackEffect());
+    }
+
+
+    // Finds the shortest sequence of ops that turns `start` into `target` without the stack
+    // growing past `maxDepth`, by breadth-first search. As in the original sequence, literals
+    // are pushed at most once each, in order (though some may be skipped.) Returns false if
+    // there's no sequence shorter than `maxLength`.
+    static bool shortestShuffle(const ShuffleStack &start, const ShuffleStack &target,
+                                size_t maxDepth, int nLiterals, size_t maxLength,
+                                vector<int> &outOps)
+    {
+        // A search state is the number of literals pushed so far, followed by the stack.
+        // Each state reached maps to the state it was reached from, and the op that did it:
+        ShuffleStack first = char(0) + start;
+        unordered_map<ShuffleStack, pair<ShuffleStack,int>> from {{first, {first, -1}}};
+        vector<ShuffleStack> level {first};
+        for (size_t length = 0; length < maxLength; ++length) {
+            for (auto &state : level) {
+                if (state.compare(1, string::npos, target) == 0) {
+                    outOps.clear();
+                    for (auto cur = state; cur != first; ) {
+                        auto &[prev, op] = from[cur];
+                        outOps.insert(outOps.begin(), op);
+                        cur = prev;
+                    }
+                    return true;
+                }
+            }
+            vector<ShuffleStack> next;
+            for (auto &state : level) {
+                int nPushed = state[0];
+                for (int op = 0; op < kPushLiteral + nLiterals; ++op) {
+                    if (op == kPushLiteral)
+                        op += nPushed;              // (skip literals already pushed)
+                    if (op >= kPushLiteral + nLiterals)
+                        break;
+                    ShuffleStack stack = state.substr(1);
+                    if (!applyShuffle(stack, op) || stack.size() > maxDepth)
+                        continue;
+                    int pushed = (op >= kPushLiteral) ? op - kPushLiteral + 1 : nPushed;
+                    auto n = char(pushed) + stack;
+                    if (from.emplace(n, make_pair(state, op)).second)
+                        next.push_back(move(n));
+                }
+            }
+            level = move(next);
+        }
+        return false;
+    }
+
+
+    // Finds runs of adjacent stack-shuffling words and literals, simulates each one, and
+    // replaces it with the shortest sequence that has the same effect on the stack; so
+    // `SWAP SWAP`, `DUP DROP` and `ROT ROT ROT` disappear, and `OVER SWAP DROP` becomes
+    // `DROP DUP`. A run never extends past a branch destination.
+    void Compiler::simplifyStackOps() {
+        if (!peepholeEnabled)
+            return;
+        static constexpr size_t kMaxRun = 6;    // Longer runs are handled in pieces
+        auto shuffleOp = [](const SourceWord &w) -> int {
+            auto i = std::find(std::begin(kShuffleWords), std::end(kShuffleWords), w.word);
+            if (i != std::end(kShuffleWords))
+                return int(i - std::begin(kShuffleWords));
+            else if (w.word == &_LITERAL || w.word == &ZERO || w.word == &ONE || w.word == &NULL_)
+                return kPushLiteral;
+            return -1;
+        };
+
+        size_t removed = 0;
+        vector<int> ops;
+        for (InstructionPos i = 0; i < _words.size(); ) {
+            // Collect the run starting at `i`:
+            InstructionPos run[kMaxRun];
+            size_t len = 0;
+            for (auto j = i; j < _words.size() && len < kMaxRun; ++j) {
+                if (shuffleOp(_words[j]) < 0 || (len > 0 && _words[j].isBranchDestination))
+                    break;
+                run[len++] = j;
+            }
+            i += std::max(len, size_t(1));
+            if (len < 2)
+                continue;
+            // Literals, `DUP` and `OVER` each push one item, so a run of just those can't be
+            // made any shorter:
+            if (std::all_of(&run[0], &run[len], [&](InstructionPos j) {
+                    auto word = _words[j].word;
+                    return word == &DUP || word == &OVER || shuffleOp(_words[j]) == kPushLiteral;
+                }))
+                continue;
+
+            // Number the run's literals in order:
+            int runOps[kMaxRun], nLiterals = 0;
+            InstructionPos literals[kMaxRun];
+            for (size_t n = 0; n < len; ++n) {
+                runOps[n] = shuffleOp(_words[run[n]]);
+                if (runOps[n] == kPushLiteral) {
+                    literals[nLiterals] = run[n];
+                    runOps[n] += nLiterals++;
+                }
+            }
+
+            // Simulate the run to count its inputs, then again starting with those inputs:
+            size_t nInputs = 0;
+            ShuffleStack stack;
+            for (size_t n = 0; n < len; ++n) {
+                while (!applyShuffle(stack, runOps[n])) {
+                    stack.insert(stack.begin(), char(0));
+                    ++nInputs;
+                }
+            }
+            ShuffleStack start;
+            for (size_t n = nInputs; n > 0; --n)
+                start.push_back(char(n - 1));
+            ShuffleStack target = start;
+            size_t maxDepth = target.size();
+            for (size_t n = 0; n < len; ++n) {
+                applyShuffle(target, runOps[n]);
+                maxDepth = std::max(maxDepth, target.size());
+            }
+
+            if (!shortestShuffle(start, target, maxDepth, nLiterals, len, ops))
+                continue;
+            if (ops.empty() && _words[run[0]].isBranchDestination)
+                continue;   // (a branch destination can't be removed)
+
+            // Rewrite the run, reusing the instructions that pushed the literals:
+            SourceWords newWords(*_arena);
+            for (int op : ops) {
+                if (op >= kPushLiteral)
+                    newWords.push_back(_words[literals[op - kPushLiteral]]);
+                else
+                    newWords.emplace_back(*kShuffleWords[op], _words[run[0]].sourceCode);
+            }
+            for (size_t n = 0; n < len; ++n) {
+                auto &w = _words[run[n]];
+                bool isDst = w.isBranchDestination;
+                if (n < newWords.size())
+                    w = newWords[n];
+                else
+                    w.word = nullptr;
+                w.isBranchDestination = isDst;
+            }
+            removed += len - ops.size();
+        }
+        if (removed > 0) {
+            peepholeRemoved += removed;
+            compact();
+        }
+    }
+
+
+    // Replaces each run of adjacent stack-shuffling words, like `SWAP ROT OVER`, with a single
+    // `_SHUFFLE`, when that's cheaper. A `_SHUFFLE` costs more than one of the simple shuffles, so
+    // it has to save at least `kMinShuffleSavings` dispatches -- unless the run already has a
+    // `_SHUFFLE` in it (from an inlined word.) This runs after fuseInstructions, so it doesn't
+    // take words that could have been fused with their neighbors. A run never extends past a
+    // branch destination, and is limited to what a `_SHUFFLE`'s stack effect can describe.
+    void Compiler::collapseShuffles() {
+        if (!peepholeEnabled)
+            return;
+        auto effectOf = [](const SourceWord &w) -> optional<StackEffect> {
+            if (w.word == &_SHUFFLE)
+                return effectOfShuffle(w.param.shuffle);
+            else if (isShuffleWord(w.word))
+                return w.word->stackEffect();
+            return nullopt;
+        };
+
+        bool changed = false;
+        for (InstructionPos i = 0; i < _words.size(); ) {
+            // Simulate as long a run as possible starting at `i`. Inputs are numbered from the
+            // top down, so each input found deeper in the stack gets the next number:
+            ShuffleStack stack;
+            size_t nInputs = 0;
+            InstructionPos end;
+            for (end = i; end < _words.size(); ++end) {
+                auto effect = effectOf(_words[end]);
+                if (!effect || (end > i && _words[end].isBranchDestination))
+                    break;
+                ShuffleStack next = stack;
+                size_t nextInputs = nInputs;
+                while (next.size() < size_t(effect->inputCount()))
+                    next.insert(next.begin(), char(nextInputs++));
+                applyShuffle(next, *effect);
+                if (nextInputs > kMaxShuffleInputs
+                        || nextInputs + next.size() > StackEffect::kMaxEntries)
+                    break;
+                stack = move(next);
+                nInputs = nextInputs;
+            }
+
+            bool hasShuffle = false;
+            for (auto j = i; j < end; ++j)
+                hasShuffle = hasShuffle || _words[j].word == &_SHUFFLE;
+            if (end - i > (hasShuffle ? 1 : kMinShuffleSavings)) {
+                ShuffleParam shuffle {uint8_t(nInputs), uint8_t(stack.size()), 0};
+                for (int n = 0; n < shuffle.outputs; ++n)
+                    shuffle.setSource(n, stack[stack.size() - 1 - n]);
+                _words[i].word = &_SHUFFLE;
+                _words[i].param = shuffle;
+                for (auto j = i + 1; j < end; ++j)
+                    _words[j].word = nullptr;
+                changed = true;
+            }
+            i = std::max(end, i + 1);
+        }
+        if (changed)
+            compact();
+    }
+
+
+    // Combines pairs of adjacent instructions into superinstructions, according to `kFusions`
+    // and `kGeneratedFusions`. A pair can't be fused if its second instruction is a branch
+    // destination. Longer sequences are fused by rules whose `first` is itself a superinstruction.
+    void Compiler::fuseInstructions() {
+        if (!fusionEnabled)
+            return;
+        // The next instruction after `i` that hasn't been fused into its predecessor:
+        auto after = [&](InstructionPos i) {
+            do ++i; while (i < _words.size() && !_words[i].word);
+            return i;
+        };
+        auto fusable = [&](InstructionPos i) {
+            auto n = after(i);
+            return n < _words.size() && !_words[n].isBranchDestination;
+        };
+        auto fusionAt = [&](InstructionPos i) -> const Fusion* {
+            if (i >= _words.size() || !fusable(i))
+                return nullptr;
+            return findFusion(_words[i].word, _words[after(i)].word);
+        };
+
+        for (InstructionPos i = 0; i < _words.size();) {
+            auto fusion = fusionAt(i);
+            // If the second instruction could instead fuse with the one after it, let it;
+            // this way `> 0BRANCH` wins over `1 >`. But not if this pair's superinstruction
+            // could itself fuse with the third instruction.
+            if (fusion && fusionAt(after(i))) {
+                auto n = after(i);
+                if (!fusable(n) || !findFusion(fusion->fused, _words[after(n)].word))
+                    fusion = nullptr;
+            }
+            if (!fusion) {
+                i = after(i);
+                continue;
+            }
+            auto &w = _words[i], &n = _words[after(i)];
+            if (w.word == &ZERO || w.word == &ONE)
+                w.param = Value(w.word == &ONE ? 1 : 0);
+            else if (n.word == &ZERO || n.word == &ONE)
+                w.param = Value(n.word == &ONE ? 1 : 0);
+            else if (n.word->parameters())
+                w.param = n.param;
+            if (n.branchTo)
+                w.branchTo = n.branchTo;
+            w.word = fusion->fused;
+            n.word = nullptr;
+            // Don't advance `i`: the fused instruction may fuse again with its new successor.
+        }
+        compact();
+    }
+
+
+    // Erases the instructions that have been removed (whose `word` is null), and updates the
+    // branches to account for the instructions' new positions.
+    void Compiler::compact() {
+        vector<InstructionPos, ArenaAllocator<InstructionPos>> newPos(_words.size(), 0,
+                                                                      *_arena);
+        InstructionPos n = 0;
+        for (InstructionPos i = 0; i < _words.size(); ++i) {
+            newPos[i] = n;
+            if (_words[i].word)
+                ++n;
+        }
+        n = 0;
+        for (InstructionPos i = 0; i < _words.size(); ++i) {
+            auto &w = _words[i];
+            if (!w.word)
+                continue;
+            if (w.branchTo) {
+                assert(_words[*w.branchTo].word);   // branch destinations are never removed
+                w.branchTo = newPos[*w.branchTo];
+            }
+            if (n != i)
+                _words[n] = std::move(w);
+            ++n;
+        }
+        _words.erase(_words.begin() + n, _words.end());
+    }
+
+
+    // Replaces arithmetic and comparison words with their numbers-only variants, where the stack
+    // checker has proven that all their operands are numbers: the integer-only or double-only
+    // variant if they're all integers or all doubles. This runs after fuseInstructions, since the
+    // fusion rules only know the generic words.
+    // If quickening is enabled, the remaining generic words that have quickening variants are
+    // replaced with those.
+    void Compiler::specializeInstructions() {
+        // Returns the variant of `spec` for `w`'s operands, or nullptr if they may not be numbers.
+        auto provenVariant = [](const SourceWord &w, const Specialization *spec) -> const Word* {
+            // (A superinstruction has the operand types recorded at its first component, so a
+            // `_LIT+` sees the stack before its literal: its stack operand is on top.)
+            TypeSet all;
+            for (int n = 0; n < w.word->stackEffect().inputCount(); ++n) {
+                TypeSet types = w.operandTypes[n];
+                if (!types || (types - TypeSet(Value::ANumber)))
+                    return nullptr;
+                all = all | types;
+            }
+            if (w.word->hasValParams()) {
+                if (!w.param.literal.isNumber())
+                    return nullptr;
+                all = all | TypeSet::of(w.param.literal);
+            }
+            if (all.isInteger())
+                return spec->integer;
+            else if (all.isFloating())
+                return spec->floating;
+            else
+                return spec->numeric;
+        };
+
+        for (auto &w : _words) {
+            const Word *variant = nullptr;
+            if (auto spec = findSpecialization(w.word); spec && w.word == spec->generic
+                                                        && specializationEnabled)
+                variant = provenVariant(w, spec);
+            if (variant) {
+                w.word = variant;
+            } else if (auto q = findQuickening(w.word); q && w.word == q->generic
+                                                          && quickeningEnabled) {
+                w.word = q->quickening;
+            }
+        }
     }
 
 
     vector<Instruction> Compiler::generateInstructions() {
         if (!_controlStack.empty())
-            throw compile_error("Unfinished IF-ELSE-THEN or BEGIN-WHILE-REPEAT)", nullptr);
+            throw compile_error("Unfinished IF-ELSE-THEN, BEGIN-WHILE-REPEAT or DO-LOOP", nullptr);
 
         // Add a RETURN, replacing the "next word" placeholder:
         assert(_words.back().word == &NOP);
+        const Word *inlinedWord = _words.back().inlinedWord;
         _words.back() = {_RETURN};
+        _words.back().inlinedWord = inlinedWord;        // (an inlined word with no code)
 
         // Compute the stack effect and do type-checking:
         computeEffect();
 
-        // Assign a PC offset to each instruction, and do some optimizations:
-        int interpCount = 0;
-        InstructionPos firstInterp;
+        // Inlined words' declared inputs have now been checked; folding may remove the code
+        // that pushed them, so don't check them again:
+        for (auto &w : _words)
+            w.inlinedWord = nullptr;
+
+        // Evaluate constant expressions, then check the simplified code again:
+        if (foldConstants())
+            computeEffect();
+
+        // Remove redundant stack shuffling:
+        simplifyStackOps();
+
+        // Replace common pairs of instructions with superinstructions:
+        fuseInstructions();
+
+        // Replace the remaining runs of stack shuffles with single instructions:
+        collapseShuffles();
+
+        // Use faster numbers-only words where the operands are known to be numbers, and
+        // quickening words (if enabled) elsewhere:
+        specializeInstructions();
+
+        // Detect tail recursion, and remove unreachable instructions after branches:
         bool afterBranch = false;
-        int pc = 0;
-        for (auto i = _words.begin(); i != _words.end();) {
-            if (afterBranch && !i->isBranchDestination) {
-                // Unreachable instruction after a branch
-                i = _words.erase(i);
+        for (InstructionPos i = 0; i < _words.size(); ++i) {
+            auto &w = _words[i];
+            if (afterBranch && !w.isBranchDestination) {
+                w.word = nullptr;
                 continue;
             }
+            if (w.word == &_RECURSE) {
+                // Change RECURSE to BRANCH if it's followed by RETURN:
+                if (returnsImmediately(i + 1))
+                    w.word = &_BRANCH;
+                else
+                    _flags = Word::Flags(_flags | Word::Recursive);
+            }
+            afterBranch = (w.word == &_BRANCH);
+        }
+        compact();
 
-            i->pc = pc;
-            if (i->word->isNative()) {
-                if (i->word == &_RECURSE) {
-                    // Detect tail recursion: Change RECURSE to BRANCH if it's followed by RETURN:
-                    if (returnsImmediately(next(i)))
-                        i->word = &_BRANCH;
-                    else
-                        _flags = Word::Flags(_flags | Word::Recursive);
-                }
-                if (auto dst = i->branchTo; dst) {
+        // Remove branches to the next instruction, such as those left by folding a literal IF:
+        bool removedBranch = false;
+        for (InstructionPos i = 0; i < _words.size(); ++i) {
+            auto &w = _words[i];
+            if (w.word == &_BRANCH && *w.branchTo == i + 1 && !w.isBranchDestination) {
+                w.word = nullptr;
+                removedBranch = true;
+            }
+        }
+        if (removedBranch)
+            compact();
+
+        // Assign a PC offset to each instruction:
+        int interpCount = 0;
+        InstructionPos firstInterp = 0;
+        int pc = 0;
+        for (InstructionPos i = 0; i < _words.size(); ++i) {
+            auto &w = _words[i];
+            w.pc = pc;
+            if (w.word->isNative()) {
+                if (auto dst = w.branchTo; dst) {
                     // Follow chains of branches:
-                    while ((*dst)->word == &_BRANCH)
-                        dst = (*dst)->branchTo;
-                    i->branchTo = dst;
+                    while (_words[*dst].word == &_BRANCH)
+                        dst = _words[*dst].branchTo;
+                    w.branchTo = dst;
+                    // A BRANCH to a RETURN might as well return. (The word's length is stored
+                    // separately, so a RETURN isn't necessarily the end.)
+                    if (w.word == &_BRANCH && _words[*dst].word == &_RETURN) {
+                        w.word = &_RETURN;
+                        w.branchTo = nullopt;
+                    }
                 }
-                // Note: We could optimize a BRANCH to RETURN into a RETURN; but currently we use
-                // RETURN as an end-of-word marker, so it can only appear at the end of a word.
                 interpCount = 0;
-                pc += i->word->parameters();
+                pc += w.word->parameters();
             } else {
                 // In a series of 1 or more interpreted words, set the _first_ one's `interpWord` to
                 // the appropriate word. As more words are found it's changed from INTERP to INTERP2
                 // etc.; and if the final one is followed by RETURN it's changed to the matching
                 // TAILINTERP word.
-                if (interpCount == 0 || interpCount >= kMaxInterp || i->isBranchDestination) {
+                if (interpCount == 0 || interpCount >= kMaxInterp || w.isBranchDestination) {
                     interpCount = 0;
                     firstInterp = i;
                     pc += 1;
                 }
-                bool isTail = returnsImmediately(next(i));
-                firstInterp->interpWord = kInterpWords[isTail][interpCount];
+                bool isTail = returnsImmediately(i + 1);
+                _words[firstInterp].interpWord = &kInterpWords[isTail][interpCount];
                 ++interpCount;
             }
-            afterBranch = (i->word == &_BRANCH);
             ++pc;
-            ++i;
         }
 
         // Assemble `_words` into a series of instructions:
         vector<Instruction> instrs;
         instrs.reserve(pc);
-        for (auto i = _words.begin(); i != _words.end(); ++i) {
-            if (i->word->isNative()) {
+        for (auto &w : _words) {
+            if (w.word->isNative()) {
                 // Add a native word. If it's a branch, compute its PC offset. Then add any param:
-                instrs.push_back(*i->word);
-                if (i->branchTo)
-                    i->param.offset = (*i->branchTo)->pc - i->pc - 2;
-                if (i->word->parameters())
-                    instrs.push_back(i->param);
+                instrs.push_back(*w.word);
+                if (w.branchTo)
+                    w.param.offset = _words[*w.branchTo].pc - w.pc - 2;
+                if (w.word == &_RECURSE) {
+                    // A new stack segment is sized by the word's max, so it has to be known:
+                    if (_effect.maxIsUnknown())
+                        throw compile_error("Recursive word's stack use is too large",
+                                            w.sourceCode);
+                    assert(_effect.inputCount() <= UINT8_MAX && _effect.outputCount() <= UINT8_MAX);
+                    w.param = RecurseParam{int32_t(w.param.offset), uint16_t(_effect.max()),
+                                           uint8_t(_effect.inputCount()),
+                                           uint8_t(_effect.outputCount())};
+                }
+                if (w.word->parameters())
+                    instrs.push_back(w.param);
             } else {
                 // The first of a series of interpreted words will have `interpWord` set to the
                 // appropriate INTERP-family native word, so emit it:
-                if (i->interpWord)
-                    instrs.push_back(*i->interpWord);
+                if (w.interpWord)
+                    instrs.push_back(*w.interpWord);
                 // For each interpreted word add its word as a parameter:
-                instrs.push_back(*i->word);
+                instrs.push_back(*w.word);
             }
         }
         assert(instrs.size() == pc);
@@ -274,10 +1041,11 @@ namespace tails {
     namespace core_words {
 
         NATIVE_WORD(DEFINE, "DEFINE", "{code} $name -- "_sfx) {
-            auto name = sp[0].asString();
+            string name;
+            { Value top = TOS; name = string(top.asString()); }  // (copy: the string may be inline)
             auto quote = (const CompiledWord*)sp[-1].asQuote();
-            sp -= 2;
-            new CompiledWord(*quote, string(name));
+            POPN(2);
+            new CompiledWord(*quote, move(name));
             NEXT();
         }
 
@@ -18,9 +18,10 @@
 
 #pragma once
 #include "word.hh"
+#include "arena.hh"
+#include <memory>
 #include <optional>
 #include <stdexcept>
-#include <list>
 #include <string>
 #include <vector>
 
@@ -28,6 +29,8 @@
 namespace tails {
 
     class Compiler;
+    class NativeCode;
+    class RegisterCode;
     class VocabularyStack;
 
     namespace core_words {
@@ -47,9 +50,32 @@ namespace tails {
         /// Copies a CompiledWord, adding a name.
         CompiledWord(const CompiledWord&, std::string &&name);
 
+        /// The interpreted words whose definitions were inlined into this one, in order;
+        /// a word appears once per call site.
+        const std::vector<const Word*>& inlinedWords() const    {return _inlined;}
+
+        /// The word's translation to register code, if \ref RegisterCode::enabled was set when it
+        /// was compiled and it could be translated; else nullptr.
+        const RegisterCode* registerCode() const                {return _registers.get();}
+
     private:
+        struct Unregistered { };
+        CompiledWord(Unregistered, std::string &&name, StackEffect, std::vector<Instruction>&&);
+        std::vector<Instruction> threadedCode() const;
+        void translate();
+        void addToVocabulary();
+
         std::string const              _nameStr;   // Backing store for inherited _name
-        std::vector<Instruction> const _instrs {}; // Backing store for inherited _instr
+#ifdef ENABLE_NATIVE_CODEGEN
+        std::shared_ptr<NativeCode>    _native;    // Machine code translation, if any
+#endif
+        std::shared_ptr<RegisterCode>  _registers; // Register code translation, if any
+        // Backing store for inherited _instr. The only thing that may modify it is quickening
+        // (see Compiler::quickeningEnabled): an op may overwrite its own instruction, never a
+        // parameter, with an equivalent op having the same parameters and stack effect. That's a
+        // single pointer-sized store, so the code is valid before and after it.
+        std::vector<Instruction> _instrs {};
+        std::vector<const Word*> _inlined;         // Words inlined into this one
     };
 
 
@@ -124,8 +150,8 @@ namespace tails {
         //---- Adding individual words:
 
         struct SourceWord;
-        /// A reference to a WordRef added to the Compiler.
-        using InstructionPos = std::list<SourceWord>::iterator;
+        /// A reference to a WordRef added to the Compiler: its index in the instruction list.
+        using InstructionPos = size_t;
 
         /// Adds an instruction to a word being compiled.
         /// @return  An opaque reference to this instruction, that can be used later to fix branches.
@@ -134,6 +160,10 @@ namespace tails {
         /// Adds a word by inlining its definition, if it's interpreted. Native words added normally.
         void addInline(const Word&, const char *source);
 
+        /// True if a call to this word should be added with \ref addInline: if it has the
+        /// `Inline` flag, or it's a small non-recursive interpreted word (see \ref inlineBudget.)
+        bool shouldInline(const Word&) const;
+
         void addBranchBackTo(InstructionPos);
 
         void addRecurse();
@@ -159,6 +189,40 @@ namespace tails {
         /// The vocabularies the parser looks up words from
         static VocabularyStack activeVocabularies;
 
+        /// Set this to false to stop the compiler from fusing instructions into superinstructions.
+        /// (The superinstruction profiler does this, so it sees the unfused instruction stream.)
+        static inline bool fusionEnabled = true;
+
+        /// Set this to false to stop the compiler from evaluating pure words whose inputs are all
+        /// literals (like `60 60 *`) at compile time, and removing branches on literal conditions.
+        static inline bool foldingEnabled = true;
+
+        /// Set this to false to stop the compiler from rewriting runs of stack-shuffling words
+        /// and literals, like `SWAP SWAP` or `OVER DROP`, into shorter equivalent sequences.
+        static inline bool peepholeEnabled = true;
+
+        /// The number of instructions the stack-shuffle peephole pass has removed, in total.
+        static inline size_t peepholeRemoved = 0;
+
+        /// The most instructions an interpreted word can have, for the parser to inline it
+        /// automatically instead of calling it. This is the budget while the word being compiled
+        /// is short; beyond `kFullInlineBudgetSize` instructions it shrinks in proportion, so a
+        /// long word doesn't balloon. Recursive words are never inlined. Words are inlined into
+        /// code whose inputs are inferred, like quotations, too; the stack checker still checks
+        /// the inlined word's declared inputs. Set it to 0 to only inline words with the
+        /// `Inline` flag.
+        static inline size_t inlineBudget = 12;
+
+        /// Set this to false to stop the compiler from substituting numbers-only variants of
+        /// arithmetic and comparison words where it can prove the operands are numbers.
+        static inline bool specializationEnabled = true;
+
+        /// Set this to true to compile arithmetic, comparison and `LENGTH` words whose operand
+        /// types aren't known into "quickening" variants. The first time one runs, it rewrites
+        /// itself to a variant specialized for the types it sees, guarded by a type check; if the
+        /// check ever fails, it reverts to the generic word. See core_words::quickeningStats.
+        static inline bool quickeningEnabled = false;
+
     private:
         friend class CompiledWord;
 
@@ -171,20 +235,48 @@ namespace tails {
         Value parseQuote(const char* &input);
         void pushBranch(char identifier, const Word *branch =nullptr);
         InstructionPos popBranch(const char *matching);
+        size_t loopDepth() const;
+        void addLoopEnd(const Word &loopWord, const char *source);
+        void addLeave(const char *source);
+        void setBranch(InstructionPos src, InstructionPos dst);
         bool returnsImmediately(InstructionPos);
+        void addUnfused(const WordRef&, const char *source);
+        bool foldConstants();
+        void simplifyStackOps();
+        void collapseShuffles();
+        void fuseInstructions();
+        void compact();
+        void specializeInstructions();
         void computeEffect();
-        void computeEffect(InstructionPos i,
-                           EffectStack stack);
+        template <class MERGE>
+        void computeEffect(InstructionPos i, EffectStack &curStack,
+                           const std::vector<bool, ArenaAllocator<bool>> &isJoin, MERGE mergeInto);
+        void addMissingInputs(const StackEffect&, EffectStack&);
         StackEffect effectOfIFELSE(InstructionPos, EffectStack&);
+        static StackEffect effectOfShuffle(ShuffleParam);
+
+        // The most inputs a `_SHUFFLE` can have: the limit of a stack effect's input matches.
+        static constexpr size_t kMaxShuffleInputs = 7;
+
+        // The fewest dispatches collapsing a run of shuffles into a `_SHUFFLE` has to save.
+        static constexpr size_t kMinShuffleSavings = 2;
+
+        // The size a word can grow to before its auto-inlining budget starts shrinking.
+        static constexpr size_t kFullInlineBudgetSize = 32;
+
+        using SourceWords = std::vector<SourceWord, ArenaAllocator<SourceWord>>;
 
         std::string                 _name;
         Word::Flags                 _flags {};
-        std::list<SourceWord>       _words;
+        std::unique_ptr<Arena>      _arena;         // Allocates `_words` and their EffectStacks
+        SourceWords                 _words;         // The instructions, ending in a placeholder
         StackEffect                 _effect;
         bool                        _effectCanAddInputs = true;
         bool                        _effectCanAddOutputs = true;
         std::string_view            _curToken;
         std::vector<BranchTarget>   _controlStack;
+        std::vector<std::pair<size_t, InstructionPos>> _leaves; // LEAVE branches, by loop depth
+        std::vector<const Word*>    _inlined;       // Words inlined so far
     };
 
 }
@@ -19,6 +19,7 @@
 #pragma once
 #include "compiler.hh"
 #include "core_words.hh"
+#include "register_code.hh"
 #include "word.hh"
 #include "vocabulary.hh"
 
@@ -27,11 +28,21 @@ namespace tails {
 
     class Disassembler {
     public:
-        Disassembler(const Instruction *pc) :_pc(pc) { }
+        /// Disassembles an interpreted word's code, to its end.
+        explicit Disassembler(const Word &word)
+        :_pc(word.instruction().word)
+        ,_end(_pc + word.instructionCount())
+        { }
+
+        /// Disassembles code starting at `pc`, up to the first `_RETURN`.
+        explicit Disassembler(const Instruction *pc) :_pc(pc) { }
 
         void setLiteral(bool literal)   {_literal = literal;}
 
-        explicit operator bool() const  {return _pc != nullptr;}
+        explicit operator bool() const  {return _pc != _end;}
+
+        /// The address of the next instruction to be disassembled.
+        const Instruction* pc() const   {return _pc;}
 
         std::optional<Compiler::WordRef> _next() {
             assert(_pc);
@@ -43,7 +54,7 @@ namespace tails {
             else if (word->parameters())
                 return Compiler::WordRef(*word, *_pc++);
             else {
-                if (word == &core_words::_RETURN)
+                if (word == &core_words::_RETURN && !_end)
                     _pc = nullptr;
                 return Compiler::WordRef(*word);
             }
@@ -68,10 +79,8 @@ namespace tails {
         }
 
 
-        static vector<Compiler::WordRef> disassembleWord(const Instruction *instr,
-                                                         bool literal = false)
-        {
-            Disassembler dis(instr);
+        static vector<Compiler::WordRef> disassembleWord(const Word &word, bool literal = false) {
+            Disassembler dis(word);
             dis.setLiteral(literal);
             vector<Compiler::WordRef> instrs;
             while (dis)
@@ -80,8 +89,32 @@ namespace tails {
         }
 
 
+        /// Describes the parameter of a `_SHUFFLE` as a stack effect, like "a b c -- b c a".
+        static string describeShuffle(ShuffleParam shuffle) {
+            auto name = [&](int input) {return char('a' + shuffle.inputs - 1 - input);};
+            string desc;
+            for (int i = shuffle.inputs - 1; i >= 0; --i) {
+                desc += name(i);
+                desc += ' ';
+            }
+            desc += "--";
+            for (int i = shuffle.outputs - 1; i >= 0; --i) {
+                desc += ' ';
+                desc += name(shuffle.source(i));
+            }
+            return desc;
+        }
+
+
+        /// Describes the parameter of a `_REGS`, the register code it runs.
+        static string describeRegisters(const RegisterCode *code) {
+            return to_string(code->size()) + " register instructions";
+        }
+
+
     private:
         const Instruction* _pc;
+        const Instruction* _end = nullptr;      // End of the code, if known
         bool               _literal = false;
     };
 
@@ -0,0 +1,766 @@
+//
+// native_code.cc
+//
+// Copyright (C) 2021 Jens Alfke. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "native_code.hh"
+
+#ifdef ENABLE_NATIVE_CODEGEN
+
+#include "compiler.hh"
+#include "core_words.hh"
+#include "vocabulary.hh"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+
+namespace tails {
+    using namespace std;
+    using namespace tails::core_words;
+
+
+    // How the generated code works:
+    //
+    // The native stack pointer `sp` lives in RBX (callee-saved) for the whole function.
+    // Primitives that aren't inlined are called as C functions `op(sp, pc)`, where `pc` points to
+    // a "parameter block" in the code's data section: a copy of the op's parameters followed by
+    // `_RETURN`, so that the op's `NEXT()` returns right back to the native code.
+    //
+    // Conditional branches use a parameter block [offset=1, _RETURN, branchTaken]: if the branch
+    // is taken the op skips over the `_RETURN` to `f_branchTaken`, which returns `sp` with its low
+    // bit set. The native code then tests and clears that bit, and jumps if it was set.
+    //
+    // A recursive call is a direct CALL to the start of the code, if the stack has room for it
+    // below `stackLimit`; otherwise it calls `_RECURSE` with a parameter block that points back to
+    // the code's entry point, so it makes the call on a new stack segment.
+    //
+    // Arithmetic and comparisons have inline fast paths for when the operands are both doubles,
+    // or both integers, falling back to calling the op for any other types. `+` and `-` also
+    // handle a mix of the two, or integers whose result overflows, in floating point. (The
+    // numbers-only variants chosen by the compiler are translated the same way, since a number
+    // may be either.)
+
+
+    // Tags the stack pointer to tell the native code that a conditional branch was taken.
+    static Value* f_branchTaken(Value *sp, const Instruction*) {
+        return (Value*)(uintptr_t(sp) | 1);
+    }
+
+
+    // Returns the built-in or generated rule that produces the superinstruction `word`, or nullptr.
+    static const Fusion* fusionFor(const Word *word) {
+        for (auto rules : {kFusions, kGeneratedFusions}) {
+            for (auto f = rules; f->fused; ++f) {
+                if (f->fused == word)
+                    return f;
+            }
+        }
+        return nullptr;
+    }
+
+
+    // Returns the rule that produces `word` if it's a generated superinstruction, else nullptr.
+    static const Fusion* generatedFusionFor(const Word *word) {
+        for (auto f = kGeneratedFusions; f->fused; ++f) {
+            if (f->fused == word)
+                return f;
+        }
+        return nullptr;
+    }
+
+
+    // Returns true if `word` is `0BRANCH` or a superinstruction ending in it.
+    static bool isConditionalBranch(const Word *word) {
+        if (word == &_ZBRANCH || word == &_DO || word == &_LOOP || word == &_PLUSLOOP)
+            return true;
+        auto f = fusionFor(word);
+        return f && f->second == &_ZBRANCH;
+    }
+
+
+    // Returns true if `word` can be called as a C function, with a parameter block.
+    // That's true of a word whose only use of `pc` is reading its parameters and calling `NEXT()`.
+    static bool isCallable(const Word *word) {
+        if (!word->isMagic() || word == &CALL || word == &_LITERAL || word == &_UNLOOP)
+            return true;
+        if (word >= &kInterpWords[0][0] && word < &kInterpWords[0][0] + 2 * kMaxInterp)
+            return true;
+        if (auto f = fusionFor(word); f)
+            return isCallable(f->first) && isCallable(f->second);
+        return false;
+    }
+
+
+    // Bits that are all set in a Value that isn't a double. (See NanTagged::kMagicBits.)
+    static constexpr uint64_t kNonDoubleBits = 0x7ffc000000000000;
+
+    // The top 16 bits of an integer Value, whose low 48 bits are the integer. (See
+    // NanTagged::kIntType.) No other Value has all of these bits set.
+    static constexpr uint64_t kIntBits = 0x7fff000000000000;
+
+
+    // Returns the second byte of the `Jcc rel32` instruction that jumps when a comparison
+    // (UCOMISD or CMP) does NOT satisfy `word`, i.e. when its 0BRANCH is taken; else 0.
+    static uint8_t branchIfFalseOpcode(const Word *word) {
+        if (word == &_EQ_ZBRANCH || word == &_ZERO_EQ_ZBRANCH)  return 0x85;  // JNE
+        if (word == &_NE_ZBRANCH || word == &_ZERO_NE_ZBRANCH)  return 0x84;  // JE
+        if (word == &_GT_ZBRANCH || word == &_ZERO_GT_ZBRANCH)  return 0x86;  // JBE
+        if (word == &_GE_ZBRANCH)                               return 0x82;  // JB
+        if (word == &_LT_ZBRANCH || word == &_ZERO_LT_ZBRANCH)  return 0x83;  // JAE
+        if (word == &_LE_ZBRANCH)                               return 0x87;  // JA
+        return 0;
+    }
+
+    // Converts a `Jcc` opcode from `branchIfFalseOpcode`, which is for an unsigned comparison
+    // (as UCOMISD sets the flags), to its equivalent for a signed integer comparison.
+    static uint8_t signedJcc(uint8_t jcc) {
+        switch (jcc) {
+            case 0x82: return 0x8C;     // JB  -> JL
+            case 0x83: return 0x8D;     // JAE -> JGE
+            case 0x86: return 0x8E;     // JBE -> JLE
+            case 0x87: return 0x8F;     // JA  -> JG
+            default:   return jcc;      // JE, JNE
+        }
+    }
+
+
+    namespace {
+        // Accumulates machine code, and the fixups to apply once its address is known.
+        class Assembler {
+        public:
+            void emit(std::initializer_list<uint8_t> bytes) {_code.insert(_code.end(), bytes);}
+
+            template <class T>
+            void emitRaw(T value) {
+                auto bytes = (const uint8_t*)&value;
+                _code.insert(_code.end(), &bytes[0], &bytes[sizeof(T)]);
+            }
+
+            // Emits a 32-bit relative branch displacement to the native code of instruction `dst`.
+            void emitBranchTo(size_t dst)       {_branches.push_back({_code.size(), dst}); emitRaw(int32_t(0));}
+
+            // MOVABS RSI, <address of a new parameter block>
+            void emitParamBlock(const Instruction *params, size_t n, const Instruction *rest, size_t nRest) {
+                emit({0x48, 0xBE});
+                _blocks.push_back({_code.size(), _data.size()});
+                emitRaw(uint64_t(0));
+                _data.insert(_data.end(), &params[0], &params[n]);
+                _data.insert(_data.end(), &rest[0], &rest[nRest]);
+            }
+
+            // Pushes a constant Value on the stack
+            void emitPush(Value v) {
+                emit({0x48, 0xB8}); emitRaw(v);     // MOVABS RAX, v
+                emit({0x48, 0x89, 0x43, 0x08});     // MOV [RBX+8], RAX
+                emit({0x48, 0x83, 0xC3, 0x08});     // ADD RBX, 8
+            }
+
+            // Calls `op(sp, paramBlock)` and updates `sp`.
+            void emitCall(const Word *word, const Instruction *params, size_t nParams,
+                          const Instruction *rest, size_t nRest)
+            {
+                emit({0x48, 0x89, 0xDF});           // MOV RDI, RBX
+                emitParamBlock(params, nParams, rest, nRest);
+                emit({0x48, 0xB8});                 // MOVABS RAX, op
+                emitRaw(word->instruction().native);
+                emit({0xFF, 0xD0});                 // CALL RAX
+                emit({0x48, 0x89, 0xC3});           // MOV RBX, RAX
+            }
+
+            // Emits a short jump (opcode + 8-bit displacement) to be patched by `bindJump8`.
+            size_t emitJump8(uint8_t opcode)    {emit({opcode, 0x00}); return _code.size();}
+
+            // Points the short jump emitted by `emitJump8` at the current position.
+            void bindJump8(size_t after) {
+                auto disp = _code.size() - after;
+                assert(disp < 128);
+                _code[after - 1] = uint8_t(disp);
+            }
+
+            // Jumps to `slow` (an `emitJump8` handle list) unless [RBX+disp] is a double.
+            // Uses RCX (which must hold kNonDoubleBits) and RDX.
+            void emitCheckDouble(int8_t disp, vector<size_t> &slow) {
+                emit({0x48, 0x8B, 0x53, uint8_t(disp)});    // MOV RDX, [RBX+disp]
+                emit({0x48, 0x21, 0xCA});           // AND RDX, RCX
+                emit({0x48, 0x39, 0xCA});           // CMP RDX, RCX
+                slow.push_back(emitJump8(0x74));    // JE slow
+            }
+
+            // Loads kNonDoubleBits into RCX and checks that the top `n` stack items are doubles.
+            void emitCheckDoubles(int n, vector<size_t> &slow) {
+                emit({0x48, 0xB9}); emitRaw(kNonDoubleBits);    // MOVABS RCX, kNonDoubleBits
+                for (int i = 0; i < n; ++i)
+                    emitCheckDouble(int8_t(-8 * i), slow);
+            }
+
+            void bindJumps8(const vector<size_t> &jumps)     {for (auto j : jumps) bindJump8(j);}
+
+            // Emits a near jump (JMP with a 32-bit displacement) to be patched by `bindJump32`.
+            size_t emitJump32()                 {emit({0xE9}); emitRaw(int32_t(0)); return _code.size();}
+
+            // Points the near jump emitted by `emitJump32` at the current position.
+            void bindJump32(size_t after) {
+                auto disp = int32_t(_code.size() - after);
+                memcpy(&_code[after - 4], &disp, sizeof(disp));
+            }
+
+            // Loads the top `n` (1 or 2) stack items into RAX, or RAX and RDX (the top one), and
+            // jumps to `slow` unless they're all integers. Uses RCX.
+            void emitLoadInts(int n, vector<size_t> &slow) {
+                if (n == 2) {
+                    emit({0x48, 0x8B, 0x43, 0xF8});     // MOV RAX, [RBX-8]
+                    emit({0x48, 0x8B, 0x13});           // MOV RDX, [RBX]
+                    emit({0x48, 0x89, 0xC1});           // MOV RCX, RAX
+                    emit({0x48, 0x21, 0xD1});           // AND RCX, RDX
+                } else {
+                    emit({0x48, 0x8B, 0x03});           // MOV RAX, [RBX]
+                    emit({0x48, 0x89, 0xC1});           // MOV RCX, RAX
+                }
+                emit({0x48, 0xC1, 0xE9, 0x30});         // SHR RCX, 48
+                emit({0x81, 0xF9}); emitRaw(uint32_t(kIntBits >> 48)); // CMP ECX, kIntBits >> 48
+                slow.push_back(emitJump8(0x75));        // JNE slow
+            }
+
+            // Loads the number at [RBX+disp] into XMM<xmm> as a double, converting an integer,
+            // and jumps to `slow` if it's not a number. Uses RAX and RCX.
+            void emitLoadNumber(int8_t disp, uint8_t xmm, vector<size_t> &slow) {
+                uint8_t modrm = uint8_t(0xC0 | (xmm << 3));
+                emit({0x48, 0x8B, 0x43, uint8_t(disp)});    // MOV RAX, [RBX+disp]
+                emit({0x48, 0x89, 0xC1});               // MOV RCX, RAX
+                emit({0x48, 0xC1, 0xE9, 0x30});         // SHR RCX, 48
+                emit({0x81, 0xF9}); emitRaw(uint32_t(kIntBits >> 48)); // CMP ECX, kIntBits >> 48
+                auto isInt = emitJump8(0x74);           // JE isInt
+                emit({0x81, 0xE1}); emitRaw(uint32_t(kNonDoubleBits >> 48));
+                                                        // AND ECX, kNonDoubleBits >> 48
+                emit({0x81, 0xF9}); emitRaw(uint32_t(kNonDoubleBits >> 48));
+                                                        // CMP ECX, kNonDoubleBits >> 48
+                slow.push_back(emitJump8(0x74));        // JE slow
+                emit({0x66, 0x48, 0x0F, 0x6E, modrm});  // MOVQ XMM<xmm>, RAX
+                auto loaded = emitJump8(0xEB);          // JMP loaded
+                bindJump8(isInt);
+                emit({0x48, 0xC1, 0xE0, 0x10});         // SHL RAX, 16
+                emit({0x48, 0xC1, 0xF8, 0x10});         // SAR RAX, 16
+                emit({0xF2, 0x48, 0x0F, 0x2A, modrm});  // CVTSI2SD XMM<xmm>, RAX
+                bindJump8(loaded);
+            }
+
+            // Stores the integer in the top 48 bits of RAX at [RBX+disp]. Uses RCX.
+            void emitIntResult(int8_t disp) {
+                emit({0x48, 0xC1, 0xE8, 0x10});         // SHR RAX, 16
+                emit({0x48, 0xB9}); emitRaw(kIntBits);  // MOVABS RCX, kIntBits
+                emit({0x48, 0x09, 0xC8});               // OR RAX, RCX
+                emit({0x48, 0x89, 0x43, uint8_t(disp)});// MOV [RBX+disp], RAX
+            }
+
+            // Stores XMM0 at [RBX+disp] unless it's a NaN (which Value turns into null), in
+            // which case it jumps to `slow`.
+            void emitNumericResult(int8_t disp, vector<size_t> &slow) {
+                emit({0x66, 0x0F, 0x2E, 0xC0});     // UCOMISD XMM0, XMM0
+                slow.push_back(emitJump8(0x7A));    // JP slow
+                emit({0xF2, 0x0F, 0x11, 0x43, uint8_t(disp)});  // MOVSD [RBX+disp], XMM0
+            }
+
+            // Calls a conditional-branch op, then jumps to instruction `dst` if it branched.
+            void emitConditionalBranch(const Word *word, size_t dst) {
+                static const Instruction kBranch[] = {Instruction::withOffset(1), _RETURN,
+                                                      f_branchTaken};
+                emitCall(word, nullptr, 0, kBranch, 3);
+                emit({0x48, 0x0F, 0xBA, 0xF3, 0x00}); // BTR RBX, 0
+                emit({0x0F, 0x82});                 // JC dst
+                emitBranchTo(dst);
+            }
+
+            // Calls `_RECURSE` with the parameter block [param, _RETURN, <this code's entry point>]
+            // (the param's offset pointing to the last), so it calls this code recursively.
+            void emitRecurseCall(Instruction param) {
+                param.recurse.offset = 1;
+                const Instruction block[3] = {param, _RETURN, _RETURN};
+                emitCall(&_RECURSE, block, 3, nullptr, 0);
+                _entryPoints.push_back(_data.size() - 1);
+            }
+
+            void markInstruction(size_t pc)     {_offsets.resize(pc + 1, SIZE_MAX); _offsets[pc] = _code.size();}
+
+            size_t codeSize() const             {return _code.size();}
+
+            // Copies the code and data to `dst`, applying fixups for running it at `addr`.
+            // (These differ if the code is written through a writable alias of its memory.)
+            bool writeTo(uint8_t *dst, const uint8_t *addr) {
+                size_t dataStart = dataOffset();
+                for (auto [at, target] : _branches) {
+                    if (target >= _offsets.size() || _offsets[target] == SIZE_MAX)
+                        return false;
+                    int32_t disp = int32_t(_offsets[target] - (at + 4));
+                    memcpy(&_code[at], &disp, 4);
+                }
+                for (auto [at, index] : _blocks) {
+                    auto blockAddr = uint64_t(addr + dataStart + index * sizeof(Instruction));
+                    memcpy(&_code[at], &blockAddr, 8);
+                }
+                for (auto index : _entryPoints)
+                    _data[index] = Instruction(Op(addr));
+                memcpy(dst, _code.data(), _code.size());
+                memcpy(dst + dataStart, _data.data(), _data.size() * sizeof(Instruction));
+                return true;
+            }
+
+            size_t dataOffset() const           {return (_code.size() + 15) & ~size_t(15);}
+            size_t totalSize() const            {return dataOffset() + _data.size() * sizeof(Instruction);}
+
+        private:
+            vector<uint8_t>              _code;
+            vector<Instruction>          _data;
+            vector<size_t>               _offsets;   // native offset of each threaded instruction
+            vector<pair<size_t,size_t>>  _branches;  // (code offset, threaded instruction index)
+            vector<pair<size_t,size_t>>  _blocks;    // (code offset, data index)
+            vector<size_t>               _entryPoints; // data indexes to set to the entry point
+        };
+    }
+
+
+    // Emits the native code for one instruction at threaded-code offset `pc`, whose parameters (if
+    // any) are at `params`. Returns false if it can't be translated.
+    static bool translateWord(Assembler &a, const Word *word, const Instruction *params, size_t pc) {
+        static const Instruction kReturn[] = {_RETURN};
+        // A numbers-only word is translated like its generic form:
+        for (auto s = kNumericSpecializations; s->numeric; ++s) {
+            if (s->isVariant(word)) {
+                word = s->generic;
+                break;
+            }
+        }
+        // Quickening words rewrite their own instruction, so they can't be called from here;
+        // they and their quickened forms are translated as the generic word.
+        for (auto q = kQuickenings; q->generic; ++q) {
+            if (q->quickening == word || q->quickened == word) {
+                word = q->generic;
+                break;
+            }
+        }
+
+        if (word == &_RETURN) {
+            a.emit({0x48, 0x89, 0xD8});         // MOV RAX, RBX
+            a.emit({0x5B});                     // POP RBX
+            a.emit({0xC3});                     // RET
+        } else if (word == &_LITERAL) {
+            a.emitPush(params[0].literal);
+        } else if (word == &ZERO) {
+            a.emitPush(Value(0));
+        } else if (word == &ONE) {
+            a.emitPush(Value(1));
+        } else if (word == &DUP) {
+            a.emit({0x48, 0x8B, 0x03});         // MOV RAX, [RBX]
+            a.emit({0x48, 0x89, 0x43, 0x08});   // MOV [RBX+8], RAX
+            a.emit({0x48, 0x83, 0xC3, 0x08});   // ADD RBX, 8
+        } else if (word == &DROP) {
+            a.emit({0x48, 0x83, 0xEB, 0x08});   // SUB RBX, 8
+        } else if (word == &SWAP) {
+            a.emit({0x48, 0x8B, 0x03});         // MOV RAX, [RBX]
+            a.emit({0x48, 0x8B, 0x4B, 0xF8});   // MOV RCX, [RBX-8]
+            a.emit({0x48, 0x89, 0x0B});         // MOV [RBX], RCX
+            a.emit({0x48, 0x89, 0x43, 0xF8});   // MOV [RBX-8], RAX
+        } else if (word == &OVER) {
+            a.emit({0x48, 0x8B, 0x43, 0xF8});   // MOV RAX, [RBX-8]
+            a.emit({0x48, 0x89, 0x43, 0x08});   // MOV [RBX+8], RAX
+            a.emit({0x48, 0x83, 0xC3, 0x08});   // ADD RBX, 8
+        } else if (word == &ROT) {
+            a.emit({0x48, 0x8B, 0x43, 0xF0});   // MOV RAX, [RBX-16]
+            a.emit({0x48, 0x8B, 0x4B, 0xF8});   // MOV RCX, [RBX-8]
+            a.emit({0x48, 0x89, 0x4B, 0xF0});   // MOV [RBX-16], RCX
+            a.emit({0x48, 0x8B, 0x0B});         // MOV RCX, [RBX]
+            a.emit({0x48, 0x89, 0x4B, 0xF8});   // MOV [RBX-8], RCX
+            a.emit({0x48, 0x89, 0x03});         // MOV [RBX], RAX
+        } else if (word == &_SHUFFLE) {
+            // Load the inputs that are used into registers, then store the outputs. (RAX, RCX,
+            // RDX, RSI, RDI, R8, R9, R10 are all free here.)
+            static constexpr uint8_t kRegs[ShuffleParam::kMaxItems] = {0, 1, 2, 6, 7, 8, 9, 10};
+            auto rex   = [](uint8_t reg) {return uint8_t(reg >= 8 ? 0x4C : 0x48);};
+            auto modrm = [](uint8_t reg) {return uint8_t(0x43 | ((reg & 7) << 3));}; // [RBX+disp8]
+            ShuffleParam shuffle = params[0].shuffle;
+            bool used[ShuffleParam::kMaxItems] = {};
+            for (int i = 0; i < shuffle.outputs; ++i)
+                used[shuffle.source(i)] = true;
+            for (int i = 0; i < shuffle.inputs; ++i) {
+                if (used[i])                    // MOV reg, [RBX-8*i]
+                    a.emit({rex(kRegs[i]), 0x8B, modrm(kRegs[i]), uint8_t(-8 * i)});
+            }
+            int growth = shuffle.outputs - shuffle.inputs;
+            for (int i = 0; i < shuffle.outputs; ++i) {
+                uint8_t reg = kRegs[shuffle.source(i)];   // MOV [RBX+8*(growth-i)], reg
+                a.emit({rex(reg), 0x89, modrm(reg), uint8_t(8 * (growth - i))});
+            }
+            if (growth != 0)
+                a.emit({0x48, 0x8D, 0x5B, uint8_t(8 * growth)});   // LEA RBX, [RBX+8*growth]
+        } else if (word == &NOP) {
+            // nothing
+        } else if (word == &_BRANCH) {
+            a.emit({0xE9});                     // JMP dst
+            a.emitBranchTo(pc + 2 + params[0].offset);
+        } else if (word == &_RECURSE) {
+            // If there's room below `stackLimit`, call this code directly:
+            a.emit({0x48, 0xB8}); a.emitRaw(&stackLimit);  // MOVABS RAX, &stackLimit
+            a.emit({0x48, 0x8D, 0x93});         // LEA RDX, [RBX + max*8]
+            a.emitRaw(int32_t(params[0].recurse.max * sizeof(Value)));
+            a.emit({0x48, 0x3B, 0x10});         // CMP RDX, [RAX]
+            auto slow = a.emitJump8(0x77);      // JA slow
+            a.emit({0x48, 0x89, 0xDF});         // MOV RDI, RBX
+            a.emit({0xE8});                     // CALL <start of this code>
+            a.emitRaw(int32_t(-int32_t(a.codeSize() + 4)));
+            a.emit({0x48, 0x89, 0xC3});         // MOV RBX, RAX
+            auto done = a.emitJump8(0xEB);      // JMP done
+            // Otherwise let `_RECURSE` call it on a new stack segment:
+            a.bindJump8(slow);
+            a.emitRecurseCall(params[0]);
+            a.bindJump8(done);
+        } else if (word == &I || word == &J) {
+            a.emit({0x48, 0xBA}); a.emitRaw(&loopStack);  // MOVABS RDX, &loopStack
+            a.emit({0x48, 0x8B, 0x02});         // MOV RAX, [RDX]
+            a.emit({0x48, 0x8B, 0x40, uint8_t(word == &I ? -16 : -32)});
+                                                // MOV RAX, [RAX-16] (or -32: the loop's index)
+            a.emit({0x48, 0x89, 0x43, 0x08});   // MOV [RBX+8], RAX
+            a.emit({0x48, 0x83, 0xC3, 0x08});   // ADD RBX, 8
+        } else if (word == &_LOOP) {
+            // Fast path: the frame holds integers (so the incremented index can't overflow.)
+            // Shifting them to the top 48 bits lets a signed compare check index < limit.
+            a.emit({0x48, 0xBA}); a.emitRaw(&loopStack);  // MOVABS RDX, &loopStack
+            a.emit({0x48, 0x8B, 0x02});         // MOV RAX, [RDX]
+            a.emit({0x48, 0x8B, 0x48, 0xF0});   // MOV RCX, [RAX-16]  (the index)
+            a.emit({0x48, 0x89, 0xCE});         // MOV RSI, RCX
+            a.emit({0x48, 0xC1, 0xEE, 0x30});   // SHR RSI, 48
+            a.emit({0x81, 0xFE}); a.emitRaw(uint32_t(kIntBits >> 48)); // CMP ESI, kIntBits >> 48
+            auto notInt = a.emitJump8(0x75);    // JNE notInt
+            a.emit({0x48, 0xC1, 0xE1, 0x10});   // SHL RCX, 16
+            a.emit({0x48, 0x81, 0xC1}); a.emitRaw(int32_t(1 << 16));   // ADD RCX, 1 << 16
+            a.emit({0x48, 0x8B, 0x70, 0xF8});   // MOV RSI, [RAX-8]  (the limit)
+            a.emit({0x48, 0xC1, 0xE6, 0x10});   // SHL RSI, 16
+            a.emit({0x49, 0x89, 0xC8});         // MOV R8, RCX
+            a.emit({0x49, 0xC1, 0xE8, 0x10});   // SHR R8, 16
+            a.emit({0x49, 0xB9}); a.emitRaw(kIntBits);  // MOVABS R9, kIntBits
+            a.emit({0x4D, 0x09, 0xC8});         // OR R8, R9
+            a.emit({0x4C, 0x89, 0x40, 0xF0});   // MOV [RAX-16], R8
+            a.emit({0x48, 0x39, 0xF1});         // CMP RCX, RSI
+            a.emit({0x0F, 0x8C});               // JL dst
+            a.emitBranchTo(pc + 2 + params[0].offset);
+            a.emit({0x48, 0x83, 0x2A, 0x10});   // SUB QWORD [RDX], 16
+            auto done = a.emitJump32();         // JMP done
+            // Otherwise the frame holds doubles; let `_LOOP` handle it:
+            a.bindJump8(notInt);
+            a.emitConditionalBranch(&_LOOP, pc + 2 + params[0].offset);
+            a.bindJump32(done);
+        } else if (word == &PLUS || word == &MINUS) {
+            // Fast path: a, b are integers. Shifting them to the top 48 bits makes the CPU's
+            // overflow flag detect a result that doesn't fit in 48 bits.
+            vector<size_t> notInts, slow;
+            uint8_t intOp = (word == &PLUS) ? 0x01 : 0x29, doubleOp = (word == &PLUS) ? 0x58 : 0x5C;
+            a.emitLoadInts(2, notInts);
+            a.emit({0x48, 0xC1, 0xE0, 0x10});   // SHL RAX, 16
+            a.emit({0x48, 0xC1, 0xE2, 0x10});   // SHL RDX, 16
+            a.emit({0x48, intOp, 0xD0});        // ADD/SUB RAX, RDX
+            notInts.push_back(a.emitJump8(0x70));   // JO notInts
+            a.emitIntResult(-8);
+            a.emit({0x48, 0x83, 0xEB, 0x08});   // SUB RBX, 8
+            auto intDone = a.emitJump32();      // JMP done
+            // Fast path: a, b are numbers (or integers whose result overflowed); use doubles.
+            a.bindJumps8(notInts);
+            a.emitLoadNumber(-8, 0, slow);      // XMM0 = a
+            a.emitLoadNumber(0, 1, slow);       // XMM1 = b
+            a.emit({0xF2, 0x0F, doubleOp, 0xC1});   // ADDSD/SUBSD XMM0, XMM1
+            a.emitNumericResult(-8, slow);
+            a.emit({0x48, 0x83, 0xEB, 0x08});   // SUB RBX, 8
+            auto done = a.emitJump8(0xEB);      // JMP done
+            a.bindJumps8(slow);
+            a.emitCall(word, params, word->parameters(), kReturn, 1);
+            a.bindJump8(done);
+            a.bindJump32(intDone);
+        } else if ((word == &_LIT_PLUS || word == &_LIT_MINUS) && params[0].literal.isNumber()) {
+            // Same as above, with the literal as `b`:
+            Value literal = params[0].literal;
+            vector<size_t> notInts, slow;
+            uint8_t intOp = (word == &_LIT_PLUS) ? 0x01 : 0x29;
+            uint8_t doubleOp = (word == &_LIT_PLUS) ? 0x58 : 0x5C;
+            size_t intDone = 0;
+            if (literal.isInt()) {
+                a.emitLoadInts(1, notInts);
+                a.emit({0x48, 0xC1, 0xE0, 0x10});   // SHL RAX, 16
+                a.emit({0x48, 0xBA});               // MOVABS RDX, literal << 16
+                a.emitRaw(uint64_t(literal.asInt()) << 16);
+                a.emit({0x48, intOp, 0xD0});        // ADD/SUB RAX, RDX
+                notInts.push_back(a.emitJump8(0x70));   // JO notInts
+                a.emitIntResult(0);
+                intDone = a.emitJump32();           // JMP done
+                a.bindJumps8(notInts);
+            }
+            a.emitLoadNumber(0, 0, slow);       // XMM0 = a
+            a.emit({0x48, 0xB8}); a.emitRaw(literal.asDouble());  // MOVABS RAX, double(literal)
+            a.emit({0x66, 0x48, 0x0F, 0x6E, 0xC8}); // MOVQ XMM1, RAX
+            a.emit({0xF2, 0x0F, doubleOp, 0xC1});   // ADDSD/SUBSD XMM0, XMM1
+            a.emitNumericResult(0, slow);
+            auto done = a.emitJump8(0xEB);      // JMP done
+            a.bindJumps8(slow);
+            a.emitCall(word, params, word->parameters(), kReturn, 1);
+            a.bindJump8(done);
+            if (literal.isInt())
+                a.bindJump32(intDone);
+        } else if (uint8_t jcc = branchIfFalseOpcode(word); jcc != 0) {
+            // Fast path: compare doubles with UCOMISD and branch on the flags
+            vector<size_t> notDoubles, slow;
+            int nArgs = word->stackEffect().inputCount();
+            bool zero = (nArgs == 1);
+            bool equality = (jcc == 0x84 || jcc == 0x85);
+            if (zero && equality) {
+                // The numbers equal to zero are the doubles +0.0 and -0.0, whose bits are all
+                // zero but the sign, and the integer 0. No type check is needed.
+                a.emit({0x48, 0x8B, 0x03});         // MOV RAX, [RBX]
+                a.emit({0x48, 0xB9}); a.emitRaw(kIntBits);  // MOVABS RCX, kIntBits
+                a.emit({0x31, 0xD2});               // XOR EDX, EDX
+                a.emit({0x48, 0x39, 0xC8});         // CMP RAX, RCX
+                a.emit({0x48, 0x0F, 0x44, 0xC2});   // CMOVE RAX, RDX
+                a.emit({0x48, 0x01, 0xC0});         // ADD RAX, RAX
+            } else {
+                a.emitCheckDoubles(nArgs, notDoubles);
+                if (zero) {
+                    a.emit({0xF2, 0x0F, 0x10, 0x03});       // MOVSD XMM0, [RBX]
+                    a.emit({0x66, 0x0F, 0x57, 0xC9});       // XORPD XMM1, XMM1
+                    a.emit({0x66, 0x0F, 0x2E, 0xC1});       // UCOMISD XMM0, XMM1
+                } else {
+                    a.emit({0xF2, 0x0F, 0x10, 0x43, 0xF8}); // MOVSD XMM0, [RBX-8]
+                    a.emit({0x66, 0x0F, 0x2E, 0x03});       // UCOMISD XMM0, [RBX]
+                }
+            }
+            a.emit({0x48, 0x8D, 0x5B, uint8_t(-8 * nArgs)}); // LEA RBX, [RBX-8*nArgs]
+            a.emit({0x0F, jcc});                // Jcc dst
+            a.emitBranchTo(pc + 2 + params[0].offset);
+            if (!notDoubles.empty()) {
+                auto done = a.emitJump8(0xEB);  // JMP done
+                // Fast path: compare integers. Equal integers have equal bits; otherwise shift
+                // them to the top 48 bits and compare them as signed 64-bit numbers.
+                a.bindJumps8(notDoubles);
+                a.emitLoadInts(nArgs, slow);
+                if (!equality)
+                    a.emit({0x48, 0xC1, 0xE0, 0x10});   // SHL RAX, 16
+                if (zero) {
+                    a.emit({0x48, 0x85, 0xC0});         // TEST RAX, RAX
+                } else {
+                    if (!equality)
+                        a.emit({0x48, 0xC1, 0xE2, 0x10});   // SHL RDX, 16
+                    a.emit({0x48, 0x39, 0xD0});         // CMP RAX, RDX
+                }
+                a.emit({0x48, 0x8D, 0x5B, uint8_t(-8 * nArgs)}); // LEA RBX, [RBX-8*nArgs]
+                a.emit({0x0F, signedJcc(jcc)});     // Jcc dst
+                a.emitBranchTo(pc + 2 + params[0].offset);
+                auto intDone = a.emitJump8(0xEB);   // JMP done
+                a.bindJumps8(slow);
+                a.emitConditionalBranch(word, pc + 2 + params[0].offset);
+                a.bindJump8(done);
+                a.bindJump8(intDone);
+            }
+        } else if (auto f = generatedFusionFor(word); f) {
+            // Native code has no dispatch overhead to save, and its primitives are mostly inlined,
+            // so split a generated superinstruction back into its parts. (Its one parameter, if
+            // any, belongs to whichever part takes one; and a 0BRANCH part can only come last,
+            // so its offset is still relative to `pc`.)
+            return translateWord(a, f->first, params, pc) && translateWord(a, f->second, params, pc);
+        } else if (isConditionalBranch(word)) {
+            a.emitConditionalBranch(word, pc + 2 + params[0].offset);
+        } else if (isCallable(word)) {
+            a.emitCall(word, params, word->parameters(), kReturn, 1);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+
+    namespace {
+        // Executable memory for NativeCode, shared by all of it, so that translating a word
+        // doesn't cost an mmap, an mprotect and an munmap, and a page of its own. Blocks are
+        // carved out of chunks that are mapped once and never unmapped; a freed block is reused,
+        // merged with any free neighbors.
+        //
+        // No page is ever both writable and executable. On Linux each chunk is mapped twice, from
+        // a memfd: executable, and writable at another address, which is where code is copied
+        // to. Elsewhere a block's pages are made writable, and not executable, only while code is
+        // copied into it. (The runtime is single-threaded, so no code on those pages can be
+        // running meanwhile: at most it's on the call stack, waiting for the translation.)
+        class CodeArena {
+        public:
+            static constexpr size_t kChunkSize = 256 * 1024;
+            static constexpr size_t kAlignment = 64;
+
+            // Returns a block of at least `size` bytes, or nullptr if out of memory.
+            uint8_t* allocate(size_t size) {
+                size = roundUp(size, kAlignment);
+                for (auto i = _free.begin(); i != _free.end(); ++i) {
+                    if (auto [block, blockSize] = *i; blockSize >= size) {
+                        _free.erase(i);
+                        if (blockSize > size)
+                            _free[block + size] = blockSize - size;
+                        return block;
+                    }
+                }
+                // No free block is big enough, so map a new chunk:
+                size_t chunkSize = max(kChunkSize, roundUp(size, size_t(getpagesize())));
+                uint8_t *chunk = mapChunk(chunkSize);
+                if (!chunk)
+                    return nullptr;
+                if (chunkSize > size)
+                    _free[chunk + size] = chunkSize - size;
+                return chunk;
+            }
+
+            // Returns a block to the arena.
+            void free(uint8_t *block, size_t size) {
+                size = roundUp(size, kAlignment);
+                auto next = _free.lower_bound(block);
+                if (next != _free.end() && next->first == block + size) {
+                    size += next->second;
+                    next = _free.erase(next);
+                }
+                if (next != _free.begin()) {
+                    if (auto prev = std::prev(next); prev->first + prev->second == block) {
+                        prev->second += size;
+                        return;
+                    }
+                }
+                _free[block] = size;
+            }
+
+            // Returns the address to copy a block's code to, or nullptr on failure.
+            // Must be followed by a call to `endWriting`.
+            uint8_t* beginWriting(uint8_t *block, size_t size) {
+#ifdef __linux__
+                (void)size;
+                auto chunk = std::prev(_chunks.upper_bound(block));
+                return chunk->second + (block - chunk->first);
+#else
+                return protect(block, size, PROT_READ | PROT_WRITE) ? block : nullptr;
+#endif
+            }
+
+            // Makes a block that was written to executable.
+            bool endWriting(uint8_t *block, size_t size) {
+#ifdef __linux__
+                (void)block, (void)size;    // (the code was written through the alias)
+                return true;
+#else
+                return protect(block, size, PROT_READ | PROT_EXEC);
+#endif
+            }
+
+        private:
+            static size_t roundUp(size_t n, size_t unit)    {return (n + unit - 1) & ~(unit - 1);}
+
+#ifdef __linux__
+            uint8_t* mapChunk(size_t size) {
+                int fd = memfd_create("tails-jit", MFD_CLOEXEC);
+                if (fd < 0)
+                    return nullptr;
+                void *code = MAP_FAILED, *data = MAP_FAILED;
+                if (ftruncate(fd, off_t(size)) == 0) {
+                    code = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+                    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                }
+                close(fd);
+                if (code == MAP_FAILED || data == MAP_FAILED) {
+                    if (code != MAP_FAILED) munmap(code, size);
+                    if (data != MAP_FAILED) munmap(data, size);
+                    return nullptr;
+                }
+                _chunks[(uint8_t*)code] = (uint8_t*)data;
+                return (uint8_t*)code;
+            }
+
+            map<uint8_t*, uint8_t*> _chunks;    // Chunks: executable address -> writable address
+#else
+            static uint8_t* mapChunk(size_t size) {
+                void *chunk = mmap(nullptr, size, PROT_READ | PROT_EXEC,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                return (chunk != MAP_FAILED) ? (uint8_t*)chunk : nullptr;
+            }
+
+            // Sets the protection of the pages a block is on.
+            static bool protect(uint8_t *block, size_t size, int prot) {
+                auto pageSize = uintptr_t(getpagesize());
+                auto start = uintptr_t(block) & ~(pageSize - 1);
+                auto end = roundUp(uintptr_t(block) + size, pageSize);
+                return mprotect((void*)start, end - start, prot) == 0;
+            }
+#endif
+
+            map<uint8_t*, size_t> _free;        // Free blocks: start -> size
+        };
+
+        // (Never freed, since NativeCode in static CompiledWords elsewhere may outlive this file's
+        // statics.)
+        CodeArena &sArena = *new CodeArena;
+    }
+
+
+    shared_ptr<NativeCode> NativeCode::translate(const vector<Instruction> &code) {
+        if (!enabled)
+            return nullptr;
+
+        Assembler a;
+        a.emit({0x53});                             // PUSH RBX
+        a.emit({0x48, 0x89, 0xFB});                 // MOV RBX, RDI
+
+        for (size_t pc = 0; pc < code.size(); ) {
+            a.markInstruction(pc);
+            const Word *word = Compiler::activeVocabularies.lookup(code[pc]);
+            if (!word || !word->isNative())
+                return nullptr;
+            const Instruction *params = code.data() + pc + 1;
+            size_t nParams = word->parameters();
+            if (pc + 1 + nParams > code.size())
+                return nullptr;
+
+            if (!translateWord(a, word, params, pc))
+                return nullptr;
+            pc += 1 + nParams;
+        }
+
+        // Copy the code into executable memory:
+        size_t size = a.totalSize();
+        uint8_t *mem = sArena.allocate(size);
+        if (!mem)
+            return nullptr;
+        uint8_t *dst = sArena.beginWriting(mem, size);
+        if (!dst) {
+            sArena.free(mem, size);
+            return nullptr;
+        }
+        bool ok = a.writeTo(dst, mem);
+        if (!sArena.endWriting(mem, size))
+            abort();        // Other words' code may share these pages, so it can't carry on
+        if (!ok) {
+            sArena.free(mem, size);
+            return nullptr;
+        }
+        return shared_ptr<NativeCode>(new NativeCode(mem, size, a.codeSize()));
+    }
+
+
+    NativeCode::~NativeCode() {
+        sArena.free((uint8_t*)_memory, _size);
+    }
+
+}
+
+#endif // ENABLE_NATIVE_CODEGEN
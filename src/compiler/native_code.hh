@@ -0,0 +1,67 @@
+//
+// native_code.hh
+//
+// Copyright (C) 2021 Jens Alfke. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "instruction.hh"
+#include <memory>
+#include <vector>
+
+
+#ifdef ENABLE_NATIVE_CODEGEN
+
+namespace tails {
+
+    /// x86-64 machine code translated from a word's threaded code, by stitching together
+    /// "stencils": short machine-code templates for the primitives, with literals, branch offsets
+    /// and call targets patched in. Stack shuffling, literals and branches are fully inlined;
+    /// other primitives are called as regular C functions.
+    ///
+    /// The code lives in a block of executable memory shared with other NativeCode, freed for
+    /// reuse when this object is destructed.
+    class NativeCode {
+    public:
+        /// Translates threaded code (as produced by the Compiler, ending with `_RETURN`) to
+        /// native code. Returns nullptr if it contains an instruction that can't be translated,
+        /// in which case the caller should just keep using the threaded code.
+        static std::shared_ptr<NativeCode> translate(const std::vector<Instruction> &code);
+
+        ~NativeCode();
+
+        /// The entry point, a function with the standard Op signature. (It ignores `pc`.)
+        Op entryPoint() const       {return Op(_memory);}
+
+        /// The size in bytes of the machine code.
+        size_t codeSize() const     {return _codeSize;}
+
+        /// Set this to true to translate compiled words to native code. It's off by default,
+        /// since translating makes compiling slower; it pays off for words that run often.
+        static inline bool enabled = false;
+
+    private:
+        NativeCode(void *memory, size_t size, size_t codeSize)
+        :_memory(memory), _size(size), _codeSize(codeSize) { }
+        NativeCode(const NativeCode&) = delete;
+
+        void*  _memory;
+        size_t _size;
+        size_t _codeSize;
+    };
+
+}
+
+#endif // ENABLE_NATIVE_CODEGEN
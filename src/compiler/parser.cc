@@ -20,6 +20,10 @@
 #include "core_words.hh"
 #include "stack_effect_parser.hh"
 #include "vocabulary.hh"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
 #include <optional>
 #include <sstream>
 #include <string>
@@ -86,20 +90,56 @@ namespace tails {
     }
 
 
-    /// Tries to parse `token` as an integer (decimal or hex) or floating-point number.
-    /// Returns `nullopt` if it's not. Throws `compile_error` if it's an out-of-range number.
-    static optional<double> asNumber(string_view token) {
-        try {
-            size_t pos;
-            double d = stod(string(token), &pos);
-            if (pos == token.size() && !isnan(d) && !isinf(d))
-                return d;
-        } catch (const std::out_of_range&) {
-            throw compile_error("Number out of range", token.data());
-        } catch (const std::invalid_argument&) {
-            // if invalid number, just return nullopt
+    /// Tries to parse `token` as an integer (decimal or hex, with a `0x` prefix) or floating-point
+    /// number. Returns `nullopt` if it's not. Throws `compile_error` if it's an out-of-range number.
+    /// Doesn't allocate or throw in the common case of a token that's a word, not a number.
+    /// An integer without a decimal point or exponent is an integer Value, if it fits in one.
+    static optional<Value> asNumber(string_view token) {
+        const char *begin = token.data(), *end = begin + token.size();
+        bool negative = false;
+        if (begin < end && (*begin == '-' || *begin == '+')) {
+            negative = (*begin == '-');
+            ++begin;
+        }
+        // Most tokens are words; reject them right away:
+        if (begin == end || !(isdigit((unsigned char)*begin) || *begin == '.'))
+            return nullopt;
+
+        bool hex = (end - begin > 2 && begin[0] == '0' && (begin[1] == 'x' || begin[1] == 'X'));
+        bool integer = std::none_of(begin, end, [hex](char c) {
+            return c == '.' || (hex ? (c == 'p' || c == 'P') : (c == 'e' || c == 'E'));
+        });
+
+        double d;
+        bool outOfRange;
+#ifdef __cpp_lib_to_chars
+        if (hex) {
+            begin += 2;
+            if (!isxdigit((unsigned char)*begin) && *begin != '.')
+                return nullopt;             // (`from_chars` would accept a sign here)
         }
-        return nullopt;
+        auto [ptr, ec] = from_chars(begin, end, d, hex ? chars_format::hex : chars_format::general);
+        if (ptr != end || (ec != errc() && ec != errc::result_out_of_range))
+            return nullopt;
+        outOfRange = (ec == errc::result_out_of_range);
+#else
+        // Without floating-point `from_chars`, use `strtod`. The token can't be a prefix of a
+        // longer number, since it ends at whitespace or a delimiter, so it needn't be copied.
+        char *ptr;
+        errno = 0;
+        d = strtod(begin, &ptr);
+        if (ptr != end)
+            return nullopt;
+        outOfRange = (errno == ERANGE);
+#endif
+        if (outOfRange)
+            throw compile_error("Number out of range", token.data());
+        if (negative)
+            d = -d;
+        // (Every integer that fits in a Value is exactly representable as a double.)
+        if (integer && d >= Value::kMinInt && d <= Value::kMaxInt)
+            return Value(int64_t(d));
+        return Value(d);
     }
 
 
@@ -166,6 +206,18 @@ namespace tails {
                 addBranchBackTo(beginPos);
                 fixBranch(whilePos);
 
+            } else if (match(token, "DO")) {
+                // DO compiles into _DO, which branches past the loop if it's empty (offset TBD):
+                pushBranch('d', &_DO);
+
+            } else if (match(token, "LOOP") || match(token, "+LOOP")) {
+                // LOOP compiles into _LOOP, which branches back to the start of the loop body:
+                addLoopEnd(match(token, "LOOP") ? _LOOP : _PLUSLOOP, sourcePos);
+
+            } else if (match(token, "LEAVE")) {
+                // LEAVE compiles into _UNLOOP and a BRANCH, which the LOOP will resolve:
+                addLeave(sourcePos);
+
             } else if (match(token, "RECURSE")) {
                 addRecurse();
 
@@ -174,17 +226,19 @@ namespace tails {
                 if (word->isMagic())
                         throw compile_error("Special word " + string(token)
                                             + " cannot be added by parser", sourcePos);
+                if ((word == &I && loopDepth() < 1) || (word == &J && loopDepth() < 2))
+                    throw compile_error(string(token) + " must be inside a DO loop", sourcePos);
                 if (word->parameters()) {
                     assert(word->parameters() == 1);
                     auto numTok = readToken(input);
                     auto param = asNumber(numTok);
-                    if (!param || (*param != intptr_t(*param)))
+                    if (!param || (param->asDouble() != intptr_t(param->asDouble())))
                         throw compile_error("Invalid param after " + string(token), numTok.data());
                     if (word->hasIntParams())
-                        add({*word, (intptr_t)*param}, sourcePos);
+                        add({*word, (intptr_t)param->asInt()}, sourcePos);
                     else
-                        add({*word, Value(*param)}, sourcePos);
-                } else if (word->hasFlag(Word::Inline)) {
+                        add({*word, *param}, sourcePos);
+                } else if (shouldInline(*word)) {
                     addInline(*word, sourcePos);
                 } else {
                     add(*word, sourcePos);
@@ -192,7 +246,7 @@ namespace tails {
 
             } else if (auto np = asNumber(token); np) {
                 // A number is added as a LITERAL instruction:
-                add({_LITERAL, Value(*np)}, sourcePos);
+                add({_LITERAL, *np}, sourcePos);
 
             } else {
                 throw compile_error("Unknown word '" + string(token) + "'", sourcePos);
@@ -225,7 +279,7 @@ namespace tails {
             else if (token == "[")
                 array->push_back(parseArray(input));
             else if (auto np = asNumber(token); np)
-                array->push_back(Value(*np));
+                array->push_back(*np);
             else
                 throw compile_error("Invalid literal '" + string(token) + "' in array", token.data());
         }
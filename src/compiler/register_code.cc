@@ -0,0 +1,801 @@
+//
+// register_code.cc
+//
+// Copyright (C) 2021 Jens Alfke. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "register_code.hh"
+#include "compiler.hh"
+#include "core_words.hh"
+#include "vocabulary.hh"
+#include "io.hh"
+#include <cassert>
+#include <sstream>
+#include <tuple>
+#include <utility>
+
+
+namespace tails {
+    using namespace std;
+    using namespace tails::core_words;
+
+
+    // How the register code works:
+    //
+    // The frame is the word's own part of the data stack: slot 0 is its first input, and slot `i`
+    // is where the item at depth `i` lives in the threaded code. While translating, a "virtual
+    // stack" records which slot or constant holds each stack item, so `DUP`, `SWAP`, `_SHUFFLE`
+    // and literals just edit it. An instruction that computes a value writes it to its item's own
+    // slot if no other item still lives there, else to any other free slot.
+    //
+    // At a branch, a branch destination, a call and a return, every item is first "flushed" into
+    // its own slot, with MOVs and XCHGs; so the code agrees on where things are wherever control
+    // flow meets, and callees find a normal stack.
+    //
+    // Words that aren't implemented here are called like native code's callable words: the
+    // instruction points to a copy of the op and its parameters followed by `_RETURN`, in
+    // `_blocks`, and the op runs on the real stack.
+
+
+    enum RegisterCode::Opcode : uint8_t {
+        MOV, XCHG,                                  // dst = a;  swap dst, a
+        ADD, SUB, MUL, DIV, MOD,                    // dst = a OP b
+        ADD_NUM, SUB_NUM, MUL_NUM, DIV_NUM,         //   (operands known to be numbers)
+        EQ, NE, GT, GE, LT, LE,                     // dst = (a OP b)
+        GT_NUM, GE_NUM, LT_NUM, LE_NUM,
+        BR_EQ, BR_NE, BR_GT, BR_GE, BR_LT, BR_LE,   // unless (a OP b), goto target
+        BR_GT_NUM, BR_GE_NUM, BR_LT_NUM, BR_LE_NUM,
+        ADD_K, SUB_K, MUL_K, DIV_K, MOD_K,          // The above, with a constant `b`
+        ADD_NUM_K, SUB_NUM_K, MUL_NUM_K, DIV_NUM_K,
+        EQ_K, NE_K, GT_K, GE_K, LT_K, LE_K,
+        GT_NUM_K, GE_NUM_K, LT_NUM_K, LE_NUM_K,
+        BR_EQ_K, BR_NE_K, BR_GT_K, BR_GE_K, BR_LT_K, BR_LE_K,
+        BR_GT_NUM_K, BR_GE_NUM_K, BR_LT_NUM_K, BR_LE_NUM_K,
+        BR, BRZ,                                    // goto target;  unless a, goto target
+        DO, LOOP, PLUSLOOP,                         // like `_DO`, `_LOOP`, `_+LOOP`
+        INDEX,                                      // dst = index of the a'th innermost loop
+        CALL,                                       // call _blocks[target] with depth `dst`
+        RECURSE,                                    // run this code with depth `dst`; b = max
+                                                    //   (else call _blocks[target], as CALL)
+        RETURN,                                     // return with depth `dst`
+    };
+
+    // Each conditional branch is its comparison's opcode plus this:
+    static constexpr int kBranchOffset = RegisterCode::BR_EQ - RegisterCode::EQ;
+    static_assert(RegisterCode::BR_LE_NUM - RegisterCode::LE_NUM == kBranchOffset);
+
+    // Each opcode from ADD to BR_LE_NUM, plus this, is the same operation with a constant `b`.
+    // (Only `b` can be a constant in these, so they needn't test which kind each operand is.)
+    static constexpr int kConstantOffset = RegisterCode::ADD_K - RegisterCode::ADD;
+    static_assert(RegisterCode::BR_LE_NUM_K - RegisterCode::BR_LE_NUM == kConstantOffset);
+
+    static constexpr const char* kOpcodeNames[] = {
+        "MOV", "XCHG",
+        "ADD", "SUB", "MUL", "DIV", "MOD",
+        "ADD#", "SUB#", "MUL#", "DIV#",
+        "EQ", "NE", "GT", "GE", "LT", "LE",
+        "GT#", "GE#", "LT#", "LE#",
+        "BR!EQ", "BR!NE", "BR!GT", "BR!GE", "BR!LT", "BR!LE",
+        "BR!GT#", "BR!GE#", "BR!LT#", "BR!LE#",
+        "ADD", "SUB", "MUL", "DIV", "MOD",
+        "ADD#", "SUB#", "MUL#", "DIV#",
+        "EQ", "NE", "GT", "GE", "LT", "LE",
+        "GT#", "GE#", "LT#", "LE#",
+        "BR!EQ", "BR!NE", "BR!GT", "BR!GE", "BR!LT", "BR!LE",
+        "BR!GT#", "BR!GE#", "BR!LT#", "BR!LE#",
+        "BR", "BRZ",
+        "DO", "LOOP", "+LOOP",
+        "INDEX",
+        "CALL", "RECURSE",
+        "RETURN",
+    };
+
+
+    // Binary operators and comparisons, the opcodes that implement them, and the opcodes to use
+    // when the operands are known to be numbers.
+    struct BinaryOp {
+        const Word *word;
+        RegisterCode::Opcode op, numericOp;
+    };
+
+    static const BinaryOp kBinaryOps[] = {
+        {&PLUS,  RegisterCode::ADD, RegisterCode::ADD_NUM},
+        {&MINUS, RegisterCode::SUB, RegisterCode::SUB_NUM},
+        {&MULT,  RegisterCode::MUL, RegisterCode::MUL_NUM},
+        {&DIV,   RegisterCode::DIV, RegisterCode::DIV_NUM},
+        {&MOD,   RegisterCode::MOD, RegisterCode::MOD},
+        {&EQ,    RegisterCode::EQ,  RegisterCode::EQ},
+        {&NE,    RegisterCode::NE,  RegisterCode::NE},
+        {&GT,    RegisterCode::GT,  RegisterCode::GT_NUM},
+        {&GE,    RegisterCode::GE,  RegisterCode::GE_NUM},
+        {&LT,    RegisterCode::LT,  RegisterCode::LT_NUM},
+        {&LE,    RegisterCode::LE,  RegisterCode::LE_NUM},
+    };
+
+    // Comparisons with zero, which are translated as comparisons with a constant 0.
+    static const BinaryOp kZeroCompareOps[] = {
+        {&EQ_ZERO, RegisterCode::EQ, RegisterCode::EQ},
+        {&NE_ZERO, RegisterCode::NE, RegisterCode::NE},
+        {&GT_ZERO, RegisterCode::GT, RegisterCode::GT},
+        {&LT_ZERO, RegisterCode::LT, RegisterCode::LT},
+    };
+
+    // Comparison superinstructions ending in `0BRANCH`, and their comparison's opcodes.
+    static const BinaryOp kCompareBranchOps[] = {
+        {&_EQ_ZBRANCH, RegisterCode::EQ, RegisterCode::EQ},
+        {&_NE_ZBRANCH, RegisterCode::NE, RegisterCode::NE},
+        {&_GT_ZBRANCH, RegisterCode::GT, RegisterCode::GT_NUM},
+        {&_GE_ZBRANCH, RegisterCode::GE, RegisterCode::GE_NUM},
+        {&_LT_ZBRANCH, RegisterCode::LT, RegisterCode::LT_NUM},
+        {&_LE_ZBRANCH, RegisterCode::LE, RegisterCode::LE_NUM},
+    };
+
+    static const BinaryOp kZeroCompareBranchOps[] = {
+        {&_ZERO_EQ_ZBRANCH, RegisterCode::EQ, RegisterCode::EQ},
+        {&_ZERO_NE_ZBRANCH, RegisterCode::NE, RegisterCode::NE},
+        {&_ZERO_GT_ZBRANCH, RegisterCode::GT, RegisterCode::GT},
+        {&_ZERO_LT_ZBRANCH, RegisterCode::LT, RegisterCode::LT},
+    };
+
+    template <size_t N>
+    static const BinaryOp* findOp(const BinaryOp (&ops)[N], const Word *word) {
+        for (auto &op : ops) {
+            if (op.word == word)
+                return &op;
+        }
+        return nullptr;
+    }
+
+
+    // True if `op` is one of the opcodes from ADD to BR_LE_NUM, which have a constant-`b` form.
+    static bool hasConstantForm(RegisterCode::Opcode op) {
+        return op >= RegisterCode::ADD && op <= RegisterCode::BR_LE_NUM;
+    }
+
+    // The opcode that computes `b OP a`, for an opcode `op` that computes `a OP b`; or -1.
+    static int swappedOpcode(RegisterCode::Opcode op) {
+        int branch = (op >= RegisterCode::BR_EQ) ? kBranchOffset : 0;
+        switch (op - branch) {
+            case RegisterCode::ADD_NUM: case RegisterCode::MUL_NUM:
+            case RegisterCode::EQ:      case RegisterCode::NE:      return op;
+            case RegisterCode::GT:      return RegisterCode::LT + branch;
+            case RegisterCode::GE:      return RegisterCode::LE + branch;
+            case RegisterCode::LT:      return RegisterCode::GT + branch;
+            case RegisterCode::LE:      return RegisterCode::GE + branch;
+            case RegisterCode::GT_NUM:  return RegisterCode::LT_NUM + branch;
+            case RegisterCode::GE_NUM:  return RegisterCode::LE_NUM + branch;
+            case RegisterCode::LT_NUM:  return RegisterCode::GT_NUM + branch;
+            case RegisterCode::LE_NUM:  return RegisterCode::GE_NUM + branch;
+            default:                    return -1;
+        }
+    }
+
+
+    // Returns the built-in or generated rule that produces the superinstruction `word`, or nullptr.
+    static const Fusion* fusionFor(const Word *word) {
+        for (auto rules : {kFusions, kGeneratedFusions}) {
+            for (auto f = rules; f->fused; ++f) {
+                if (f->fused == word)
+                    return f;
+            }
+        }
+        return nullptr;
+    }
+
+
+    // True if `word`'s parameter is a branch offset.
+    static bool isBranch(const Word *word) {
+        return word->hasIntParams() && word != &_RECURSE && word != &_SHUFFLE;
+    }
+
+
+    static bool isInterpWord(const Word *word) {
+        return word >= &kInterpWords[0][0] && word < &kInterpWords[0][0] + 2 * kMaxInterp;
+    }
+
+
+#pragma mark - TRANSLATOR:
+
+
+    class RegisterCode::Translator {
+    public:
+        Translator(RegisterCode &rc, const vector<Instruction> &code)
+        :_rc(rc)
+        ,_threaded(code)
+        ,_depthAt(code.size(), -1)
+        ,_isTarget(code.size(), false)
+        ,_labels(code.size(), -1)
+        {
+            for (uint16_t i = 0; i < rc._inputs; ++i)
+                _stack.push_back(i);
+        }
+
+        bool translate() {
+            // First find the branch destinations:
+            for (size_t pc = 0; pc < _threaded.size(); ) {
+                const Word *word = Compiler::activeVocabularies.lookup(_threaded[pc]);
+                if (!word || !word->isNative() || pc + 1 + word->parameters() > _threaded.size())
+                    return false;
+                if (isBranch(word)) {
+                    size_t dst = pc + 2 + _threaded[pc + 1].offset;
+                    if (dst >= _threaded.size())
+                        return false;
+                    _isTarget[dst] = true;
+                }
+                pc += 1 + word->parameters();
+            }
+
+            for (size_t pc = 0; pc < _threaded.size(); ) {
+                const Word *word = Compiler::activeVocabularies.lookup(_threaded[pc]);
+                if (_isTarget[pc]) {
+                    if (_reachable) {
+                        flush();
+                        if (!setDepthAt(pc))
+                            return false;
+                    } else if (_depthAt[pc] >= 0) {
+                        resetStack(_depthAt[pc]);
+                        _reachable = true;
+                    } else {
+                        return false;
+                    }
+                }
+                if (_reachable) {
+                    _labels[pc] = int32_t(_rc._code.size());
+                    if (!translateWord(word, &_threaded[pc + 1], pc, false))
+                        return false;
+                }
+                // (Code that can't be reached, after a branch or return, is skipped.)
+                pc += 1 + word->parameters();
+            }
+
+            // Resolve the branches, to offsets from themselves:
+            for (size_t i : _branches) {
+                auto &instr = _rc._code[i];
+                if (_labels[instr.target] < 0)
+                    return false;
+                instr.target = _labels[instr.target] - int32_t(i);
+            }
+            return !_failed;
+        }
+
+    private:
+        // Emits the code for one threaded instruction at `pc`, with parameters `params`.
+        bool translateWord(const Word *word, const Instruction *params, size_t pc, bool numeric) {
+            // A numbers-only word is translated like its generic form, with `numeric` set:
+            for (auto s = kNumericSpecializations; s->numeric; ++s) {
+                if (s->isVariant(word)) {
+                    word = s->generic;
+                    numeric = true;
+                    break;
+                }
+            }
+            // Quickening words and their quickened forms are translated as the generic word.
+            for (auto q = kQuickenings; q->generic; ++q) {
+                if (q->quickening == word || q->quickened == word) {
+                    word = q->generic;
+                    break;
+                }
+            }
+            if (!word->stackEffect().isWeird()
+                    && size_t(word->stackEffect().inputCount()) > _stack.size())
+                return false;
+
+            size_t depth = _stack.size();
+            if (word == &_RETURN) {
+                flush();
+                emit(RETURN, uint16_t(depth));
+                _reachable = false;
+            } else if (word == &_LITERAL) {
+                push(constant(params[0].literal));
+            } else if (word == &ZERO) {
+                push(constant(Value(0)));
+            } else if (word == &ONE) {
+                push(constant(Value(1)));
+            } else if (word == &NULL_) {
+                push(constant(NullValue));
+            } else if (word == &NOP) {
+                // nothing
+            } else if (word == &DUP) {
+                push(_stack[depth - 1]);
+            } else if (word == &DROP) {
+                _stack.pop_back();
+            } else if (word == &SWAP) {
+                swap(_stack[depth - 1], _stack[depth - 2]);
+            } else if (word == &OVER) {
+                push(_stack[depth - 2]);
+            } else if (word == &ROT) {
+                rotate(_stack.end() - 3, _stack.end() - 2, _stack.end());
+            } else if (word == &_SHUFFLE) {
+                ShuffleParam shuffle = params[0].shuffle;
+                if (shuffle.inputs > depth)
+                    return false;
+                Operand in[ShuffleParam::kMaxItems];    // numbered from the top, like the param
+                for (int i = 0; i < shuffle.inputs; ++i)
+                    in[i] = _stack[depth - 1 - i];
+                _stack.resize(depth - shuffle.inputs);
+                for (int i = shuffle.outputs - 1; i >= 0; --i)
+                    push(in[shuffle.source(i)]);
+            } else if (auto op = findOp(kBinaryOps, word); op) {
+                Operand b = pop(), a = pop();
+                compute(numeric ? op->numericOp : op->op, a, b);
+            } else if (auto op = findOp(kZeroCompareOps, word); op) {
+                Operand a = pop();
+                compute(op->op, a, constant(Value(0)));
+            } else if (word == &I || word == &J) {
+                compute(INDEX, (word == &I) ? 1 : 2, 0);
+            } else if (word == &_BRANCH) {
+                flush();
+                branch(BR, 0, 0, pc, params);
+                _reachable = false;
+            } else if (word == &_ZBRANCH) {
+                auto [a, b] = popForBranch(1);
+                branch(BRZ, a, b, pc, params);
+            } else if (auto op = findOp(kCompareBranchOps, word); op) {
+                auto [a, b] = popForBranch(2);
+                branch(Opcode((numeric ? op->numericOp : op->op) + kBranchOffset), a, b, pc, params);
+            } else if (auto op = findOp(kZeroCompareBranchOps, word); op) {
+                auto [a, b] = popForBranch(1);
+                branch(Opcode(op->op + kBranchOffset), a, constant(Value(0)), pc, params);
+            } else if (word == &_DO) {
+                auto [limit, start] = popForBranch(2);
+                branch(DO, limit, start, pc, params);
+            } else if (word == &_LOOP) {
+                flush();
+                branch(LOOP, 0, 0, pc, params);
+            } else if (word == &_PLUSLOOP) {
+                auto [a, b] = popForBranch(1);
+                branch(PLUSLOOP, a, b, pc, params);
+            } else if (auto f = fusionFor(word); f) {
+                // Translate a superinstruction's parts. (Its one parameter, if any, belongs to
+                // whichever part takes one; and a 0BRANCH part can only come last, so its offset
+                // is still relative to `pc`.)
+                return translateWord(f->first, params, pc, numeric)
+                    && translateWord(f->second, params, pc, numeric);
+            } else if (word == &_RECURSE) {
+                // RECURSE runs this code directly, unless the stack is too full; then it calls
+                // `_RECURSE` with the parameter block [param, _RETURN, _REGS, this code], the
+                // param's offset pointing to the `_REGS`, to continue on a new stack segment.
+                RecurseParam param = params[0].recurse;
+                param.offset = 1;
+                const Instruction block[4] = {param, _RETURN, _REGS,
+                                              Instruction::withRegisters(&_rc)};
+                if (!call(word, block, 4, param.inputs, param.outputs))
+                    return false;
+                _rc._code.back().op = RECURSE;
+                _rc._code.back().b = param.max;
+                return true;
+            } else if (isInterpWord(word)) {
+                // The net stack effect of the interpreted words it calls:
+                int inputs = 0, outputs = 0;
+                for (int i = 0; i < word->parameters(); ++i) {
+                    auto callee = Compiler::activeVocabularies.lookup(params[i]);
+                    if (!callee || callee->stackEffect().isWeird())
+                        return false;
+                    auto effect = callee->stackEffect();
+                    int needed = effect.inputCount() - outputs;
+                    if (needed > 0) {
+                        inputs += needed;
+                        outputs += needed;
+                    }
+                    outputs += effect.outputCount() - effect.inputCount();
+                }
+                return call(word, params, word->parameters(), inputs, outputs);
+            } else if (word == &_UNLOOP) {
+                return call(word, params, 0, 0, 0);
+            } else if (!word->isMagic() && !word->stackEffect().isWeird()) {
+                return call(word, params, word->parameters(),
+                            word->stackEffect().inputCount(), word->stackEffect().outputCount());
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        // The virtual stack:
+
+        void push(Operand o)            {_stack.push_back(o);}
+        Operand pop()                   {Operand o = _stack.back(); _stack.pop_back(); return o;}
+
+        // True if some item on the virtual stack lives in slot `slot`.
+        bool isLive(Operand slot) const {
+            return find(_stack.begin(), _stack.end(), slot) != _stack.end();
+        }
+
+        // Puts every item of a stack of the given depth in its own slot.
+        void resetStack(size_t depth) {
+            _stack.clear();
+            for (size_t i = 0; i < depth; ++i)
+                _stack.push_back(Operand(i));
+        }
+
+        Operand constant(Value v) {
+            auto &constants = _rc._constants;
+            size_t i = 0;
+            while (i < constants.size() && !constants[i].isIdentical(v))
+                ++i;
+            if (i == constants.size())
+                constants.push_back(v);
+            return Operand(kConstant | i);
+        }
+
+        // Emitting code:
+
+        size_t emit(Opcode op, uint16_t dst, Operand a = 0, Operand b = 0, int32_t target = 0) {
+            _rc._code.push_back({op, dst, a, b, target});
+            return _rc._code.size() - 1;
+        }
+
+        // Rewrites an operation with a constant operand to use the form of `op` whose `b` is a
+        // constant: swapping the operands if that's allowed, else moving `a` into a free slot.
+        Opcode constantLast(Opcode op, Operand &a, Operand &b) {
+            if (!hasConstantForm(op))
+                return op;
+            if ((a & kConstant) && !(b & kConstant)) {
+                if (int swapped = swappedOpcode(op); swapped >= 0) {
+                    std::swap(a, b);
+                    op = Opcode(swapped);
+                }
+            }
+            if (a & kConstant) {
+                // (The two operands were items above the live ones, so one of their own slots
+                // is free.)
+                Operand slot = 0;
+                while (isLive(slot) || slot == b)
+                    ++slot;
+                emit(MOV, slot, a);
+                a = slot;
+            }
+            return (b & kConstant) ? Opcode(op + kConstantOffset) : op;
+        }
+
+        // Emits an instruction computing a new item from operands `a` and `b`, and pushes it.
+        void compute(Opcode op, Operand a, Operand b) {
+            op = constantLast(op, a, b);
+            // Use the item's own slot, unless another item is there; then any free one. (There
+            // are more slots up to here than items below, so one is free.)
+            auto dst = Operand(_stack.size());
+            if (isLive(dst)) {
+                dst = 0;
+                while (isLive(dst))
+                    ++dst;
+            }
+            emit(op, dst, a, b);
+            push(dst);
+        }
+
+        // Emits a branch to the destination of the threaded branch at `pc`.
+        void branch(Opcode op, Operand a, Operand b, size_t pc, const Instruction *params) {
+            op = constantLast(op, a, b);
+            size_t dst = pc + 2 + params[0].offset;
+            _branches.push_back(emit(op, 0, a, b, int32_t(dst)));
+            setDepthAt(dst);
+        }
+
+        // Records the (flushed) stack depth at a branch destination; returns false if a different
+        // depth was already recorded.
+        bool setDepthAt(size_t pc) {
+            if (_depthAt[pc] < 0)
+                _depthAt[pc] = int(_stack.size());
+            else if (_depthAt[pc] != int(_stack.size()))
+                _failed = true;
+            return !_failed;
+        }
+
+        // Emits a call to `word`, with its parameters, on the flushed stack.
+        bool call(const Word *word, const Instruction *params, size_t nParams,
+                  int inputs, int outputs)
+        {
+            if (size_t(inputs) > _stack.size())
+                return false;
+            flush();
+            emit(CALL, uint16_t(_stack.size()), 0, 0, int32_t(_rc._blocks.size()));
+            _rc._blocks.push_back(word->instruction());
+            _rc._blocks.insert(_rc._blocks.end(), &params[0], &params[nParams]);
+            _rc._blocks.push_back(_RETURN.instruction());
+            resetStack(_stack.size() - inputs + outputs);
+            return _stack.size() < kConstant;
+        }
+
+        // Pops the operands of a conditional branch (returning them, or 0 for a missing second
+        // one), and flushes the rest of the stack, without overwriting a slot an operand is in.
+        pair<Operand,Operand> popForBranch(size_t n) {
+            size_t k = _stack.size() - n;
+            for (size_t p = 0; p < k; ++p) {
+                if (_stack[p] != p && find(_stack.begin() + k, _stack.end(), p) != _stack.end()) {
+                    flush();        // Flushing the operands too puts them out of harm's way
+                    break;
+                }
+            }
+            Operand b = (n > 1) ? pop() : 0;
+            Operand a = pop();
+            flush();
+            return {a, b};
+        }
+
+        // Moves every item on the virtual stack into its own slot: a "parallel move".
+        void flush() {
+            vector<pair<Operand,Operand>> moves;    // (dst slot, src)
+            for (size_t p = 0; p < _stack.size(); ++p) {
+                if (_stack[p] != p)
+                    moves.push_back({Operand(p), _stack[p]});
+            }
+            auto isSource = [&](Operand slot) {
+                for (auto &m : moves)
+                    if (m.second == slot)
+                        return true;
+                return false;
+            };
+            while (!moves.empty()) {
+                // Make a move whose destination no other move still needs to read:
+                bool moved = false;
+                for (size_t i = 0; i < moves.size() && !moved; ++i) {
+                    auto [dst, src] = moves[i];
+                    if (!isSource(dst)) {
+                        emit(MOV, dst, src);
+                        moves.erase(moves.begin() + i);
+                        moved = true;
+                    }
+                }
+                if (!moved) {
+                    // The rest form cycles of slots (a move from a constant, or a slot read by two
+                    // moves, would lead to a move nothing reads.) Swap the first move's slots, and update the
+                    // move that read its destination to read the other slot:
+                    auto [dst, src] = moves.front();
+                    moves.erase(moves.begin());
+                    emit(XCHG, dst, src);
+                    for (auto &m : moves) {
+                        if (m.second == dst)
+                            m.second = src;
+                    }
+                }
+            }
+            resetStack(_stack.size());
+        }
+
+        RegisterCode&               _rc;
+        const vector<Instruction>&  _threaded;
+        vector<Operand>             _stack;         // Virtual stack: where each item is
+        vector<int>                 _depthAt;       // Stack depth at each branch destination
+        vector<bool>                _isTarget;      // Which threaded instructions are destinations
+        vector<int32_t>             _labels;        // Register code index of each threaded instr
+        vector<size_t>              _branches;      // Branches, whose targets are threaded pcs
+        bool                        _reachable = true;
+        bool                        _failed = false;
+    };
+
+
+#pragma mark - REGISTERCODE:
+
+
+    shared_ptr<RegisterCode> RegisterCode::translate(const vector<Instruction> &code,
+                                                     const StackEffect &effect)
+    {
+        if (!enabled || effect.isWeird() || effect.inputCount() + effect.max() >= kConstant)
+            return nullptr;
+        shared_ptr<RegisterCode> rc(new RegisterCode);
+        rc->_inputs = uint16_t(effect.inputCount());
+        if (!Translator(*rc, code).translate())
+            return nullptr;
+        return rc;
+    }
+
+
+    // `run` dispatches with computed `goto`s (a GCC and Clang extension) instead of a `switch`:
+    // each instruction's code ends with its own indirect jump to the next, whose target the CPU
+    // predicts separately, much as it does the tail calls of threaded code.
+    Value* RegisterCode::run(Value *sp) const {
+        static constexpr const void* kLabels[] = {
+            &&MOV, &&XCHG,
+            &&ADD, &&SUB, &&MUL, &&DIV, &&MOD,
+            &&ADD_NUM, &&SUB_NUM, &&MUL_NUM, &&DIV_NUM,
+            &&EQ, &&NE, &&GT, &&GE, &&LT, &&LE,
+            &&GT_NUM, &&GE_NUM, &&LT_NUM, &&LE_NUM,
+            &&BR_EQ, &&BR_NE, &&BR_GT, &&BR_GE, &&BR_LT, &&BR_LE,
+            &&BR_GT_NUM, &&BR_GE_NUM, &&BR_LT_NUM, &&BR_LE_NUM,
+            &&ADD_K, &&SUB_K, &&MUL_K, &&DIV_K, &&MOD_K,
+            &&ADD_NUM_K, &&SUB_NUM_K, &&MUL_NUM_K, &&DIV_NUM_K,
+            &&EQ_K, &&NE_K, &&GT_K, &&GE_K, &&LT_K, &&LE_K,
+            &&GT_NUM_K, &&GE_NUM_K, &&LT_NUM_K, &&LE_NUM_K,
+            &&BR_EQ_K, &&BR_NE_K, &&BR_GT_K, &&BR_GE_K, &&BR_LT_K, &&BR_LE_K,
+            &&BR_GT_NUM_K, &&BR_GE_NUM_K, &&BR_LT_NUM_K, &&BR_LE_NUM_K,
+            &&BR, &&BRZ,
+            &&DO, &&LOOP, &&PLUSLOOP,
+            &&INDEX,
+            &&CALL, &&RECURSE,
+            &&RETURN,
+        };
+        static_assert(std::size(kLabels) == RETURN + 1);
+
+        // Recursive calls save their return address here, instead of nesting C++ calls, so deep
+        // recursion can't overflow the native stack. (The caller's frame is implied by the
+        // depth of the RECURSE before it.) It belongs to this call, so it's reentrant, and is
+        // freed if a callee throws.
+        vector<const Instr*> returns;
+
+        Value *frame = sp - _inputs + 1;
+        const Value *constants = _constants.data();
+
+        const Instr *in = _code.data();
+        // (These are macros, not lambdas, since capturing `frame` or `in` by reference keeps
+        // them in memory instead of in registers.)
+        #define get(OPERAND)    (((OPERAND) & kConstant) ? constants : frame)[(OPERAND) & ~kConstant]
+        #define NEXT_INSTR()    goto *kLabels[(++in)->op]
+        #define JUMP()          goto *kLabels[(in += in->target)->op]
+        #define BRANCH_UNLESS(COND) if (COND) NEXT_INSTR(); else JUMP()
+        // Defines an opcode and its constant-`b` form, both running `CODE` with operands `a`, `b`:
+        #define BINARY(OP, CODE) \
+            OP:     { Value a = frame[in->a], b = frame[in->b]; CODE; } \
+            OP##_K: { Value a = frame[in->a], b = constants[in->b & ~kConstant]; CODE; }
+        #define NUM_ARITH(OP)   frame[in->dst] = NUMERIC_ARITH(a, OP, b, Any)
+        #define NUM_COMPARE(OP) NUMERIC_COMPARE(a, OP, b, Any)
+
+        goto *kLabels[in->op];
+
+    MOV:        frame[in->dst] = get(in->a); NEXT_INSTR();
+    XCHG:       std::swap(frame[in->dst], frame[in->a]); NEXT_INSTR();
+
+    BINARY(ADD,         frame[in->dst] = a + b; NEXT_INSTR())
+    BINARY(SUB,         frame[in->dst] = a - b; NEXT_INSTR())
+    BINARY(MUL,         frame[in->dst] = a * b; NEXT_INSTR())
+    BINARY(DIV,         frame[in->dst] = a / b; NEXT_INSTR())
+    BINARY(MOD,         frame[in->dst] = a % b; NEXT_INSTR())
+    BINARY(ADD_NUM,     NUM_ARITH(+); NEXT_INSTR())
+    BINARY(SUB_NUM,     NUM_ARITH(-); NEXT_INSTR())
+    BINARY(MUL_NUM,     NUM_ARITH(*); NEXT_INSTR())
+    BINARY(DIV_NUM,     frame[in->dst] = Value(a.asDouble() / b.asDouble()); NEXT_INSTR())
+
+    BINARY(EQ,          frame[in->dst] = Value(a == b); NEXT_INSTR())
+    BINARY(NE,          frame[in->dst] = Value(a != b); NEXT_INSTR())
+    BINARY(GT,          frame[in->dst] = Value(a >  b); NEXT_INSTR())
+    BINARY(GE,          frame[in->dst] = Value(a >= b); NEXT_INSTR())
+    BINARY(LT,          frame[in->dst] = Value(a <  b); NEXT_INSTR())
+    BINARY(LE,          frame[in->dst] = Value(a <= b); NEXT_INSTR())
+    BINARY(GT_NUM,      frame[in->dst] = Value(NUM_COMPARE(>)); NEXT_INSTR())
+    BINARY(GE_NUM,      frame[in->dst] = Value(NUM_COMPARE(>=)); NEXT_INSTR())
+    BINARY(LT_NUM,      frame[in->dst] = Value(NUM_COMPARE(<)); NEXT_INSTR())
+    BINARY(LE_NUM,      frame[in->dst] = Value(NUM_COMPARE(<=)); NEXT_INSTR())
+
+    BINARY(BR_EQ,       BRANCH_UNLESS(a == b))
+    BINARY(BR_NE,       BRANCH_UNLESS(a != b))
+    BINARY(BR_GT,       BRANCH_UNLESS(a >  b))
+    BINARY(BR_GE,       BRANCH_UNLESS(a >= b))
+    BINARY(BR_LT,       BRANCH_UNLESS(a <  b))
+    BINARY(BR_LE,       BRANCH_UNLESS(a <= b))
+    BINARY(BR_GT_NUM,   BRANCH_UNLESS(NUM_COMPARE(>)))
+    BINARY(BR_GE_NUM,   BRANCH_UNLESS(NUM_COMPARE(>=)))
+    BINARY(BR_LT_NUM,   BRANCH_UNLESS(NUM_COMPARE(<)))
+    BINARY(BR_LE_NUM,   BRANCH_UNLESS(NUM_COMPARE(<=)))
+
+    BR:         JUMP();
+    BRZ:        BRANCH_UNLESS(get(in->a));
+
+    DO: {
+        LoopFrame loop = LoopFrame::make(get(in->b), get(in->a));
+        if (loop.empty())
+            JUMP();
+        if (loopStack == loopStackEnd)
+            growLoopStack();
+        *loopStack++ = loop;
+        NEXT_INSTR();
+    }
+    LOOP: {
+        if (loopStack[-1].next())
+            JUMP();
+        --loopStack;
+        NEXT_INSTR();
+    }
+    PLUSLOOP: {
+        if (loopStack[-1].next(get(in->a)))
+            JUMP();
+        --loopStack;
+        NEXT_INSTR();
+    }
+    INDEX:      frame[in->dst] = loopStack[-in->a].index; NEXT_INSTR();
+
+    CALL: {
+        Value *callSp = call(frame + in->dst - 1, &_blocks[in->target]);
+        assert(callSp >= frame - 1);
+        (void)callSp;
+        NEXT_INSTR();
+    }
+    RECURSE: {
+        Value *callSp = frame + in->dst - 1;
+        if (callSp + in->b > stackLimit) {
+            call(callSp, &_blocks[in->target]);     // (continues on a new stack segment)
+            NEXT_INSTR();
+        }
+        returns.push_back(in + 1);      // (not `in`, whose address would escape)
+        frame = callSp - _inputs + 1;
+        in = _code.data();
+        goto *kLabels[in->op];
+    }
+    RETURN:
+        if (!returns.empty()) {
+            in = returns.back();
+            returns.pop_back();
+            frame += _inputs - in[-1].dst;
+            goto *kLabels[in->op];
+        }
+        return frame + in->dst - 1;
+
+        #undef NEXT_INSTR
+        #undef JUMP
+        #undef BRANCH_UNLESS
+        #undef BINARY
+        #undef NUM_ARITH
+        #undef NUM_COMPARE
+        #undef get
+    }
+
+
+    string RegisterCode::disassemble() const {
+        stringstream out;
+        auto operand = [&](Operand o) {
+            if (o & kConstant)
+                out << _constants[o & ~kConstant];
+            else
+                out << 'r' << o;
+        };
+        for (size_t i = 0; i < _code.size(); ++i) {
+            const Instr &in = _code[i];
+            int target = int(i) + in.target;
+            out << i << ": " << kOpcodeNames[in.op];
+            switch (in.op) {
+                case MOV: case XCHG:
+                    out << " r" << in.dst << ", ";
+                    operand(in.a);
+                    break;
+                case INDEX:
+                    out << " r" << in.dst << ", " << in.a;
+                    break;
+                case BR: case LOOP:
+                    out << " -> " << target;
+                    break;
+                case BRZ: case PLUSLOOP:
+                    out << ' ';
+                    operand(in.a);
+                    out << " -> " << target;
+                    break;
+                case RECURSE:
+                    out << " @" << in.dst;
+                    break;
+                case CALL:
+                    if (auto word = Compiler::activeVocabularies.lookup(_blocks[in.target]); word)
+                        out << ' ' << word->name();
+                    out << " @" << in.dst;
+                    break;
+                case RETURN:
+                    out << " @" << in.dst;
+                    break;
+                default: {
+                    int op = (in.op >= ADD_K && in.op <= BR_LE_NUM_K) ? in.op - kConstantOffset
+                                                                      : in.op;
+                    if (op < BR_EQ)
+                        out << " r" << in.dst << ",";
+                    out << ' ';
+                    operand(in.a);
+                    out << ", ";
+                    operand(in.b);
+                    if (op >= BR_EQ)
+                        out << " -> " << target;
+                    break;
+                }
+            }
+            out << '\n';
+        }
+        return out.str();
+    }
+
+}
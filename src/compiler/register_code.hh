@@ -0,0 +1,88 @@
+//
+// register_code.hh
+//
+// Copyright (C) 2021 Jens Alfke. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "instruction.hh"
+#include "stack_effect.hh"
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace tails {
+
+    /// A word's threaded code lowered to a three-address "register" form. Since the stack checker
+    /// has proven the stack depth at every instruction, each stack position can be treated as a
+    /// fixed register: a slot of the word's stack frame, numbered up from its first input. The
+    /// translator tracks at compile time which slot (or constant) holds each stack item, so stack
+    /// shuffles and literals generate no code at all; arithmetic and comparisons read their
+    /// operands from wherever the items are and write the result to a free slot. Items are only
+    /// moved into their own slots where control flow joins, and before calls and returns.
+    ///
+    /// Words the register code can't implement itself, like `LENGTH` or calls to interpreted
+    /// words, are called normally, on the real stack.
+    class RegisterCode {
+    public:
+        /// Translates threaded code (as produced by the Compiler, ending with `_RETURN`) with the
+        /// given stack effect. Returns nullptr if it contains an instruction that can't be
+        /// translated, in which case the caller should just keep using the threaded code.
+        static std::shared_ptr<RegisterCode> translate(const std::vector<Instruction> &code,
+                                                       const StackEffect &effect);
+
+        /// Runs the code on a stack whose top item is at `sp`, returning the new stack pointer,
+        /// like `call`. The top of the stack must be in memory, even with ENABLE_TOS_REGISTER.
+        Value* run(Value *sp) const;
+
+        /// The number of register instructions.
+        size_t size() const             {return _code.size();}
+
+        /// A readable listing of the code, one instruction per line. Slots are shown as `r0`,
+        /// `r1`... and constants as their values.
+        std::string disassemble() const;
+
+        /// Set this to true to translate compiled words to register code. (It takes precedence
+        /// over native code.)
+        static inline bool enabled = false;
+
+        /// The register instructions (defined in register_code.cc.)
+        enum Opcode : uint8_t;
+
+    private:
+        using Operand = uint16_t;       // A slot number, or kConstant | a constant's index
+
+        static constexpr Operand kConstant = 0x8000;
+
+        struct Instr {
+            Opcode   op;
+            uint16_t dst;               // Destination slot; stack depth for CALL and RETURN
+            Operand  a, b;              // Source operands
+            int32_t  target;            // Relative branch destination, or CALL's param block
+        };
+
+        class Translator;
+
+        RegisterCode() = default;
+        RegisterCode(const RegisterCode&) = delete;
+
+        uint16_t                 _inputs = 0;   // Number of inputs: the slots below `sp` at entry
+        std::vector<Instr>       _code;
+        std::vector<Value>       _constants;
+        std::vector<Instruction> _blocks;       // Threaded code of the words it calls
+    };
+
+}
@@ -19,13 +19,23 @@
 #include "vocabulary.hh"
 #include "core_words.hh"
 #include "word.hh"
-#include "utils.hh"
 #include "gc.hh"
+#include <algorithm>
 
 
 namespace tails {
 
-    const Vocabulary Vocabulary::core(core_words::kWords);
+    // The core vocabulary is the perfect-hash table of core words, plus the words defined in
+    // other source files, whose names the table can't see at compile time.
+    const Vocabulary Vocabulary::core = [] {
+        Vocabulary core(core_words::kWordTable);
+        core.add(core_words::DEFINE);
+        core.add(core_words::kGeneratedWords);
+        return core;
+    }();
+
+
+    Vocabulary::Vocabulary() = default;
 
 
     Vocabulary::Vocabulary(const Word* const *wordList) {
@@ -33,34 +43,119 @@ namespace tails {
     }
 
 
+    Vocabulary::Vocabulary(const WordTable &table)
+    :_table(&table)
+    { }
+
+
     void Vocabulary::add(const Word* const *wordList) {
         while (*wordList)
             add(**wordList++);
     }
 
 
+    // `_words` and `_byInstruction` are open-addressing hash tables with linear probing, whose
+    // sizes are powers of 2; they're kept at most half full.
+
+    static void place(std::vector<const Word*> &table, const Word *word, uint64_t hash) {
+        size_t mask = table.size() - 1;
+        size_t i = hash & mask;
+        while (table[i])
+            i = (i + 1) & mask;
+        table[i] = word;
+    }
+
+    // Makes sure `table` has room for `count` words, rehashing them if it has to grow.
+    template <class HASH>
+    static void reserve(std::vector<const Word*> &table, size_t count, HASH hashOf) {
+        if (2 * count <= table.size())
+            return;
+        std::vector<const Word*> old(std::max(table.size() * 2, size_t(16)), nullptr);
+        swap(old, table);
+        for (const Word *word : old) {
+            if (word)
+                place(table, word, hashOf(word));
+        }
+    }
+
+    static uint64_t nameHash(const Word *word) {
+        return word_names::hash(word->name());
+    }
+
+    static uint64_t instructionHash(Instruction instr) {
+        uint64_t h = uint64_t(uintptr_t(instr.native)) * 0x9E3779B97F4A7C15;
+        return h ^ (h >> 32);
+    }
+
+    static uint64_t instructionHashOf(const Word *word) {
+        return instructionHash(word->instruction());
+    }
+
+
     void Vocabulary::add(const Word &word) {
-        _words.insert({word.name(), &word});
+        std::string_view name = word.name();
+        uint64_t hash = word_names::hash(name);
+        if (lookup(name, hash))
+            return;                                     // (like `map::insert`, keeps the original)
+        reserve(_words, ++_count, nameHash);
+        place(_words, &word, hash);
+        if (!_byInstruction.empty())
+            indexInstruction(&word);
     }
 
 
     const Word* Vocabulary::lookup(std::string_view name) const {
-        if (auto i = _words.find(toupper(std::string(name))); i != _words.end())
-            return i->second;
-        else
-            return nullptr;
+        return lookup(name, word_names::hash(name));
+    }
+
+
+    const Word* Vocabulary::lookup(std::string_view name, uint64_t hash) const {
+        if (_table) {
+            if (auto word = _table->lookup(name, hash); word)
+                return word;
+        }
+        if (_count > 0) {
+            size_t mask = _words.size() - 1;
+            for (size_t i = hash & mask; _words[i]; i = (i + 1) & mask) {
+                if (word_names::equal(_words[i]->name(), name))
+                    return _words[i];
+            }
+        }
+        return nullptr;
     }
 
 
+    // The index from instructions to words is built the first time it's needed, so it doesn't
+    // slow down startup; after that, `add` keeps it up to date.
     const Word* Vocabulary::lookup(Instruction instr) const {
-        for (auto i = _words.begin(); i != _words.end(); ++i) {
-            if (i->second->instruction() == instr)
-                return i->second;
+        if (_byInstruction.empty()) {
+            for (const Word *word : *this)
+                indexInstruction(word);
+        }
+        return findInstruction(instr);
+    }
+
+
+    const Word* Vocabulary::findInstruction(Instruction instr) const {
+        if (_byInstructionCount > 0) {
+            size_t mask = _byInstruction.size() - 1;
+            for (size_t i = instructionHash(instr) & mask; _byInstruction[i]; i = (i + 1) & mask) {
+                if (_byInstruction[i]->instruction() == instr)
+                    return _byInstruction[i];
+            }
         }
         return nullptr;
     }
 
 
+    void Vocabulary::indexInstruction(const Word *word) const {
+        if (findInstruction(word->instruction()))
+            return;                                     // (an alias; keep the first one)
+        reserve(_byInstruction, ++_byInstructionCount, instructionHashOf);
+        place(_byInstruction, word, instructionHashOf(word));
+    }
+
+
 
     void VocabularyStack::push(const Vocabulary &v)  {
         _active.push_back(&v);
@@ -73,8 +168,9 @@ namespace tails {
 
 
     const Word* VocabularyStack::lookup(std::string_view name) const {
+        uint64_t hash = word_names::hash(name);
         for (auto vocab : _active)
-            if (auto word = vocab->lookup(name); word)
+            if (auto word = vocab->lookup(name, hash); word)
                 return word;
         return nullptr;
     }
@@ -87,15 +183,21 @@ namespace tails {
     }
 
     VocabularyStack::iterator& VocabularyStack::iterator::operator++ () {
-        if (++_iWord == _endWords) {
-            if (++_iVoc != _endVoc) {
-                _iWord = (*_iVoc)->begin();
-                _endWords = (*_iVoc)->end();
-            }
-        }
+        ++_iWord;
+        skipEmpty();
         return *this;
     }
 
+    // Advances to the next vocabulary while the current one is exhausted.
+    void VocabularyStack::iterator::skipEmpty() {
+        while (_iWord == _endWords) {
+            if (++_iVoc == _endVoc)
+                break;
+            _iWord = (*_iVoc)->begin();
+            _endWords = (*_iVoc)->end();
+        }
+    }
+
 
     void VocabularyStack::gcScan() {
         for (auto word : *this)
@@ -18,8 +18,8 @@
 
 #pragma once
 #include "instruction.hh"
+#include "word_table.hh"
 #include <string_view>
-#include <unordered_map>
 #include <vector>
 #include <assert.h>
 
@@ -27,30 +27,70 @@ namespace tails {
     class Word;
 
     /// A lookup table to find Words by name. Used by the Compiler.
+    /// Names are matched case-insensitively.
     class Vocabulary {
     public:
         Vocabulary();
 
         explicit Vocabulary(const Word* const *wordList);
 
+        /// Constructs a Vocabulary whose initial words are those in a WordTable. (This doesn't
+        /// copy anything, so it's nearly free.) More words can be added.
+        explicit Vocabulary(const WordTable&);
+
         void add(const Word &word);
 
         void add(const Word* const *wordList);
 
         const Word* lookup(std::string_view name) const;
+
+        /// Finds the word whose instruction this is: a native word's op, or an interpreted
+        /// word's code. This uses a hash index, so it's fast enough for the disassembler.
         const Word* lookup(Instruction) const;
 
-        using map = std::unordered_map<std::string_view, const Word*>;
-        using iterator = map::const_iterator;
+        /// Looks up a name given its \ref word_names::hash, which VocabularyStack only computes once.
+        const Word* lookup(std::string_view name, uint64_t hash) const;
+
+        /// Iterates the Words, in no particular order.
+        class iterator {
+        public:
+            iterator() = default;
+            const Word* operator* () const          {return _vocab->slotAt(_i);}
+            iterator& operator++ ()                 {++_i; skipEmpty(); return *this;}
+            bool operator==(const iterator &other) const {return _i == other._i;}
+            bool operator!=(const iterator &other) const {return _i != other._i;}
+        private:
+            friend class Vocabulary;
+            iterator(const Vocabulary *v, size_t i)  :_vocab(v), _i(i) {skipEmpty();}
+            void skipEmpty()    {while (_i < _vocab->slotCount() && !_vocab->slotAt(_i)) ++_i;}
+
+            const Vocabulary*   _vocab = nullptr;
+            size_t              _i = 0;
+        };
 
-        iterator begin() const    {return _words.begin();}
-        iterator end() const      {return _words.end();}
+        iterator begin() const    {return iterator(this, 0);}
+        iterator end() const      {return iterator(this, slotCount());}
 
         // The vocabulary of core words.
         static const Vocabulary core;
 
     private:
-        map         _words;
+        // The slots of the WordTable, if any, followed by those of `_words`:
+        size_t slotCount() const {
+            return (_table ? _table->slotCount() : 0) + _words.size();
+        }
+        const Word* slotAt(size_t i) const {
+            size_t n = _table ? _table->slotCount() : 0;
+            return i < n ? _table->slots()[i] : _words[i - n];
+        }
+        const Word* findInstruction(Instruction) const;
+        void indexInstruction(const Word*) const;
+
+        const WordTable*            _table = nullptr;   // Predefined words, if any
+        std::vector<const Word*>    _words;             // Added words: open addressing, by hash
+        size_t                      _count = 0;         // Number of words in `_words`
+        mutable std::vector<const Word*> _byInstruction;  // All words, by instruction (lazy)
+        mutable size_t              _byInstructionCount = 0;
     };
 
 
@@ -75,25 +115,34 @@ namespace tails {
 
         class iterator {
         public:
-            const Word* operator* () const          {return _iWord->second;}
-            const Word* operator-> () const         {return _iWord->second;}
+            const Word* operator* () const          {return *_iWord;}
+            const Word* operator-> () const         {return *_iWord;}
             iterator& operator++ ();
-            bool operator==(const iterator &other)  {return _iVoc == other._iVoc;}
-            bool operator!=(const iterator &other)  {return _iVoc != other._iVoc;}
+            bool operator==(const iterator &other) const {
+                return _iVoc == other._iVoc && (_iVoc == _endVoc || _iWord == other._iWord);
+            }
+            bool operator!=(const iterator &other) const {return !(*this == other);}
 
         private:
             friend class VocabularyStack;
-            iterator(const std::vector<const Vocabulary*> &active,
-                     Vocabulary::iterator beginWords, Vocabulary::iterator endWords)
-            :_iVoc(active.begin()), _endVoc(active.end()), _iWord(beginWords), _endWords(endWords)
-            { }
+            iterator(const std::vector<const Vocabulary*> &active, bool atEnd)
+            :_iVoc(atEnd ? active.end() : active.begin()), _endVoc(active.end())
+            {
+                if (_iVoc != _endVoc) {
+                    _iWord = (*_iVoc)->begin();
+                    _endWords = (*_iVoc)->end();
+                    skipEmpty();
+                }
+            }
+
+            void skipEmpty();
 
             std::vector<const Vocabulary*>::const_iterator  _iVoc, _endVoc;
             Vocabulary::iterator                            _iWord, _endWords;
         };
 
-        iterator begin() const {return iterator(_active, _active.front()->begin(), _active.front()->end());}
-        iterator end() const   {return iterator(_active, _active.front()->end(),   _active.front()->end());}
+        iterator begin() const {return iterator(_active, false);}
+        iterator end() const   {return iterator(_active, true);}
 
     private:
         std::vector<const Vocabulary*>  _active;
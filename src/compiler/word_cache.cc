@@ -0,0 +1,101 @@
+//
+// word_cache.cc
+//
+// Copyright (C) 2021 Jens Alfke. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "word_cache.hh"
+#include "gc.hh"
+#include <cassert>
+#include <cctype>
+
+namespace tails {
+    using namespace std;
+
+
+    WordCache::WordCache(size_t capacity)
+    :_capacity(capacity)
+    {
+        assert(capacity > 0);
+    }
+
+
+    string WordCache::keyFor(string_view source, const Value *bottom, const Value *top) {
+        string key;
+        key.reserve(source.size() + 8);
+        // Collapse whitespace, except in string literals:
+        bool inString = false, space = false;
+        for (char c : source) {
+            if (!inString && isspace((unsigned char)c)) {
+                space = true;
+                continue;
+            }
+            if (space && !key.empty())
+                key += ' ';
+            space = false;
+            key += c;
+            if (c == '"')
+                inString = !inString;
+        }
+        // Then append the input stack's types; the NUL can't appear in source code:
+        key += '\0';
+        if (bottom && top) {
+            for (auto vp = bottom; vp <= top; ++vp)
+                key += char('A' + vp->type());
+        }
+        return key;
+    }
+
+
+    const CompiledWord& WordCache::compile(const string &source,
+                                           const Value *bottom, const Value *top)
+    {
+        string key = keyFor(source, bottom, top);
+        if (auto i = _index.find(key); i != _index.end()) {
+            // Hit: move the entry to the front:
+            ++_stats.hits;
+            _entries.splice(_entries.begin(), _entries, i->second);
+            return *i->second->word;
+        }
+
+        ++_stats.misses;
+        Compiler compiler;
+        compiler.setInputStack(bottom, top);
+        compiler.parse(source);
+        auto word = make_unique<CompiledWord>(move(compiler));
+
+        if (_entries.size() >= _capacity) {
+            ++_stats.evictions;
+            _index.erase(_entries.back().key);
+            _entries.pop_back();
+        }
+        _entries.push_front({move(key), move(word)});
+        _index.emplace(_entries.front().key, _entries.begin());
+        return *_entries.front().word;
+    }
+
+
+    void WordCache::clear() {
+        _index.clear();
+        _entries.clear();
+    }
+
+
+    void WordCache::gcScan() const {
+        for (auto &entry : _entries)
+            gc::object::scanWord(entry.word.get());
+    }
+
+}
@@ -0,0 +1,91 @@
+//
+// word_cache.hh
+//
+// Copyright (C) 2021 Jens Alfke. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "compiler.hh"
+#include "value.hh"
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+
+namespace tails {
+
+    /// A bounded cache of compiled words, so that evaluating the same source code over and over
+    /// doesn't parse and compile it every time. It's keyed by the source code, with runs of
+    /// whitespace outside string literals collapsed, plus the types of the input stack (as in
+    /// \ref Compiler::setInputStack), since those affect the stack check and the generated code.
+    /// When it's full, the least recently used word is evicted.
+    ///
+    /// Cached words aren't in any Vocabulary, so call \ref gcScan before a garbage collection to
+    /// keep their literals alive.
+    /// If the active vocabularies change, call \ref clear, since names may now mean other words.
+    /// Not thread-safe: use a cache per thread.
+    class WordCache {
+    public:
+        explicit WordCache(size_t capacity = 1024);
+
+        /// Returns the compiled word for `source`, to run on a stack holding `bottom` through
+        /// `top` (which may both be null if it's empty.) If it isn't cached, compiles it, with its
+        /// inputs set by \ref Compiler::setInputStack, and adds it to the cache. A compile_error
+        /// propagates, and nothing is cached.
+        /// The reference is valid until the word is evicted: until the next call that misses, or
+        /// \ref clear.
+        const CompiledWord& compile(const std::string &source,
+                                    const Value *bottom, const Value *top);
+
+        /// The maximum number of words cached.
+        size_t capacity() const                 {return _capacity;}
+
+        /// The number of words currently cached.
+        size_t size() const                     {return _entries.size();}
+
+        struct Stats {
+            size_t hits = 0;                    ///< `compile` calls that found a cached word
+            size_t misses = 0;                  ///< `compile` calls that had to compile
+            size_t evictions = 0;               ///< Words removed to make room for others
+        };
+
+        const Stats& stats() const              {return _stats;}
+
+        /// Removes all the cached words.
+        void clear();
+
+        /// Marks the object literals of all cached words, so they survive the next sweep.
+        /// Call this along with \ref VocabularyStack::gcScan.
+        void gcScan() const;
+
+        /// The cache key for some source code and input stack.
+        static std::string keyFor(std::string_view source, const Value *bottom, const Value *top);
+
+    private:
+        struct Entry {
+            std::string                   key;
+            std::unique_ptr<CompiledWord> word;
+        };
+        using EntryList = std::list<Entry>;     // Most recently used first
+
+        size_t                                          _capacity;
+        EntryList                                       _entries;
+        std::unordered_map<std::string_view, EntryList::iterator> _index; // Keys point into `_entries`
+        Stats                                           _stats;
+    };
+
+}
@@ -19,7 +19,12 @@
 // Reference: <https://forth-standard.org/standard/core>
 
 #include "core_words.hh"
+#include "register_code.hh"
 #include "stack_effect.hh"
+#include "stack_pool.hh"
+#include <algorithm>
+#include <array>
+#include <utility>
 
 
 namespace tails::core_words {
@@ -37,19 +42,14 @@ namespace tails::core_words {
 
 #pragma mark The absolute core:
 
-    // Calls the interpreted word pointed to by the following instruction.
-    NATIVE_WORD(_INTERP, "_INTERP", StackEffect::weird(),
-                Word::MagicWordParam)
-    {
-        sp = call(sp, (pc++)->word);
-        NEXT();
-    }
+    // (`_INTERP`, which calls an interpreted word, is generated along with its variants; see
+    // CALL OPTIMIZATIONS below.)
 
     // Returns from the current word. Every interpreted word ends with this.
     NATIVE_WORD(_RETURN, "_RETURN", StackEffect(),
                 Word::Magic)
     {
-        return sp;
+        EXIT();
     }
 
     // Pushes the following instruction as a Value.
@@ -58,118 +58,165 @@ namespace tails::core_words {
     NATIVE_WORD(_LITERAL, "_LITERAL", StackEffect({}, {Any}),
                 Word::MagicValParam)
     {
-        *(++sp) = (pc++)->literal;
+        PUSH((pc++)->literal);
         NEXT();
     }
 
 
 #pragma mark - CALL OPTIMIZATIONS:
 
-    // Interprets 2 following words (saving an instruction and some clock cycles.)
-    NATIVE_WORD(_INTERP2, "_INTERP2", StackEffect::weird(),
-                Word::MagicWordParam, 2)
-    {
-        sp = call(sp, (pc++)->word);
-        sp = call(sp, (pc++)->word);
-        NEXT();
+    // The `_INTERP` family. `_INTERP` is followed by a pointer to an interpreted word, which it
+    // calls. `_INTERPn` is followed by `n` word pointers, which it calls in order; this saves a
+    // dispatch per word in a series of calls. `_TAILINTERPn` _jumps_ to the last word, as a
+    // tail-call optimization, so the return stack doesn't grow; it must be the last instruction
+    // before a `_RETURN`. (The `_RETURN` could then be optional, except every word ends with one.)
+    //
+    // All of these are generated from the template below, up to n = kMaxInterp.
+
+    template <size_t N, bool Tail>
+    static NATIVE_OP_SIGNATURE(f_interp) {
+        for (size_t i = 0; i < N - Tail; ++i)
+            CALL_WORD((pc++)->word);
+        if constexpr (Tail) {
+            TAIL_CALL_WORD(pc->word);
+        } else {
+            NEXT();
+        }
     }
 
-    // Interprets 3 following words.
-    NATIVE_WORD(_INTERP3, "_INTERP3", StackEffect::weird(),
-                Word::MagicWordParam, 3)
-    {
-        sp = call(sp, (pc++)->word);
-        sp = call(sp, (pc++)->word);
-        NEXT();
-    }
+    // The name of an `_INTERP` family word, e.g. "_INTERP", "_INTERP12", "_TAILINTERP3".
+    template <size_t N, bool Tail>
+    struct InterpName {
+        static_assert(N >= 1 && N <= 99);
+        static constexpr auto str = [] {
+            std::array<char, 16> name {};
+            size_t len = 0;
+            for (const char *c = (Tail ? "_TAILINTERP" : "_INTERP"); *c; ++c)
+                name[len++] = *c;
+            if (N >= 10)
+                name[len++] = char('0' + N / 10);
+            if (N >= 2)
+                name[len++] = char('0' + N % 10);
+            return name;
+        }();
+    };
 
-    // Interprets 4 following words.
-    NATIVE_WORD(_INTERP4, "_INTERP4", StackEffect::weird(),
-                Word::MagicWordParam, 4)
-    {
-        sp = call(sp, (pc++)->word);
-        sp = call(sp, (pc++)->word);
-        sp = call(sp, (pc++)->word);
-        sp = call(sp, (pc++)->word);
-        NEXT();
-    }
+    template <size_t... Is>
+    struct InterpFamily {
+        static constexpr Word kWords[2][sizeof...(Is)] = {
+            {Word(InterpName<Is+1, false>::str.data(), f_interp<Is+1, false>,
+                  StackEffect::weird(), Word::MagicWordParam, uint8_t(Is+1))...},
+            {Word(InterpName<Is+1, true>::str.data(),  f_interp<Is+1, true>,
+                  StackEffect::weird(), Word::MagicWordParam, uint8_t(Is+1))...},
+        };
+        static constexpr std::array<const Word*, 2 * sizeof...(Is)> kPointers = {
+            &kWords[0][Is]..., &kWords[1][Is]...
+        };
+    };
 
-    // _Jumps_ to the interpreted word pointed to by the following instruction,
-    // as a tail-call optimization. The stack does not grow.
-    // This must of course be the last word before a _RETURN.
-    // (The _RETURN could then be optional, except it's currently used when inlining.)
-    NATIVE_WORD(_TAILINTERP, "_TAILINTERP", StackEffect::weird(),
-                Word::MagicWordParam, 1)
-    {
-        MUSTTAIL return call(sp, pc->word);
-    }
+    template <size_t... Is>
+    static constexpr auto makeInterpFamily(std::index_sequence<Is...>) {return InterpFamily<Is...>();}
 
-    // Interprets 2 following words, jumping to the last one.
-    NATIVE_WORD(_TAILINTERP2, "_TAILINTERP2", StackEffect::weird(),
-                Word::MagicWordParam, 2)
-    {
-        sp = call(sp, (pc++)->word);
-        MUSTTAIL return call(sp, pc->word);
-    }
+    using InterpWords = decltype(makeInterpFamily(std::make_index_sequence<kMaxInterp>()));
 
-    // Interprets 3 following words, jumping to the last one.
-    NATIVE_WORD(_TAILINTERP3, "_TAILINTERP3", StackEffect::weird(),
-                Word::MagicWordParam, 3)
+    const Word (&kInterpWords)[2][kMaxInterp] = InterpWords::kWords;
+
+    constexpr const Word &_INTERP     = InterpWords::kWords[0][0];
+    constexpr const Word &_TAILINTERP = InterpWords::kWords[1][0];
+
+
+#ifdef ENABLE_NATIVE_CODEGEN
+    // Jumps to the native machine code whose entry point is the following instruction's op.
+    // If an interpreted word has been translated to native code, this is its first instruction;
+    // the original threaded code follows, for the disassembler and the inliner.
+    // (The parameter isn't an offset, so the word has no HasIntParam flag, just a parameter.)
+    NATIVE_WORD(_JIT, "_JIT", StackEffect::weird(),
+                Word::Magic, 1)
     {
-        sp = call(sp, (pc++)->word);
-        sp = call(sp, (pc++)->word);
-        MUSTTAIL return call(sp, pc->word);
+        MUSTTAIL return pc->native(sp, pc + 1);
     }
-
-    // Interprets 4 following words, jumping to the last one.
-    NATIVE_WORD(_TAILINTERP4, "_TAILINTERP4", StackEffect::weird(),
-                Word::MagicWordParam, 4)
+#endif
+
+    // Runs the RegisterCode that the following instruction points to, and returns.
+    // If an interpreted word has been translated to register code, this is its first instruction;
+    // the original threaded code follows, for the disassembler and the inliner.
+    // (Like `_JIT`'s, the parameter isn't an offset, so there's no HasIntParam flag.)
+    NATIVE_WORD(_REGS, "_REGS", StackEffect::weird(),
+                Word::Magic, 1)
     {
-        sp = call(sp, (pc++)->word);
-        sp = call(sp, (pc++)->word);
-        sp = call(sp, (pc++)->word);
-        MUSTTAIL return call(sp, pc->word);
+        sp[0] = TOS;                        // (a no-op without ENABLE_TOS_REGISTER)
+        sp = pc->registers->run(sp);
+        TOS = sp[0];
+        EXIT();
     }
 
-    // There's no reason there couldn't be more of these: _INTERP5, _INTERP6, ...
-    // They'd need to be implemented here, and added to kWords and kInterpWords.
-
 
 #pragma mark Stack gymnastics:
 
-    NATIVE_WORD(DUP, "DUP", StackEffect({Any}, {Any/0, Any/0})) {
-        ++sp;
-        sp[0] = sp[-1];
+    NATIVE_WORD(DUP, "DUP", StackEffect({Any}, {Any/0, Any/0}), Word::Pure) {
+        PUSH(TOS);
         NEXT();
     }
 
-    NATIVE_WORD(DROP, "DROP", StackEffect({Any}, {})) {
-        --sp;
+    NATIVE_WORD(DROP, "DROP", StackEffect({Any}, {}), Word::Pure) {
+        POP();
         NEXT();
     }
 
     NATIVE_WORD(SWAP, "SWAP", StackEffect({Any,   Any},
-                                          {Any/0, Any/1}))
+                                          {Any/0, Any/1}), Word::Pure)
     {
-        std::swap(sp[0], sp[-1]);
+        std::swap(TOS, sp[-1]);
         NEXT();
     }
 
     NATIVE_WORD(OVER, "OVER", StackEffect({Any,   Any},
-                                          {Any/1, Any/0, Any/1}))
+                                          {Any/1, Any/0, Any/1}), Word::Pure)
     {
-        ++sp;
-        sp[0] = sp[-2];
+        PUSH(sp[-1]);
         NEXT();
     }
 
     NATIVE_WORD(ROT, "ROT", StackEffect({Any,   Any,   Any},
-                                        {Any/1, Any/0, Any/2}))
+                                        {Any/1, Any/0, Any/2}), Word::Pure)
     {
         auto sp2 = sp[-2];
         sp[-2] = sp[-1];
-        sp[-1] = sp[ 0];
-        sp[ 0] = sp2;
+        sp[-1] = TOS;
+        TOS    = sp2;
+        NEXT();
+    }
+
+    // Does the work of `_SHUFFLE` on `N` inputs, with the copy of the inputs unrolled.
+    template <int N>
+    ALWAYS_INLINE static inline Value* shuffle(Value *sp, ShuffleParam shuffle) {
+        Value in[N > 0 ? N : 1];
+        Value *bottom = sp - N + 1;
+        for (int i = 0; i < N; ++i)
+            in[i] = bottom[i];
+        for (int i = shuffle.outputs - 1; i >= 0; --i)
+            *bottom++ = in[N - 1 - shuffle.source(i)];
+        return bottom - 1;
+    }
+
+    NATIVE_WORD(_SHUFFLE, "_SHUFFLE", StackEffect::weird(), Word::MagicIntParam) {
+        {
+            ShuffleParam param = (pc++)->shuffle;
+            sp[0] = TOS;                    // (a no-op without ENABLE_TOS_REGISTER)
+            static_assert(ShuffleParam::kMaxItems == 8);
+            switch (param.inputs) {
+                case 0:  sp = shuffle<0>(sp, param); break;
+                case 1:  sp = shuffle<1>(sp, param); break;
+                case 2:  sp = shuffle<2>(sp, param); break;
+                case 3:  sp = shuffle<3>(sp, param); break;
+                case 4:  sp = shuffle<4>(sp, param); break;
+                case 5:  sp = shuffle<5>(sp, param); break;
+                case 6:  sp = shuffle<6>(sp, param); break;
+                case 7:  sp = shuffle<7>(sp, param); break;
+                default: sp = shuffle<8>(sp, param); break;
+            }
+            TOS = sp[0];
+        }
         NEXT();
     }
 
@@ -200,22 +247,153 @@ namespace tails::core_words {
     NATIVE_WORD(_ZBRANCH, "0BRANCH", StackEffect({Any}, {}),
                 Word::MagicIntParam)
     {
-        if (!(*sp--))
+        bool cond;
+        { Value top = TOS; cond = !!top; }
+        POP();
+        if (!cond)
             pc += pc->offset;
         ++pc;
         NEXT();
     }
 
+    Value* stackLimit = nullptr;
+
+    // Stack segments for recursive calls that don't fit below `stackLimit`.
+    static StackPool sStackSegments;
+
+    // Runs a recursive call of the word starting at `start` on a new stack segment: copies its
+    // inputs to the segment, calls it, and copies its outputs back. The top of the stack must be
+    // in memory at `*sp`, even with ENABLE_TOS_REGISTER.
+    NOINLINE static Value* recurseOnNewSegment(Value *sp, const Instruction *start,
+                                               RecurseParam param)
+    {
+        DataStack segment = sStackSegments.acquire(param.inputs + param.max);
+        Value *inputs = sp - param.inputs + 1;
+        std::copy(inputs, sp + 1, segment.base());
+        Value *segmentSp;
+        {
+            StackLimitScope limit(segment.limit());
+            segmentSp = call(segment.base() + param.inputs - 1, start);
+        }
+        std::copy(segmentSp - param.outputs + 1, segmentSp + 1, inputs);
+        return inputs + param.outputs - 1;
+    }
+
     // recursively calls the current word. The offset back to the start of the word is stored at
-    // *pc, so this is similar to a BRANCH back to the start, except it uses `call`.
+    // *pc, so this is similar to a BRANCH back to the start, except it uses `call`. If the call
+    // could grow the stack past `stackLimit`, it runs on a new stack segment instead.
     NATIVE_WORD(_RECURSE, "_RECURSE", StackEffect::weird(),
                 Word::MagicIntParam)
     {
-        call(sp, pc + 1 + pc->offset);
+        RecurseParam param = pc->recurse;
+        const Instruction *start = pc + 1 + param.offset;
+        ++pc;
+        if (sp + param.max <= stackLimit) {
+            CALL_WORD(start);
+        } else {
+            // (Without ENABLE_TOS_REGISTER these assignments of the top of stack are no-ops.)
+            sp[0] = TOS;
+            sp = recurseOnNewSegment(sp, start, param);
+            TOS = sp[0];
+        }
+        NEXT();
+    }
+
+
+#pragma mark Counted loops:
+
+    // `limit start DO ... LOOP` runs the body with the index `I` going from `start` up to
+    // `limit - 1`; `+LOOP` pops the amount to add to the index, which may be negative. The index
+    // and limit are kept on the loop stack, not the data stack. (Unlike standard Forth, `DO`
+    // skips the loop entirely if `start` equals `limit`, as `?DO` does; and `LOOP` stops as soon
+    // as the index reaches or passes the limit.) The compiler turns `LEAVE` into `_UNLOOP` and a
+    // branch past the end of the loop.
+
+    static constexpr size_t kInitialLoopDepth = 64;
+    static LoopFrame sInitialLoopFrames[kInitialLoopDepth];
+    LoopFrame* loopStackBase = sInitialLoopFrames;
+    LoopFrame* loopStack = sInitialLoopFrames;
+    LoopFrame* loopStackEnd = sInitialLoopFrames + kInitialLoopDepth;
+
+    void growLoopStack() {
+        // A DO loop around a non-tail RECURSE nests once per call, so there's no fixed limit.
+        // Frames are only ever accessed relative to `loopStack`, so they can simply be moved:
+        size_t depth = loopStack - loopStackBase, capacity = loopStackEnd - loopStackBase;
+        auto frames = new LoopFrame[2 * capacity];
+        std::copy(loopStackBase, loopStack, frames);
+        if (loopStackBase != sInitialLoopFrames)
+            delete [] loopStackBase;
+        loopStackBase = frames;
+        loopStack = frames + depth;
+        loopStackEnd = frames + 2 * capacity;
+    }
+
+    // ( limit# start# -- ) Pushes a loop frame, or if start == limit, branches past the loop.
+    NATIVE_WORD(_DO, "_DO", StackEffect({Num, Num}, {}),
+                Word::MagicIntParam)
+    {
+        LoopFrame frame;
+        { Value top = TOS; frame = LoopFrame::make(top, sp[-1]); }
+        POPN(2);
+        if (frame.empty()) {
+            pc += pc->offset;
+        } else {
+            if (loopStack == loopStackEnd)
+                growLoopStack();
+            *loopStack++ = frame;
+        }
+        ++pc;
+        NEXT();
+    }
+
+    // Increments the index and branches back to the start of the loop, unless it's done.
+    NATIVE_WORD(_LOOP, "_LOOP", StackEffect(),
+                Word::MagicIntParam)
+    {
+        if (loopStack[-1].next())
+            pc += pc->offset;
+        else
+            --loopStack;
+        ++pc;
+        NEXT();
+    }
+
+    // ( n# -- ) Like `_LOOP` but adds `n` to the index. If `n` is negative, the loop continues
+    // until the index goes below the limit.
+    NATIVE_WORD(_PLUSLOOP, "_+LOOP", StackEffect({Num}, {}),
+                Word::MagicIntParam)
+    {
+        bool more;
+        { Value top = TOS; more = loopStack[-1].next(top); }
+        POP();
+        if (more)
+            pc += pc->offset;
+        else
+            --loopStack;
         ++pc;
         NEXT();
     }
 
+    // Pops the innermost loop frame; used by `LEAVE`.
+    NATIVE_WORD(_UNLOOP, "_UNLOOP", StackEffect(),
+                Word::Magic)
+    {
+        --loopStack;
+        NEXT();
+    }
+
+    // ( -- i# ) Pushes the index of the innermost loop.
+    NATIVE_WORD(I, "I", StackEffect({}, {Num})) {
+        PUSH(loopStack[-1].index);
+        NEXT();
+    }
+
+    // ( -- j# ) Pushes the index of the next outer loop.
+    NATIVE_WORD(J, "J", StackEffect({}, {Num})) {
+        PUSH(loopStack[-2].index);
+        NEXT();
+    }
+
 
     // (? quote -> ?)  Pops a quotation (word) and calls it.
     // The actual stack effect is that of the quotation it calls, which in the general case is
@@ -224,9 +402,11 @@ namespace tails::core_words {
     NATIVE_WORD(CALL, "CALL", StackEffect::weird(),
                 Word::Magic)
     {
-        const Word *quote = (*sp--).asQuote();
+        const Word *quote;
+        { Value top = TOS; quote = top.asQuote(); }
         assert(quote);                                  // FIXME: Handle somehow; exceptions?
-        sp = call(sp, quote->instruction().word);
+        POP();
+        CALL_WORD(quote->instruction().word);
         NEXT();
     }
 
@@ -237,8 +417,10 @@ namespace tails::core_words {
     // Stack effect is dependent on quote1 and quote2; currently this word is special-cased by
     // the compiler's stack-checker.
     NATIVE_WORD(IFELSE, "IFELSE", StackEffect::weird()) {
-        const Word *quote = (!!sp[-2] ? sp[-1] : sp[0]).asQuote();
-        sp = call(sp - 3, quote->instruction().word);
+        const Word *quote;
+        { Value top = TOS; quote = (!!sp[-2] ? sp[-1] : top).asQuote(); }
+        POPN(3);
+        CALL_WORD(quote->instruction().word);
         NEXT();
     }
 
@@ -247,13 +429,13 @@ namespace tails::core_words {
 
     // These assume the C++ Value type supports arithmetic and relational operators.
 
-    NATIVE_WORD(ZERO, "0", StackEffect({}, {Num})) {
-        *(++sp) = Value(0);
+    NATIVE_WORD(ZERO, "0", StackEffect({}, {Num}), Word::Pure) {
+        PUSH(Value(0));
         NEXT();
     }
 
-    NATIVE_WORD(ONE, "1", StackEffect({}, {Num})) {
-        *(++sp) = Value(1);
+    NATIVE_WORD(ONE, "1", StackEffect({}, {Num}), Word::Pure) {
+        PUSH(Value(1));
         NEXT();
     }
 
@@ -276,26 +458,214 @@ namespace tails::core_words {
     BINARY_OP_WORD(LT,    "<",   kRelEffect, <)
     BINARY_OP_WORD(LE,    "<=",  kRelEffect, <=)
 
-    NATIVE_WORD(EQ_ZERO, "0=",  k0RelEffect)  { sp[0] = Value(sp[0] == Value(0)); NEXT(); }
-    NATIVE_WORD(NE_ZERO, "0<>", k0RelEffect)  { sp[0] = Value(sp[0] != Value(0)); NEXT(); }
-    NATIVE_WORD(GT_ZERO, "0>",  k0RelEffect)  { sp[0] = Value(sp[0] >  Value(0)); NEXT(); }
-    NATIVE_WORD(LT_ZERO, "0<",  k0RelEffect)  { sp[0] = Value(sp[0] <  Value(0)); NEXT(); }
+    NATIVE_WORD(EQ_ZERO, "0=",  k0RelEffect, Word::Pure)  { {Value a = TOS; TOS = Value(a == Value(0));} NEXT(); }
+    NATIVE_WORD(NE_ZERO, "0<>", k0RelEffect, Word::Pure)  { {Value a = TOS; TOS = Value(a != Value(0));} NEXT(); }
+    NATIVE_WORD(GT_ZERO, "0>",  k0RelEffect, Word::Pure)  { {Value a = TOS; TOS = Value(a >  Value(0));} NEXT(); }
+    NATIVE_WORD(LT_ZERO, "0<",  k0RelEffect, Word::Pure)  { {Value a = TOS; TOS = Value(a <  Value(0));} NEXT(); }
 
     // [Appended an "_" to the symbol name to avoid conflict with C's `NULL`.]
-    NATIVE_WORD(NULL_, "NULL", StackEffect({}, {Nul})) {
-        *(++sp) = NullValue;
+    NATIVE_WORD(NULL_, "NULL", StackEffect({}, {Nul}), Word::Pure) {
+        PUSH(NullValue);
         NEXT();
     }
 
 
 #pragma mark Strings & Arrays:
 
-    NATIVE_WORD(LENGTH, "LENGTH", StackEffect({Str|Arr}, {Num})) {
-        *sp = sp->length();
+    NATIVE_WORD(LENGTH, "LENGTH", StackEffect({Str|Arr}, {Num}), Word::Pure) {
+        { Value top = TOS; TOS = top.length(); }
+        NEXT();
+    }
+
+
+#pragma mark - SUPERINSTRUCTIONS:
+
+    // These fuse a literal with the binary operator that follows it, saving a dispatch and a
+    // stack push. The compiler emits them in place of `_LITERAL x <op>`; see kFusions below.
+
+    LITERAL_OP_WORD(_LIT_PLUS,  "_LIT+",   StackEffect({Num|Str|Arr}, {(Num|Str|Arr)/0}), +)
+    LITERAL_OP_WORD(_LIT_MINUS, "_LIT-",   StackEffect({Num}, {Num}), -)
+    LITERAL_OP_WORD(_LIT_MULT,  "_LIT*",   StackEffect({Num}, {Num}), *)
+    LITERAL_OP_WORD(_LIT_DIV,   "_LIT/",   StackEffect({Num}, {Num}), /)
+    LITERAL_OP_WORD(_LIT_MOD,   "_LITMOD", StackEffect({Num}, {Num}), %)
+
+    LITERAL_OP_WORD(_LIT_EQ,    "_LIT=",   k0RelEffect, ==)
+    LITERAL_OP_WORD(_LIT_NE,    "_LIT<>",  k0RelEffect, !=)
+    LITERAL_OP_WORD(_LIT_GT,    "_LIT>",   k0RelEffect, >)
+    LITERAL_OP_WORD(_LIT_GE,    "_LIT>=",  k0RelEffect, >=)
+    LITERAL_OP_WORD(_LIT_LT,    "_LIT<",   k0RelEffect, <)
+    LITERAL_OP_WORD(_LIT_LE,    "_LIT<=",  k0RelEffect, <=)
+
+    // These fuse a comparison with the `0BRANCH` after it, so an `IF` or `WHILE` condition
+    // doesn't have to push a boolean and then test it.
+
+    COMPARE_BRANCH_WORD(_EQ_ZBRANCH, "_=0BRANCH",  ==)
+    COMPARE_BRANCH_WORD(_NE_ZBRANCH, "_<>0BRANCH", !=)
+    COMPARE_BRANCH_WORD(_GT_ZBRANCH, "_>0BRANCH",  >)
+    COMPARE_BRANCH_WORD(_GE_ZBRANCH, "_>=0BRANCH", >=)
+    COMPARE_BRANCH_WORD(_LT_ZBRANCH, "_<0BRANCH",  <)
+    COMPARE_BRANCH_WORD(_LE_ZBRANCH, "_<=0BRANCH", <=)
+
+    ZERO_COMPARE_BRANCH_WORD(_ZERO_EQ_ZBRANCH, "_0=0BRANCH",  ==)
+    ZERO_COMPARE_BRANCH_WORD(_ZERO_NE_ZBRANCH, "_0<>0BRANCH", !=)
+    ZERO_COMPARE_BRANCH_WORD(_ZERO_GT_ZBRANCH, "_0>0BRANCH",  >)
+    ZERO_COMPARE_BRANCH_WORD(_ZERO_LT_ZBRANCH, "_0<0BRANCH",  <)
+
+
+#pragma mark - NUMERIC SPECIALIZATIONS:
+
+    // Variants of the above for operands the stack checker has proven are numbers, or more
+    // specifically integers or doubles; see kNumericSpecializations below. (`MOD` isn't here,
+    // since it works on ints.)
+
+    static constexpr StackEffect kNumRelEffect({Num, Num}, {Num});
+
+    NUMERIC_OP_WORD(_PLUS_NUM,   "_NUM+",  kBinEffect, +, Any)
+    NUMERIC_OP_WORD(_MINUS_NUM,  "_NUM-",  kBinEffect, -, Any)
+    NUMERIC_OP_WORD(_MULT_NUM,   "_NUM*",  kBinEffect, *, Any)
+    NUMERIC_OP_WORD(_DIV_NUM,    "_NUM/",  kBinEffect, /, Any)
+    NUMERIC_REL_WORD(_GT_NUM,   "_NUM>",  kNumRelEffect, >, Any)
+    NUMERIC_REL_WORD(_GE_NUM,   "_NUM>=", kNumRelEffect, >=, Any)
+    NUMERIC_REL_WORD(_LT_NUM,   "_NUM<",  kNumRelEffect, <, Any)
+    NUMERIC_REL_WORD(_LE_NUM,   "_NUM<=", kNumRelEffect, <=, Any)
+
+    NUMERIC_OP_WORD(_PLUS_INT,   "_INT+",  kBinEffect, +, Int)
+    NUMERIC_OP_WORD(_MINUS_INT,  "_INT-",  kBinEffect, -, Int)
+    NUMERIC_OP_WORD(_MULT_INT,   "_INT*",  kBinEffect, *, Int)
+    NUMERIC_OP_WORD(_DIV_INT,    "_INT/",  kBinEffect, /, Int)
+    NUMERIC_REL_WORD(_GT_INT,   "_INT>",  kNumRelEffect, >, Int)
+    NUMERIC_REL_WORD(_GE_INT,   "_INT>=", kNumRelEffect, >=, Int)
+    NUMERIC_REL_WORD(_LT_INT,   "_INT<",  kNumRelEffect, <, Int)
+    NUMERIC_REL_WORD(_LE_INT,   "_INT<=", kNumRelEffect, <=, Int)
+
+    NUMERIC_OP_WORD(_PLUS_DBL,   "_DBL+",  kBinEffect, +, Double)
+    NUMERIC_OP_WORD(_MINUS_DBL,  "_DBL-",  kBinEffect, -, Double)
+    NUMERIC_OP_WORD(_MULT_DBL,   "_DBL*",  kBinEffect, *, Double)
+    NUMERIC_OP_WORD(_DIV_DBL,    "_DBL/",  kBinEffect, /, Double)
+    NUMERIC_REL_WORD(_GT_DBL,   "_DBL>",  kNumRelEffect, >, Double)
+    NUMERIC_REL_WORD(_GE_DBL,   "_DBL>=", kNumRelEffect, >=, Double)
+    NUMERIC_REL_WORD(_LT_DBL,   "_DBL<",  kNumRelEffect, <, Double)
+    NUMERIC_REL_WORD(_LE_DBL,   "_DBL<=", kNumRelEffect, <=, Double)
+
+    static constexpr StackEffect kNumUnaryEffect({Num}, {Num});
+
+    NUMERIC_LITERAL_OP_WORD(_LIT_PLUS_NUM,   "_LITNUM+",  kNumUnaryEffect, +, Any)
+    NUMERIC_LITERAL_OP_WORD(_LIT_MINUS_NUM,  "_LITNUM-",  kNumUnaryEffect, -, Any)
+    NUMERIC_LITERAL_OP_WORD(_LIT_MULT_NUM,   "_LITNUM*",  kNumUnaryEffect, *, Any)
+    NUMERIC_LITERAL_OP_WORD(_LIT_DIV_NUM,    "_LITNUM/",  kNumUnaryEffect, /, Any)
+    NUMERIC_LITERAL_REL_WORD(_LIT_GT_NUM,    "_LITNUM>",  kNumUnaryEffect, >, Any)
+    NUMERIC_LITERAL_REL_WORD(_LIT_GE_NUM,    "_LITNUM>=", kNumUnaryEffect, >=, Any)
+    NUMERIC_LITERAL_REL_WORD(_LIT_LT_NUM,    "_LITNUM<",  kNumUnaryEffect, <, Any)
+    NUMERIC_LITERAL_REL_WORD(_LIT_LE_NUM,    "_LITNUM<=", kNumUnaryEffect, <=, Any)
+
+    NUMERIC_LITERAL_OP_WORD(_LIT_PLUS_INT,   "_LITINT+",  kNumUnaryEffect, +, Int)
+    NUMERIC_LITERAL_OP_WORD(_LIT_MINUS_INT,  "_LITINT-",  kNumUnaryEffect, -, Int)
+    NUMERIC_LITERAL_OP_WORD(_LIT_MULT_INT,   "_LITINT*",  kNumUnaryEffect, *, Int)
+    NUMERIC_LITERAL_OP_WORD(_LIT_DIV_INT,    "_LITINT/",  kNumUnaryEffect, /, Int)
+    NUMERIC_LITERAL_REL_WORD(_LIT_GT_INT,    "_LITINT>",  kNumUnaryEffect, >, Int)
+    NUMERIC_LITERAL_REL_WORD(_LIT_GE_INT,    "_LITINT>=", kNumUnaryEffect, >=, Int)
+    NUMERIC_LITERAL_REL_WORD(_LIT_LT_INT,    "_LITINT<",  kNumUnaryEffect, <, Int)
+    NUMERIC_LITERAL_REL_WORD(_LIT_LE_INT,    "_LITINT<=", kNumUnaryEffect, <=, Int)
+
+    NUMERIC_LITERAL_OP_WORD(_LIT_PLUS_DBL,   "_LITDBL+",  kNumUnaryEffect, +, Double)
+    NUMERIC_LITERAL_OP_WORD(_LIT_MINUS_DBL,  "_LITDBL-",  kNumUnaryEffect, -, Double)
+    NUMERIC_LITERAL_OP_WORD(_LIT_MULT_DBL,   "_LITDBL*",  kNumUnaryEffect, *, Double)
+    NUMERIC_LITERAL_OP_WORD(_LIT_DIV_DBL,    "_LITDBL/",  kNumUnaryEffect, /, Double)
+    NUMERIC_LITERAL_REL_WORD(_LIT_GT_DBL,    "_LITDBL>",  kNumUnaryEffect, >, Double)
+    NUMERIC_LITERAL_REL_WORD(_LIT_GE_DBL,    "_LITDBL>=", kNumUnaryEffect, >=, Double)
+    NUMERIC_LITERAL_REL_WORD(_LIT_LT_DBL,    "_LITDBL<",  kNumUnaryEffect, <, Double)
+    NUMERIC_LITERAL_REL_WORD(_LIT_LE_DBL,    "_LITDBL<=", kNumUnaryEffect, <=, Double)
+
+    NUMERIC_COMPARE_BRANCH_WORD(_GT_ZBRANCH_NUM,  "_NUM>0BRANCH",  >,  Any)
+    NUMERIC_COMPARE_BRANCH_WORD(_GE_ZBRANCH_NUM,  "_NUM>=0BRANCH", >=, Any)
+    NUMERIC_COMPARE_BRANCH_WORD(_LT_ZBRANCH_NUM,  "_NUM<0BRANCH",  <,  Any)
+    NUMERIC_COMPARE_BRANCH_WORD(_LE_ZBRANCH_NUM,  "_NUM<=0BRANCH", <=, Any)
+
+    NUMERIC_COMPARE_BRANCH_WORD(_GT_ZBRANCH_INT,  "_INT>0BRANCH",  >,  Int)
+    NUMERIC_COMPARE_BRANCH_WORD(_GE_ZBRANCH_INT,  "_INT>=0BRANCH", >=, Int)
+    NUMERIC_COMPARE_BRANCH_WORD(_LT_ZBRANCH_INT,  "_INT<0BRANCH",  <,  Int)
+    NUMERIC_COMPARE_BRANCH_WORD(_LE_ZBRANCH_INT,  "_INT<=0BRANCH", <=, Int)
+
+    NUMERIC_COMPARE_BRANCH_WORD(_GT_ZBRANCH_DBL,  "_DBL>0BRANCH",  >,  Double)
+    NUMERIC_COMPARE_BRANCH_WORD(_GE_ZBRANCH_DBL,  "_DBL>=0BRANCH", >=, Double)
+    NUMERIC_COMPARE_BRANCH_WORD(_LT_ZBRANCH_DBL,  "_DBL<0BRANCH",  <,  Double)
+    NUMERIC_COMPARE_BRANCH_WORD(_LE_ZBRANCH_DBL,  "_DBL<=0BRANCH", <=, Double)
+
+
+#pragma mark - QUICKENING:
+
+    // Self-specializing variants of generic words, used when Compiler::quickeningEnabled is set;
+    // see kQuickenings below. The "quickened" words are the specialized forms the others rewrite
+    // themselves to.
+
+    QuickeningStats quickeningStats;
+
+    QUICKENED_OP_WORD(_PLUS_QNUM,  "_QNUM+",  kBinEffect, +,  PLUS,  NUMERIC_ARITH(a, +, b, Any))
+    QUICKENED_OP_WORD(_MINUS_QNUM, "_QNUM-",  kBinEffect, -,  MINUS, NUMERIC_ARITH(a, -, b, Any))
+    QUICKENED_OP_WORD(_MULT_QNUM,  "_QNUM*",  kBinEffect, *,  MULT,  NUMERIC_ARITH(a, *, b, Any))
+    QUICKENED_OP_WORD(_DIV_QNUM,   "_QNUM/",  kBinEffect, /,  DIV,   a.asDouble() /  b.asDouble())
+    QUICKENED_OP_WORD(_EQ_QNUM,    "_QNUM=",  kRelEffect, ==, EQ,    a.asDouble() == b.asDouble())
+    QUICKENED_OP_WORD(_NE_QNUM,    "_QNUM<>", kRelEffect, !=, NE,    a.asDouble() != b.asDouble())
+    QUICKENED_OP_WORD(_GT_QNUM,    "_QNUM>",  kRelEffect, >,  GT,    a.asDouble() >  b.asDouble())
+    QUICKENED_OP_WORD(_GE_QNUM,    "_QNUM>=", kRelEffect, >=, GE,    a.asDouble() >= b.asDouble())
+    QUICKENED_OP_WORD(_LT_QNUM,    "_QNUM<",  kRelEffect, <,  LT,    a.asDouble() <  b.asDouble())
+    QUICKENED_OP_WORD(_LE_QNUM,    "_QNUM<=", kRelEffect, <=, LE,    a.asDouble() <= b.asDouble())
+
+    QUICKENING_OP_WORD(_Q_PLUS,  "_Q+",  PLUS.stackEffect(), +,  _PLUS_QNUM)
+    QUICKENING_OP_WORD(_Q_MINUS, "_Q-",  kBinEffect,         -,  _MINUS_QNUM)
+    QUICKENING_OP_WORD(_Q_MULT,  "_Q*",  kBinEffect,         *,  _MULT_QNUM)
+    QUICKENING_OP_WORD(_Q_DIV,   "_Q/",  kBinEffect,         /,  _DIV_QNUM)
+    QUICKENING_OP_WORD(_Q_EQ,    "_Q=",  kRelEffect,         ==, _EQ_QNUM)
+    QUICKENING_OP_WORD(_Q_NE,    "_Q<>", kRelEffect,         !=, _NE_QNUM)
+    QUICKENING_OP_WORD(_Q_GT,    "_Q>",  kRelEffect,         >,  _GT_QNUM)
+    QUICKENING_OP_WORD(_Q_GE,    "_Q>=", kRelEffect,         >=, _GE_QNUM)
+    QUICKENING_OP_WORD(_Q_LT,    "_Q<",  kRelEffect,         <,  _LT_QNUM)
+    QUICKENING_OP_WORD(_Q_LE,    "_Q<=", kRelEffect,         <=, _LE_QNUM)
+
+    NATIVE_WORD(_LENGTH_QSTR, "_QSTRLENGTH", LENGTH.stackEffect(), Word::Magic) {
+        {
+            Value top = TOS;
+            if (top.isString()) {
+                ++quickeningStats.hits;
+                TOS = Value(top.asString().size());
+            } else {
+                ++quickeningStats.misses;
+                rewriteOp(pc - 1, LENGTH.instruction().native);
+                TOS = top.length();
+            }
+        }
+        NEXT();
+    }
+
+    NATIVE_WORD(_LENGTH_QARR, "_QARRLENGTH", LENGTH.stackEffect(), Word::Magic) {
+        {
+            Value top = TOS;
+            if (top.isArray()) {
+                ++quickeningStats.hits;
+                TOS = Value(top.asArray()->size());
+            } else {
+                ++quickeningStats.misses;
+                rewriteOp(pc - 1, LENGTH.instruction().native);
+                TOS = top.length();
+            }
+        }
+        NEXT();
+    }
+
+    NATIVE_WORD(_Q_LENGTH, "_QLENGTH", LENGTH.stackEffect(), Word::Magic) {
+        {
+            Value top = TOS;
+            if (top.isString() || top.isArray()) {
+                rewriteOp(pc - 1, (top.isString() ? _LENGTH_QSTR : _LENGTH_QARR).instruction().native);
+                ++quickeningStats.quickened;
+            }
+            TOS = top.length();
+        }
         NEXT();
     }
 
 
+
 #pragma mark - INTERPRETED WORDS:
 
     // These could easily be implemented in native code, but I'm making them interpreted for now
@@ -337,12 +707,11 @@ namespace tails::core_words {
 
     // This null-terminated list is used to register these words in the Vocabulary at startup.
 
-    const Word* const kWords[] = {
-        &_INTERP, &_INTERP2, &_INTERP3, &_INTERP4,
-        &_TAILINTERP, &_TAILINTERP2, &_TAILINTERP3, &_TAILINTERP4, 
+    static constexpr std::array kOtherWords = {
         &_LITERAL, &_RETURN, &_BRANCH, &_ZBRANCH,
         &NOP, &_RECURSE,
-        &DROP, &DUP, &OVER, &ROT, &SWAP,
+        &_DO, &_LOOP, &_PLUSLOOP, &_UNLOOP, &I, &J,
+        &DROP, &DUP, &OVER, &ROT, &SWAP, &_SHUFFLE,
         &ZERO, &ONE,
         &EQ, &NE, &EQ_ZERO, &NE_ZERO,
         &GE, &GT, &GT_ZERO,
@@ -353,8 +722,128 @@ namespace tails::core_words {
         &NULL_,
         &LENGTH,
         &IFELSE,
-        &DEFINE,
-        nullptr
+        &_LIT_PLUS, &_LIT_MINUS, &_LIT_MULT, &_LIT_DIV, &_LIT_MOD,
+        &_LIT_EQ, &_LIT_NE, &_LIT_GT, &_LIT_GE, &_LIT_LT, &_LIT_LE,
+        &_EQ_ZBRANCH, &_NE_ZBRANCH, &_GT_ZBRANCH, &_GE_ZBRANCH, &_LT_ZBRANCH, &_LE_ZBRANCH,
+        &_ZERO_EQ_ZBRANCH, &_ZERO_NE_ZBRANCH, &_ZERO_GT_ZBRANCH, &_ZERO_LT_ZBRANCH,
+        &_PLUS_NUM, &_MINUS_NUM, &_MULT_NUM, &_DIV_NUM,
+        &_GT_NUM, &_GE_NUM, &_LT_NUM, &_LE_NUM,
+        &_LIT_PLUS_NUM, &_LIT_MINUS_NUM, &_LIT_MULT_NUM, &_LIT_DIV_NUM,
+        &_LIT_GT_NUM, &_LIT_GE_NUM, &_LIT_LT_NUM, &_LIT_LE_NUM,
+        &_GT_ZBRANCH_NUM, &_GE_ZBRANCH_NUM, &_LT_ZBRANCH_NUM, &_LE_ZBRANCH_NUM,
+        &_PLUS_INT, &_MINUS_INT, &_MULT_INT, &_DIV_INT,
+        &_GT_INT, &_GE_INT, &_LT_INT, &_LE_INT,
+        &_LIT_PLUS_INT, &_LIT_MINUS_INT, &_LIT_MULT_INT, &_LIT_DIV_INT,
+        &_LIT_GT_INT, &_LIT_GE_INT, &_LIT_LT_INT, &_LIT_LE_INT,
+        &_GT_ZBRANCH_INT, &_GE_ZBRANCH_INT, &_LT_ZBRANCH_INT, &_LE_ZBRANCH_INT,
+        &_PLUS_DBL, &_MINUS_DBL, &_MULT_DBL, &_DIV_DBL,
+        &_GT_DBL, &_GE_DBL, &_LT_DBL, &_LE_DBL,
+        &_LIT_PLUS_DBL, &_LIT_MINUS_DBL, &_LIT_MULT_DBL, &_LIT_DIV_DBL,
+        &_LIT_GT_DBL, &_LIT_GE_DBL, &_LIT_LT_DBL, &_LIT_LE_DBL,
+        &_GT_ZBRANCH_DBL, &_GE_ZBRANCH_DBL, &_LT_ZBRANCH_DBL, &_LE_ZBRANCH_DBL,
+        &_Q_PLUS, &_Q_MINUS, &_Q_MULT, &_Q_DIV, &_Q_EQ, &_Q_NE, &_Q_GT, &_Q_GE, &_Q_LT, &_Q_LE,
+        &_Q_LENGTH,
+        &_PLUS_QNUM, &_MINUS_QNUM, &_MULT_QNUM, &_DIV_QNUM,
+        &_EQ_QNUM, &_NE_QNUM, &_GT_QNUM, &_GE_QNUM, &_LT_QNUM, &_LE_QNUM,
+        &_LENGTH_QSTR, &_LENGTH_QARR,
+#ifdef ENABLE_NATIVE_CODEGEN
+        &_JIT,
+#endif
+        &_REGS,
+        (const Word*)nullptr
+    };
+
+    template <class T, size_t N, size_t M>
+    static constexpr std::array<T, N + M> concat(const std::array<T,N> &a, const std::array<T,M> &b) {
+        std::array<T, N + M> result {};
+        for (size_t i = 0; i < N; ++i)
+            result[i] = a[i];
+        for (size_t i = 0; i < M; ++i)
+            result[N + i] = b[i];
+        return result;
+    }
+
+    static constexpr auto kAllWords = concat(InterpWords::kPointers, kOtherWords);
+
+    const Word* const* const kWords = kAllWords.data();
+
+    static constexpr auto kWordTableData = makeWordTable(kAllWords);
+
+    const WordTable kWordTable(kWordTableData);
+
+
+    // Superinstruction rules used by the compiler (see Compiler::fuseInstructions.)
+
+    const Fusion kFusions[] = {
+        {&_LITERAL, &PLUS,  &_LIT_PLUS},
+        {&_LITERAL, &MINUS, &_LIT_MINUS},
+        {&_LITERAL, &MULT,  &_LIT_MULT},
+        {&_LITERAL, &DIV,   &_LIT_DIV},
+        {&_LITERAL, &MOD,   &_LIT_MOD},
+        {&_LITERAL, &EQ,    &_LIT_EQ},
+        {&_LITERAL, &NE,    &_LIT_NE},
+        {&_LITERAL, &GT,    &_LIT_GT},
+        {&_LITERAL, &GE,    &_LIT_GE},
+        {&_LITERAL, &LT,    &_LIT_LT},
+        {&_LITERAL, &LE,    &_LIT_LE},
+
+        {&EQ,       &_ZBRANCH, &_EQ_ZBRANCH},
+        {&NE,       &_ZBRANCH, &_NE_ZBRANCH},
+        {&GT,       &_ZBRANCH, &_GT_ZBRANCH},
+        {&GE,       &_ZBRANCH, &_GE_ZBRANCH},
+        {&LT,       &_ZBRANCH, &_LT_ZBRANCH},
+        {&LE,       &_ZBRANCH, &_LE_ZBRANCH},
+        {&EQ_ZERO,  &_ZBRANCH, &_ZERO_EQ_ZBRANCH},
+        {&NE_ZERO,  &_ZBRANCH, &_ZERO_NE_ZBRANCH},
+        {&GT_ZERO,  &_ZBRANCH, &_ZERO_GT_ZBRANCH},
+        {&LT_ZERO,  &_ZBRANCH, &_ZERO_LT_ZBRANCH},
+        {nullptr, nullptr, nullptr}
+    };
+
+
+    // Numbers-only variants used by the compiler (see Compiler::specializeInstructions.)
+
+    const Specialization kNumericSpecializations[] = {
+        {&PLUS,        &_PLUS_NUM,       &_PLUS_INT,       &_PLUS_DBL},
+        {&MINUS,       &_MINUS_NUM,      &_MINUS_INT,      &_MINUS_DBL},
+        {&MULT,        &_MULT_NUM,       &_MULT_INT,       &_MULT_DBL},
+        {&DIV,         &_DIV_NUM,        &_DIV_INT,        &_DIV_DBL},
+        {&GT,          &_GT_NUM,         &_GT_INT,         &_GT_DBL},
+        {&GE,          &_GE_NUM,         &_GE_INT,         &_GE_DBL},
+        {&LT,          &_LT_NUM,         &_LT_INT,         &_LT_DBL},
+        {&LE,          &_LE_NUM,         &_LE_INT,         &_LE_DBL},
+        {&_LIT_PLUS,   &_LIT_PLUS_NUM,   &_LIT_PLUS_INT,   &_LIT_PLUS_DBL},
+        {&_LIT_MINUS,  &_LIT_MINUS_NUM,  &_LIT_MINUS_INT,  &_LIT_MINUS_DBL},
+        {&_LIT_MULT,   &_LIT_MULT_NUM,   &_LIT_MULT_INT,   &_LIT_MULT_DBL},
+        {&_LIT_DIV,    &_LIT_DIV_NUM,    &_LIT_DIV_INT,    &_LIT_DIV_DBL},
+        {&_LIT_GT,     &_LIT_GT_NUM,     &_LIT_GT_INT,     &_LIT_GT_DBL},
+        {&_LIT_GE,     &_LIT_GE_NUM,     &_LIT_GE_INT,     &_LIT_GE_DBL},
+        {&_LIT_LT,     &_LIT_LT_NUM,     &_LIT_LT_INT,     &_LIT_LT_DBL},
+        {&_LIT_LE,     &_LIT_LE_NUM,     &_LIT_LE_INT,     &_LIT_LE_DBL},
+        {&_GT_ZBRANCH, &_GT_ZBRANCH_NUM, &_GT_ZBRANCH_INT, &_GT_ZBRANCH_DBL},
+        {&_GE_ZBRANCH, &_GE_ZBRANCH_NUM, &_GE_ZBRANCH_INT, &_GE_ZBRANCH_DBL},
+        {&_LT_ZBRANCH, &_LT_ZBRANCH_NUM, &_LT_ZBRANCH_INT, &_LT_ZBRANCH_DBL},
+        {&_LE_ZBRANCH, &_LE_ZBRANCH_NUM, &_LE_ZBRANCH_INT, &_LE_ZBRANCH_DBL},
+        {nullptr, nullptr, nullptr, nullptr}
+    };
+
+
+    // Quickening words used by the compiler (see Compiler::quickeningEnabled.)
+
+    const Quickening kQuickenings[] = {
+        {&PLUS,     &_Q_PLUS,   &_PLUS_QNUM},
+        {&MINUS,    &_Q_MINUS,  &_MINUS_QNUM},
+        {&MULT,     &_Q_MULT,   &_MULT_QNUM},
+        {&DIV,      &_Q_DIV,    &_DIV_QNUM},
+        {&EQ,       &_Q_EQ,     &_EQ_QNUM},
+        {&NE,       &_Q_NE,     &_NE_QNUM},
+        {&GT,       &_Q_GT,     &_GT_QNUM},
+        {&GE,       &_Q_GE,     &_GE_QNUM},
+        {&LT,       &_Q_LT,     &_LT_QNUM},
+        {&LE,       &_Q_LE,     &_LE_QNUM},
+        {&LENGTH,   &_Q_LENGTH, &_LENGTH_QSTR},
+        {&LENGTH,   &_Q_LENGTH, &_LENGTH_QARR},
+        {nullptr, nullptr, nullptr}
     };
 
 }
@@ -18,14 +18,13 @@
 
 #pragma once
 #include "word.hh"
+#include "word_table.hh"
 
 
 namespace tails::core_words {
 
     /// All the words defined herein.
     extern const Word
-        _INTERP, _INTERP2, _INTERP3, _INTERP4,
-        _TAILINTERP, _TAILINTERP2, _TAILINTERP3, _TAILINTERP4,
         _RETURN, _LITERAL,
         NOP, _RECURSE,
         DROP, DUP, OVER, ROT, SWAP,
@@ -40,15 +39,208 @@ namespace tails::core_words {
     
     extern const Word NULL_, LENGTH, CALL, IFELSE;
 
-    /// Array of pointers to the above core words, ending in nullptr
-    extern const Word* const kWords[];
+    /// Rearranges the top stack items as described by its ShuffleParam. The compiler replaces
+    /// runs of stack-shuffling words like `SWAP ROT OVER` with one of these.
+    extern const Word _SHUFFLE;
 
-    /// Array of the `_INTERP` family of words.
-    /// First array index is whether to tail-call the last word;
-    /// Second index is the number of words that follow (0..kMaxInterp-1)
-    static constexpr size_t kMaxInterp = 4;
-    static constexpr const Word* kInterpWords[2][kMaxInterp] = {
-        {&_INTERP, &_INTERP2, &_INTERP3, &_INTERP4},
-        {&_TAILINTERP, &_TAILINTERP2, &_TAILINTERP3, &_TAILINTERP4}
+    /// Counted loops: `DO`, `LOOP` and `+LOOP` compile to the first three; `LEAVE` uses `_UNLOOP`.
+    extern const Word _DO, _LOOP, _PLUSLOOP, _UNLOOP, I, J;
+
+    // The runtime state below is global, not per-thread, so only one thread at a time may run
+    // words. (The same goes for compiling them, since the vocabularies are global too.)
+
+    /// The highest address the data stack may grow to. A non-tail-recursive call that might grow
+    /// the stack past this is run on a new stack segment instead. Whatever runs a word should set
+    /// this to the top of its stack, with a StackLimitScope; the default, nullptr, makes every
+    /// such call use a new segment.
+    extern Value* stackLimit;
+
+    /// Sets `stackLimit` while it's in scope, then restores the previous limit, so the limit never
+    /// outlives the stack it belongs to.
+    class StackLimitScope {
+    public:
+        explicit StackLimitScope(Value *limit)  :_saved(stackLimit) {stackLimit = limit;}
+        ~StackLimitScope()                      {stackLimit = _saved;}
+    private:
+        StackLimitScope(const StackLimitScope&) = delete;
+        Value* _saved;
+    };
+
+    /// The index and limit of an active `DO` loop. They're both integers if `DO`'s bounds were,
+    /// so `I` pushes integers and the index is incremented without any conversions; otherwise
+    /// they're both doubles. (An integer index that leaves the 48-bit range becomes a double.)
+    struct LoopFrame {
+        Value index, limit;
+
+        /// The frame for a loop from `start` up to `limit`.
+        static LoopFrame make(Value start, Value limit) {
+            if (start.isInt() && limit.isInt())
+                return {start, limit};
+            else
+                return {Value(start.asDouble()), Value(limit.asDouble())};
+        }
+
+        /// True if the loop has nothing to do, i.e. the index starts at the limit.
+        bool empty() const {
+            return index.isInt() ? index.asInt() == limit.asInt()
+                                 : index.asDouble() == limit.asDouble();
+        }
+
+        /// Adds 1 to the index; returns true if it's still below the limit.
+        bool next() {
+            if (index.isInt()) {
+                int64_t i = index.asInt() + 1;      // can't overflow, since index < limit
+                index = Value(i);
+                return i < limit.asInt();
+            } else {
+                double i = index.asDouble() + 1;
+                index = Value(i);
+                return i < limit.asDouble();
+            }
+        }
+
+        /// Adds `n` to the index; returns true if the loop continues, i.e. the index is below
+        /// the limit, or if `n` is negative, at or above it.
+        bool next(Value n) {
+            if (index.isInt() && n.isInt()) {
+                int64_t i = index.asInt() + n.asInt(), lim = limit.asInt();
+                index = Value(i);
+                return n.asInt() >= 0 ? i < lim : i >= lim;
+            } else {
+                double i = index.asDouble() + n.asDouble(), lim = limit.asDouble();
+                index = Value(i);
+                return n.asDouble() >= 0 ? i < lim : i >= lim;
+            }
+        }
+    };
+
+    /// The loop stack, which holds the active `DO` loops' frames. Points just past the innermost.
+    extern LoopFrame* loopStack;
+
+    /// The start and end of the loop stack's storage. `DO` calls `growLoopStack` when
+    /// `loopStack` reaches the end, which moves the frames to storage twice as large.
+    extern LoopFrame *loopStackBase, *loopStackEnd;
+    void growLoopStack();
+
+    /// Restores the loop stack's depth when it goes out of scope, so a word that throws from
+    /// inside a `DO` loop doesn't leave its frames behind. Whatever runs a word should use one.
+    class LoopStackMark {
+    public:
+        LoopStackMark()     :_depth(loopStack - loopStackBase) { }
+        ~LoopStackMark()    {loopStack = loopStackBase + _depth;}
+    private:
+        LoopStackMark(const LoopStackMark&) = delete;
+        ptrdiff_t _depth;
     };
+
+    /// Superinstructions: a literal followed by a binary operator.
+    extern const Word
+        _LIT_PLUS, _LIT_MINUS, _LIT_MULT, _LIT_DIV, _LIT_MOD,
+        _LIT_EQ, _LIT_NE, _LIT_GT, _LIT_GE, _LIT_LT, _LIT_LE;
+
+    /// Superinstructions: a comparison followed by `0BRANCH`.
+    extern const Word
+        _EQ_ZBRANCH, _NE_ZBRANCH, _GT_ZBRANCH, _GE_ZBRANCH, _LT_ZBRANCH, _LE_ZBRANCH,
+        _ZERO_EQ_ZBRANCH, _ZERO_NE_ZBRANCH, _ZERO_GT_ZBRANCH, _ZERO_LT_ZBRANCH;
+
+    /// Numbers-only variants of arithmetic and comparison words and superinstructions: for any
+    /// numbers, for integers only, and for doubles only.
+    extern const Word
+        _PLUS_NUM, _MINUS_NUM, _MULT_NUM, _DIV_NUM,
+        _GT_NUM, _GE_NUM, _LT_NUM, _LE_NUM,
+        _LIT_PLUS_NUM, _LIT_MINUS_NUM, _LIT_MULT_NUM, _LIT_DIV_NUM,
+        _LIT_GT_NUM, _LIT_GE_NUM, _LIT_LT_NUM, _LIT_LE_NUM,
+        _GT_ZBRANCH_NUM, _GE_ZBRANCH_NUM, _LT_ZBRANCH_NUM, _LE_ZBRANCH_NUM,
+        _PLUS_INT, _MINUS_INT, _MULT_INT, _DIV_INT,
+        _GT_INT, _GE_INT, _LT_INT, _LE_INT,
+        _LIT_PLUS_INT, _LIT_MINUS_INT, _LIT_MULT_INT, _LIT_DIV_INT,
+        _LIT_GT_INT, _LIT_GE_INT, _LIT_LT_INT, _LIT_LE_INT,
+        _GT_ZBRANCH_INT, _GE_ZBRANCH_INT, _LT_ZBRANCH_INT, _LE_ZBRANCH_INT,
+        _PLUS_DBL, _MINUS_DBL, _MULT_DBL, _DIV_DBL,
+        _GT_DBL, _GE_DBL, _LT_DBL, _LE_DBL,
+        _LIT_PLUS_DBL, _LIT_MINUS_DBL, _LIT_MULT_DBL, _LIT_DIV_DBL,
+        _LIT_GT_DBL, _LIT_GE_DBL, _LIT_LT_DBL, _LIT_LE_DBL,
+        _GT_ZBRANCH_DBL, _GE_ZBRANCH_DBL, _LT_ZBRANCH_DBL, _LE_ZBRANCH_DBL;
+
+    /// Quickening words (see Compiler::quickeningEnabled), and the specialized words they
+    /// rewrite themselves to.
+    extern const Word
+        _Q_PLUS, _Q_MINUS, _Q_MULT, _Q_DIV, _Q_EQ, _Q_NE, _Q_GT, _Q_GE, _Q_LT, _Q_LE, _Q_LENGTH,
+        _PLUS_QNUM, _MINUS_QNUM, _MULT_QNUM, _DIV_QNUM,
+        _EQ_QNUM, _NE_QNUM, _GT_QNUM, _GE_QNUM, _LT_QNUM, _LE_QNUM,
+        _LENGTH_QSTR, _LENGTH_QARR;
+
+#ifdef ENABLE_NATIVE_CODEGEN
+    /// Jumps to a word's native code (see native_code.hh.)
+    extern const Word _JIT;
+#endif
+
+    /// Runs a word's register code (see register_code.hh.)
+    extern const Word _REGS;
+
+    /// Array of pointers to the above core words, ending in nullptr. (Except `DEFINE`, which is
+    /// defined in compiler.cc, so its name isn't known when `kWordTable` is built.)
+    extern const Word* const* const kWords;
+
+    /// The words in `kWords`, as a perfect-hash table built at compile time.
+    extern const WordTable kWordTable;
+
+    /// A rule for fusing two consecutive instructions into a single "superinstruction".
+    /// At most one of `first` and `second` has a parameter; `fused` takes that same parameter.
+    struct Fusion {
+        const Word *first, *second, *fused;
+    };
+
+    /// Fusion rules applied by the compiler, ending with an entry whose `fused` is nullptr.
+    extern const Fusion kFusions[];
+
+    /// Superinstructions generated by the `profile_superinstructions` tool from a workload
+    /// (see generated_superinstructions.cc), and their fusion rules. Both lists are terminated
+    /// like `kWords` and `kFusions` respectively.
+    extern const Word* const kGeneratedWords[];
+    extern const Fusion kGeneratedFusions[];
+
+    /// A word that operates on any type, and its variants that only work on numbers. The compiler
+    /// substitutes one of those when the stack checker proves that all the operands are numbers
+    /// (including the literal parameter, if any): `integer` if they're all integers, `floating`
+    /// if they're all doubles, else `numeric`.
+    struct Specialization {
+        const Word *generic, *numeric, *integer, *floating;
+
+        /// True if `word` is one of the numbers-only variants.
+        bool isVariant(const Word *word) const {
+            return word == numeric || word == integer || word == floating;
+        }
+    };
+
+    /// Numbers-only specializations, ending with an entry whose `numeric` is nullptr.
+    extern const Specialization kNumericSpecializations[];
+
+    /// A generic word, the "quickening" variant the compiler emits in its place, and one of the
+    /// specialized words that variant may rewrite itself to at runtime. If a specialized word's
+    /// type check fails, it rewrites itself to the generic word.
+    struct Quickening {
+        const Word *generic, *quickening, *quickened;
+    };
+
+    /// Quickening rules, ending with an entry whose `generic` is nullptr.
+    extern const Quickening kQuickenings[];
+
+    /// Running totals of quickening activity.
+    struct QuickeningStats {
+        uint64_t quickened = 0;     ///< Times a quickening word rewrote itself to a specialized one
+        uint64_t hits = 0;          ///< Times a specialized word's type check passed
+        uint64_t misses = 0;        ///< Times it failed, so the word reverted to the generic one
+    };
+
+    extern QuickeningStats quickeningStats;
+
+    /// The `_INTERP` family of words, generated from a template in core_words.cc.
+    /// First array index is whether to tail-call the last word;
+    /// Second index is the number of words that follow, minus one (0..kMaxInterp-1).
+    static constexpr size_t kMaxInterp = 16;
+    extern const Word (&kInterpWords)[2][kMaxInterp];
+
+    /// The basic members of the `_INTERP` family, which call a single word.
+    extern const Word &_INTERP, &_TAILINTERP;
 }
@@ -0,0 +1,102 @@
+//
+// generated_superinstructions.cc
+//
+// GENERATED by profile_superinstructions from the workload: workloads/sample.tails
+// Don't edit; run gen_superinstructions.sh to regenerate it.
+//
+
+#include "core_words.hh"
+#include "stack_effect.hh"
+#include <utility>
+
+
+namespace tails::core_words {
+
+    static constexpr TypeSet Any = TypeSet::anyType();
+
+
+    // + SWAP  (executed 129999 times)
+    NATIVE_WORD(_PLUS_SWAP, "_+_SWAP", StackEffect({Any, Any, Any}, {Any, Any}).withMax(0), Word::Magic) {
+        { Value a = sp[-1], b = TOS; POP(); TOS = Value(a + b); }
+        std::swap(TOS, sp[-1]);
+        NEXT();
+    }
+
+    // ROT +  (executed 129999 times)
+    NATIVE_WORD(_ROT_PLUS, "_ROT_+", StackEffect({Any, Any, Any}, {Any, Any}).withMax(0), Word::Magic) {
+        { auto sp2 = sp[-2]; sp[-2] = sp[-1]; sp[-1] = TOS; TOS = sp2; }
+        { Value a = sp[-1], b = TOS; POP(); TOS = Value(a + b); }
+        NEXT();
+    }
+
+    // DUP ROT  (executed 99999 times)
+    NATIVE_WORD(_DUP_ROT, "_DUP_ROT", StackEffect({Any, Any}, {Any, Any, Any}).withMax(1), Word::Magic) {
+        PUSH(TOS);
+        { auto sp2 = sp[-2]; sp[-2] = sp[-1]; sp[-1] = TOS; TOS = sp2; }
+        NEXT();
+    }
+
+    // SWAP LIT  (executed 174999 times)
+    NATIVE_WORD(_SWAP_LIT, "_SWAP_LIT", StackEffect({Any, Any}, {Any, Any, Any}).withMax(1), Word::MagicValParam) {
+        std::swap(TOS, sp[-1]);
+        PUSH((pc++)->literal);
+        NEXT();
+    }
+
+    // DUP LIT  (executed 130000 times)
+    NATIVE_WORD(_DUP_LIT, "_DUP_LIT", StackEffect({Any}, {Any, Any, Any}).withMax(2), Word::MagicValParam) {
+        PUSH(TOS);
+        PUSH((pc++)->literal);
+        NEXT();
+    }
+
+    // + SWAP LIT  (executed 129999 times)
+    NATIVE_WORD(_PLUS_SWAP_LIT, "_+_SWAP_LIT", StackEffect({Any, Any, Any}, {Any, Any, Any}).withMax(0), Word::MagicValParam) {
+        { Value a = sp[-1], b = TOS; POP(); TOS = Value(a + b); }
+        std::swap(TOS, sp[-1]);
+        PUSH((pc++)->literal);
+        NEXT();
+    }
+
+    // ROT + SWAP  (executed 129999 times)
+    NATIVE_WORD(_ROT_PLUS_SWAP, "_ROT_+_SWAP", StackEffect({Any, Any, Any}, {Any, Any}).withMax(0), Word::Magic) {
+        { auto sp2 = sp[-2]; sp[-2] = sp[-1]; sp[-1] = TOS; TOS = sp2; }
+        { Value a = sp[-1], b = TOS; POP(); TOS = Value(a + b); }
+        std::swap(TOS, sp[-1]);
+        NEXT();
+    }
+
+    // DUP ROT +  (executed 99999 times)
+    NATIVE_WORD(_DUP_ROT_PLUS, "_DUP_ROT_+", StackEffect({Any, Any}, {Any, Any}).withMax(1), Word::Magic) {
+        PUSH(TOS);
+        { auto sp2 = sp[-2]; sp[-2] = sp[-1]; sp[-1] = TOS; TOS = sp2; }
+        { Value a = sp[-1], b = TOS; POP(); TOS = Value(a + b); }
+        NEXT();
+    }
+
+
+    const Word* const kGeneratedWords[] = {
+        &_PLUS_SWAP,
+        &_ROT_PLUS,
+        &_DUP_ROT,
+        &_SWAP_LIT,
+        &_DUP_LIT,
+        &_PLUS_SWAP_LIT,
+        &_ROT_PLUS_SWAP,
+        &_DUP_ROT_PLUS,
+        nullptr
+    };
+
+    const Fusion kGeneratedFusions[] = {
+        {&PLUS, &SWAP, &_PLUS_SWAP},
+        {&ROT, &PLUS, &_ROT_PLUS},
+        {&DUP, &ROT, &_DUP_ROT},
+        {&SWAP, &_LITERAL, &_SWAP_LIT},
+        {&DUP, &_LITERAL, &_DUP_LIT},
+        {&_PLUS_SWAP, &_LITERAL, &_PLUS_SWAP_LIT},
+        {&_ROT_PLUS, &SWAP, &_ROT_PLUS_SWAP},
+        {&_DUP_ROT, &PLUS, &_DUP_ROT_PLUS},
+        {nullptr, nullptr, nullptr}
+    };
+
+}
@@ -22,6 +22,7 @@
 
 
 namespace tails {
+    class RegisterCode;
     union Instruction;
 
 
@@ -38,14 +39,73 @@ namespace tails {
     #endif
 
 
-    /// A native word is a C++ function with this signature.
-    /// Interpreted words consist of an array of (mostly) Op pointers,
-    /// but some native ops are followed by a parameter read by the function.
-    /// @param sp  Stack pointer. Top is sp[0], below is sp[-1], sp[-2] ...
-    /// @param pc  Program counter. Points to the _next_ op to run.
-    /// @return    The updated stack pointer. (But almost all ops tail-call via `NEXT()`
-    ///            instead of explicitly returning a value.)
-    using Op = Value* (*)(Value *sp, const Instruction *pc);
+    // If ENABLE_TOS_REGISTER is defined, the top item of the stack is cached in a register: it's
+    // passed to every op as a third parameter `tos`, and returned alongside the stack pointer.
+    // `sp` still points to the top item's slot, but that slot's contents in memory are stale.
+    // Native words must use the macros below (TOS, PUSH, POP, ...) so they work either way.
+    //#define ENABLE_TOS_REGISTER
+
+
+    // If ENABLE_NATIVE_CODEGEN is defined, interpreted words are translated to x86-64 machine code
+    // when possible (see native_code.hh.) It's only supported with the default calling convention,
+    // and not when tracing.
+    #if defined(__x86_64__) && (defined(__APPLE__) || defined(__linux__)) \
+            && !defined(ENABLE_TOS_REGISTER) && !defined(ENABLE_TRACING)
+    #   define ENABLE_NATIVE_CODEGEN
+    #endif
+
+
+    #ifdef ENABLE_TOS_REGISTER
+        /// What an Op returns when ENABLE_TOS_REGISTER is on: the stack pointer and the top item.
+        /// (This fits in two registers on x86-64 and ARM64.)
+        struct OpResult {
+            Value* sp;
+            Value  tos;
+        };
+
+        /// A native word is a C++ function with this signature.
+        /// Interpreted words consist of an array of (mostly) Op pointers,
+        /// but some native ops are followed by a parameter read by the function.
+        /// @param sp  Stack pointer. Top is sp[0] (but see `tos`), below is sp[-1], sp[-2] ...
+        /// @param pc  Program counter. Points to the _next_ op to run.
+        /// @param tos The top of the stack; the memory at sp[0] is not up to date.
+        /// @return    The updated stack pointer and top of stack. (But almost all ops tail-call
+        ///            via `NEXT()` instead of explicitly returning a value.)
+        using Op = OpResult (*)(Value *sp, const Instruction *pc, Value tos);
+    #else
+        /// A native word is a C++ function with this signature.
+        /// Interpreted words consist of an array of (mostly) Op pointers,
+        /// but some native ops are followed by a parameter read by the function.
+        /// @param sp  Stack pointer. Top is sp[0], below is sp[-1], sp[-2] ...
+        /// @param pc  Program counter. Points to the _next_ op to run.
+        /// @return    The updated stack pointer. (But almost all ops tail-call via `NEXT()`
+        ///            instead of explicitly returning a value.)
+        using Op = Value* (*)(Value *sp, const Instruction *pc);
+    #endif
+
+
+    /// The parameter of `_RECURSE`: where the word starts, and what it needs from the stack.
+    struct RecurseParam {
+        int32_t  offset;            // PC offset to the start of the word, as with BRANCH
+        uint16_t max;               // The word's max stack growth, not counting recursive calls
+        uint8_t  inputs, outputs;   // The word's number of inputs and outputs
+    };
+
+
+    /// The parameter of `_SHUFFLE`: pops the top `inputs` stack items and pushes `outputs` items,
+    /// each a copy of one of the inputs. Inputs and outputs are numbered from the top (0) down.
+    struct ShuffleParam {
+        static constexpr int kMaxItems = 8;
+
+        uint8_t  inputs, outputs;   // Number of items popped and pushed, at most kMaxItems each
+        uint32_t sources;           // 4 bits per output: the number of the input it copies
+
+        constexpr int source(int output) const  {return (sources >> (4 * output)) & 0xF;}
+
+        constexpr void setSource(int output, int input) {
+            sources = (sources & ~(0xFu << (4 * output))) | (uint32_t(input) << (4 * output));
+        }
+    };
 
 
     /// A Forth instruction. Interpreted code is a sequence of these.
@@ -54,14 +114,25 @@ namespace tails {
         const Instruction* word;    // Interpreted word to call; parameter to INTERP
         intptr_t           offset;  // PC offset; parameter to BRANCH and ZBRANCH
         Value              literal; // Value to push on stack; parameter to LITERAL
+        RecurseParam       recurse; // Parameter to RECURSE
+        ShuffleParam       shuffle; // Parameter to _SHUFFLE
+        const RegisterCode* registers; // Parameter to _REGS
 
         constexpr Instruction(Op o)                 :native(o) { }
         constexpr Instruction(const Instruction *w) :word(w) { }
         constexpr Instruction(Value v)              :literal(v) { }
+        constexpr Instruction(RecurseParam r)       :recurse(r) { }
+        constexpr Instruction(ShuffleParam s)       :shuffle(s) { }
         explicit constexpr Instruction(intptr_t o)  :offset(o) { }
 
         static constexpr Instruction withOffset(intptr_t o) {return Instruction(o);}
 
+        static Instruction withRegisters(const RegisterCode *r) {
+            Instruction instr;
+            instr.registers = r;
+            return instr;
+        }
+
     private:
         friend class Word;
         friend class WordRef;
@@ -72,14 +143,103 @@ namespace tails {
     inline bool operator!= (const Instruction &a, const Instruction &b) {return !(a == b);}
 
 
+    /// Overwrites the op of the instruction at `pc`, which must be in a CompiledWord's code.
+    /// Only for quickening, which replaces an op with an equivalent one; see CompiledWord.
+    static inline void rewriteOp(const Instruction *pc, Op op) {
+        const_cast<Instruction*>(pc)->native = op;
+    }
+
+
+#ifdef ENABLE_TOS_REGISTER
+
+    // When tracing, the top of stack is written back to memory so TRACE can see the whole stack.
+    #ifdef ENABLE_TRACING
+    #   define SYNC_TOS(SP, TOS)  (*(SP) = (TOS))
+    #else
+    #   define SYNC_TOS(SP, TOS)  (void)0
+    #endif
+
+    // The standard Forth NEXT routine, found at the end of every native op,
+    // that jumps to the next op.
+    // It uses tail-recursion, so (in an optimized build) it _literally does jump_,
+    // without growing the call stack.
+    #define NEXT()    SYNC_TOS(sp, tos); TRACE(sp, pc); MUSTTAIL return pc->native(sp, pc + 1, tos)
+
+    // Returns from the current word; the body of `_RETURN`.
+    #define EXIT()    return {sp, tos}
+
+    // The top of the stack, as an lvalue.
+    // Note: Don't pass its address to a non-inline function, for example by calling a Value method
+    // on it; GCC won't tail-call `NEXT` from a function whose parameter's address escapes.
+    // Copy it into a local variable inside a block instead.
+    #define TOS       tos
+
+    // Pushes a Value on the stack.
+    #define PUSH(V)   do {Value v_ = (V); *sp++ = tos; tos = v_;} while (0)
+
+    // Pops N items off the stack.
+    #define POPN(N)   do {sp -= (N); tos = *sp;} while (0)
+
+    // Calls the interpreted word starting at instruction W, updating the stack.
+    #define CALL_WORD(W)  do {OpResult r_ = call(sp, (W), tos); sp = r_.sp; tos = r_.tos;} while (0)
+
+    // Jumps to the interpreted word starting at instruction W, as a tail call.
+    #define TAIL_CALL_WORD(W)  MUSTTAIL return call(sp, (W), tos)
+
+
+    /// Calls an interpreted word pointed to by `start`, from a native op.
+    /// @param sp    Stack pointer
+    /// @param start The first instruction of the word to run
+    /// @param tos   The top of the stack
+    /// @return      The stack pointer and top of stack on completion.
+    ALWAYS_INLINE
+    static inline OpResult call(Value *sp, const Instruction *start, Value tos) {
+        SYNC_TOS(sp, tos);
+        TRACE(sp, start);
+        return start->native(sp, start + 1, tos);
+    }
+
+
+    /// Calls an interpreted word pointed to by `start`. Used by `run`.
+    /// The top of the stack is read from and written back to `*sp`, so the slot below the bottom
+    /// of the stack must be valid memory, even if the stack is empty.
+    /// @param sp    Stack pointer
+    /// @param start The first instruction of the word to run
+    /// @return      The stack pointer on completion.
+    static inline Value* call(Value *sp, const Instruction *start) {
+        OpResult result = call(sp, start, *sp);
+        *result.sp = result.tos;
+        return result.sp;
+    }
+
+#else
+
     // The standard Forth NEXT routine, found at the end of every native op,
     // that jumps to the next op.
     // It uses tail-recursion, so (in an optimized build) it _literally does jump_,
     // without growing the call stack.
     #define NEXT()    TRACE(sp, pc); MUSTTAIL return pc->native(sp, pc + 1)
 
+    // Returns from the current word; the body of `_RETURN`.
+    #define EXIT()    return sp
+
+    // The top of the stack, as an lvalue.
+    #define TOS       sp[0]
 
-    /// Calls an interpreted word pointed to by `fn`. Used by `INTERP` and `run`.
+    // Pushes a Value on the stack.
+    #define PUSH(V)   do {Value v_ = (V); *++sp = v_;} while (0)
+
+    // Pops N items off the stack.
+    #define POPN(N)   (sp -= (N))
+
+    // Calls the interpreted word starting at instruction W, updating the stack.
+    #define CALL_WORD(W)  (sp = call(sp, (W)))
+
+    // Jumps to the interpreted word starting at instruction W, as a tail call.
+    #define TAIL_CALL_WORD(W)  MUSTTAIL return call(sp, (W))
+
+
+    /// Calls an interpreted word pointed to by `start`. Used by `INTERP` and `run`.
     /// @param sp    Stack pointer
     /// @param start The first instruction of the word to run
     /// @return      The stack pointer on completion.
@@ -89,4 +249,9 @@ namespace tails {
         return start->native(sp, start + 1);
     }
 
+#endif
+
+    // Pops the top item off the stack.
+    #define POP()     POPN(1)
+
 }
@@ -57,6 +57,9 @@
 #   if __has_attribute(noinline)
 #       define NOINLINE [[gnu::noinline]]
 #   endif
+#   if __has_attribute(cold)
+#       define COLD [[gnu::cold]]
+#   endif
 #endif
 #ifndef MUSTTAIL
 #   define MUSTTAIL
@@ -67,6 +70,9 @@
 #ifndef NOINLINE
 #   define NOINLINE
 #endif
+#ifndef COLD
+#   define COLD
+#endif
 
 
 // `_pure` functions are _read-only_. They cannot write to memory (in a way that's detectable),
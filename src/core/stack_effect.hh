@@ -30,6 +30,9 @@ namespace tails {
 
     /// A set of Value types. Describes one item, an input or output, in a word's stack effect.
     /// If it's a StackEffect output, it can optionally declare that it matches the type of an input.
+    ///
+    /// Numbers are tracked as two kinds, integers and floating-point, so the stack checker can
+    /// tell them apart; but a `Value::ANumber` is either kind.
     class TypeSet {
     public:
         constexpr TypeSet() { }
@@ -43,32 +46,54 @@ namespace tails {
 
         constexpr static TypeSet anyType() {return TypeSet(kTypeFlags);}
         constexpr static TypeSet noType()  {return TypeSet();}
+        /// Numbers that are known to be integers.
+        constexpr static TypeSet integer() {return TypeSet(kIntFlag);}
+        /// Numbers that are known to be floating-point.
+        constexpr static TypeSet floating() {return TypeSet(kFloatFlag);}
+
+        /// The type of a specific Value; an integer's is \ref integer, a double's \ref floating.
+        static TypeSet of(Value v) {
+            if (v.isInt())
+                return integer();
+            else if (v.isDouble())
+                return floating();
+            else
+                return TypeSet(v.type());
+        }
 
         constexpr bool exists() const                       {return _flags != 0;}
         constexpr bool canBeAnyType() const                 {return typeFlags() == kTypeFlags;}
-        constexpr bool canBeType(Value::Type type) const    {return (_flags & (1 << int(type))) != 0;}
+        constexpr bool canBeType(Value::Type type) const    {return (_flags & flagsFor(type)) != 0;}
+        constexpr bool isInteger() const                    {return typeFlags() == kIntFlag;}
+        constexpr bool isFloating() const                   {return typeFlags() == kFloatFlag;}
 
         std::optional<Value::Type> firstType() const {
             for (int i = 0; i < kNumTypes; ++i)
-                if (_flags & (1<<i))
+                if (canBeType(Value::Type(i)))
                     return Value::Type(i);
             return std::nullopt;
         }
 
-        constexpr void addType(Value::Type type)            {_flags |= (1 << int(type));}
+        constexpr void addType(Value::Type type)            {_flags |= flagsFor(type);}
         constexpr void addAllTypes()                        {_flags = kTypeFlags;}
 
-        constexpr bool isInputMatch() const                 {return (_flags & 0xE0) != 0;}
-        constexpr int inputMatch() const                    {return (_flags >> kNumTypes) - 1;}
+        /// The types the result of arithmetic on me can have: an integer result can overflow
+        /// into a floating-point number.
+        constexpr TypeSet promoted() const {
+            return (_flags & kIntFlag) ? TypeSet(_flags | flagsFor(Value::ANumber)) : *this;
+        }
+
+        constexpr bool isInputMatch() const                 {return (_flags >> kNumKinds) != 0;}
+        constexpr int inputMatch() const                    {return (_flags >> kNumKinds) - 1;}
 
         constexpr void setInputMatch(TypeSet inputEntry, unsigned inputNo) {
             assert(inputNo <= 6);
-            _flags = ((inputNo+1) << kNumTypes) | (inputEntry._flags & kTypeFlags);
+            _flags = ((inputNo+1) << kNumKinds) | (inputEntry._flags & kTypeFlags);
         }
 
         constexpr TypeSet operator/ (unsigned inputNo) const {
             assert(inputNo <= 6);
-            return TypeSet(typeFlags() | ((inputNo+1) << kNumTypes));
+            return TypeSet(typeFlags() | ((inputNo+1) << kNumKinds));
         }
 
         /// I am "greater than" another entry if I support types it doesn't.
@@ -92,16 +117,25 @@ namespace tails {
         constexpr TypeSet operator& (const TypeSet &other) const {return _flags & other._flags;}
         constexpr TypeSet operator- (const TypeSet &other) const {return _flags & ~other._flags;}
 
-        constexpr uint8_t typeFlags() const                      {return _flags & kTypeFlags;}
-        constexpr uint8_t flags() const                          {return _flags;} // tests only
+        constexpr uint16_t typeFlags() const                     {return _flags & kTypeFlags;}
+        constexpr uint16_t flags() const                         {return _flags;} // tests only
 
     private:
-        constexpr TypeSet(int flags) :_flags(uint8_t(flags)) { }
+        constexpr TypeSet(int flags) :_flags(uint16_t(flags)) { }
 
+        // There's a flag bit for each Value::Type, where `ANumber` means a floating-point number,
+        // then one for an integer, then 3 bits of input match.
         static constexpr int kNumTypes = 5;
-        static constexpr uint8_t kTypeFlags = (1 << kNumTypes) - 1;
+        static constexpr int kNumKinds = kNumTypes + 1;
+        static constexpr uint16_t kIntFlag = 1 << kNumTypes;
+        static constexpr uint16_t kFloatFlag = 1 << int(Value::ANumber);
+        static constexpr uint16_t kTypeFlags = (1 << kNumKinds) - 1;
 
-        uint8_t _flags = 0;
+        static constexpr uint16_t flagsFor(Value::Type type) {
+            return (1 << int(type)) | (type == Value::ANumber ? kIntFlag : 0);
+        }
+
+        uint16_t _flags = 0;
     };
 
 
@@ -188,8 +222,19 @@ namespace tails {
             return result;
         }
 
+        /// Returns a copy with the smallest max stack depth possible, i.e. the `net()` or 0.
+        constexpr StackEffect withMinimalMax() const {
+            auto result = *this;
+            result._max = 0;
+            result.setMax();
+            return result;
+        }
+
         static constexpr uint16_t kUnknownMax = UINT16_MAX;
 
+        /// The most inputs plus outputs a StackEffect can have.
+        static constexpr size_t kMaxEntries = 8;
+
         /// Returns a copy with the max stack depth set to "unknown".
         constexpr StackEffect withUnknownMax()      {return withMax(kUnknownMax);}
 
@@ -267,7 +312,6 @@ namespace tails {
             _max = uint16_t(std::min(m, int(kUnknownMax)));
         }
 
-        static constexpr size_t kMaxEntries = 8;
         using Entries = std::array<TypeSet, kMaxEntries>;
 
         Entries  _entries;              // Inputs (bottom to top), then outputs (same)
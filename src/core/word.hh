@@ -37,6 +37,7 @@ namespace tails {
             Magic       = 0x10, ///< Low-level, not allowed in parsed code (0BRANCH, INTERP, etc.)
             Inline      = 0x20, ///< Should be inlined at call site
             Recursive   = 0x40, ///< Calls itself recursively
+            Pure        = 0x80, ///< No side effects; outputs depend only on inputs (constant-foldable)
 
             MagicIntParam  = Magic | HasIntParam,
             MagicValParam  = Magic | HasValParam,
@@ -55,13 +56,15 @@ namespace tails {
         ,_nParams(std::max(nParams, uint8_t((flags & (HasIntParam|HasValParam|HasWordParam)) != 0)))
         { }
 
+        template <size_t N>
         constexpr Word(const char *name,
                        StackEffect effect,
-                       const Instruction words[])
+                       const Instruction (&words)[N])
         :_instr(words)
         ,_name(name)
         ,_effect(effect)
         ,_flags(NoFlags)
+        ,_instrCount(N)
         { }
 
         constexpr const char* name() const              {return _name;}
@@ -71,6 +74,10 @@ namespace tails {
         constexpr bool hasFlag(Flags f) const           {return (_flags & f) != 0;}
         constexpr bool isNative() const                 {return hasFlag(Native);}
         constexpr uint8_t parameters() const            {return _nParams;}
+
+        /// The length of an interpreted word's code, including parameters. (A `_RETURN` ends
+        /// the code, but it may appear earlier too, so use this to find the end.)
+        constexpr uint32_t instructionCount() const     {return _instrCount;}
         constexpr bool hasIntParams() const             {return hasFlag(HasIntParam);}
         constexpr bool hasValParams() const             {return hasFlag(HasValParam);}
         constexpr bool hasWordParams() const            {return hasFlag(HasWordParam);}
@@ -86,6 +93,7 @@ namespace tails {
         StackEffect _effect;
         Flags       _flags; // Flags (see above)
         uint8_t     _nParams = 0;
+        uint32_t    _instrCount = 0; // Length of an interpreted word's code
     };
 
 
@@ -95,17 +103,36 @@ namespace tails {
                                         {return !(a == b);}
 
 
+    // Declares a function FN with the signature of an \ref Op; useful for defining native words
+    // that NATIVE_WORD can't, such as templates.
+#ifdef ENABLE_TOS_REGISTER
+    #define NATIVE_OP_SIGNATURE(FN)   OpResult FN(Value *sp, const Instruction *pc, Value tos)
+#else
+    #define NATIVE_OP_SIGNATURE(FN)   Value* FN(Value *sp, const Instruction *pc)
+#endif
+
+
     // Shortcut for defining a native word (see examples in core_words.cc.)
     // It should be followed by the C++ function body in curly braces.
     // The body can use parameters `sp` and `pc`, and should end by calling `NEXT()`.
+    // It should access the top of the stack as `TOS`, and push/pop with `PUSH()`/`POP()`, since
+    // with ENABLE_TOS_REGISTER the top item lives in a parameter instead of at `sp[0]`.
     // @param NAME  The C++ name of the Word object to define.
     // @param FORTHNAME  The word's Forth name (a string literal.)
     // @param EFFECT  The \ref StackEffect. Must be accurate!
     // Flags and parameter count may optionally follow, as per the Word constructor.
+#ifdef ENABLE_TOS_REGISTER
+    // (Not `extern "C"`, because C functions can't return the C++ type OpResult.)
     #define NATIVE_WORD(NAME, FORTHNAME, EFFECT, ...) \
-        extern "C" Value* f_##NAME(Value *sp, const Instruction *pc); \
+        NATIVE_OP_SIGNATURE(f_##NAME); \
         constexpr Word NAME(FORTHNAME, f_##NAME, EFFECT, ## __VA_ARGS__); \
-        Value* f_##NAME(Value *sp, const Instruction *pc)
+        NATIVE_OP_SIGNATURE(f_##NAME)
+#else
+    #define NATIVE_WORD(NAME, FORTHNAME, EFFECT, ...) \
+        extern "C" NATIVE_OP_SIGNATURE(f_##NAME); \
+        constexpr Word NAME(FORTHNAME, f_##NAME, EFFECT, ## __VA_ARGS__); \
+        NATIVE_OP_SIGNATURE(f_##NAME)
+#endif
 
 
     // Shortcut for defining a native word implementing a binary operator like `+` or `==`.
@@ -113,9 +140,201 @@ namespace tails {
     // @param FORTHNAME  The word's Forth name (a string literal.)
     // @param INFIXOP  The raw C++ infix operator to implement, e.g. `+` or `==`.
     #define BINARY_OP_WORD(NAME, FORTHNAME, EFFECT, INFIXOP) \
+        NATIVE_WORD(NAME, FORTHNAME, EFFECT, Word::Pure) { \
+            { Value a = sp[-1], b = TOS; POP(); TOS = Value(a INFIXOP b); }\
+            NEXT(); \
+        }
+
+
+    // Shortcut for defining a "superinstruction" that fuses a `_LITERAL` with a following binary
+    // operator. The literal is stored as the word's parameter and used as the right-hand operand.
+    // @param NAME  The C++ name of the Word object to define.
+    // @param FORTHNAME  The word's Forth name (a string literal.)
+    // @param INFIXOP  The raw C++ infix operator to implement, e.g. `+` or `==`.
+    #define LITERAL_OP_WORD(NAME, FORTHNAME, EFFECT, INFIXOP) \
+        NATIVE_WORD(NAME, FORTHNAME, EFFECT, Word::MagicValParam) { \
+            { Value lhs = TOS; TOS = Value(lhs INFIXOP (pc++)->literal); }\
+            NEXT(); \
+        }
+
+
+    // Shortcut for defining a "superinstruction" that fuses a binary comparison with a following
+    // `0BRANCH`. It pops both operands and branches if the comparison is false, without ever
+    // pushing the boolean result.
+    // @param NAME  The C++ name of the Word object to define.
+    // @param FORTHNAME  The word's Forth name (a string literal.)
+    // @param INFIXOP  The raw C++ infix comparison operator, e.g. `==` or `<`.
+    #define COMPARE_BRANCH_WORD(NAME, FORTHNAME, INFIXOP) \
+        NATIVE_WORD(NAME, FORTHNAME, StackEffect({Any, Any}, {}), Word::MagicIntParam) { \
+            bool cond; \
+            { Value a = sp[-1], b = TOS; cond = (a INFIXOP b); } \
+            POPN(2); \
+            if (!cond) \
+                pc += pc->offset; \
+            ++pc; \
+            NEXT(); \
+        }
+
+
+    // Like COMPARE_BRANCH_WORD, but compares the top of stack with zero, e.g. `0= 0BRANCH`.
+    #define ZERO_COMPARE_BRANCH_WORD(NAME, FORTHNAME, INFIXOP) \
+        NATIVE_WORD(NAME, FORTHNAME, StackEffect({Any}, {}), Word::MagicIntParam) { \
+            bool cond; \
+            { Value a = TOS; cond = (a INFIXOP Value(0)); } \
+            POP(); \
+            if (!cond) \
+                pc += pc->offset; \
+            ++pc; \
+            NEXT(); \
+        }
+
+
+    /// What the stack checker has proven about the operands of a numbers-only word: that
+    /// they're numbers, or more specifically that they're all integers or all doubles.
+    enum class NumberKind { Any, Int, Double };
+
+    // True if numbers `a` and `b` of kind `K` are both integers; only tests them if `K` is `Any`.
+    template <NumberKind K>
+    ALWAYS_INLINE static inline bool numbersAreInts(Value a, Value b) {
+        if constexpr (K == NumberKind::Any) return a.isInt() && b.isInt();
+        else                                return K == NumberKind::Int;
+    }
+
+    // A number's value as a `double`, skipping the type test if its kind `K` is known.
+    template <NumberKind K>
+    ALWAYS_INLINE static inline double numberAsDouble(Value v) {
+        if constexpr (K == NumberKind::Int)         return double(v.uncheckedInt());
+        else if constexpr (K == NumberKind::Double) return v.uncheckedDouble();
+        else                                        return v.asDouble();
+    }
+
+    // Arithmetic on Values `A` and `B` that are known to be numbers of kind `K`; `INFIXOP` is
+    // `+`, `-`, `*` or `/`. It's all done inline, without calling Value's operators, and only
+    // tests the operands' types if `K` is `Any`. Integers stay exact: the sum or difference of
+    // two 48-bit integers can't overflow an `int64_t` (and Value's constructor turns a result
+    // beyond 48 bits into a double), and a product is checked for overflow. Anything else,
+    // including division, is done on doubles.
+    #define NUMERIC_ARITH(A, INFIXOP, B, K)    numericArith<#INFIXOP[0], NumberKind::K>(A, B)
+
+    template <char OP, NumberKind K>
+    ALWAYS_INLINE static inline Value numericArith(Value a, Value b) {
+        if (numbersAreInts<K>(a, b)) {
+            int64_t x = a.uncheckedInt(), y = b.uncheckedInt();
+            if constexpr (OP == '+')
+                return Value(x + y);
+            else if constexpr (OP == '-')
+                return Value(x - y);
+            else if constexpr (OP == '*') {
+                if (int64_t product; !__builtin_mul_overflow(x, y, &product))
+                    return Value(product);
+            }
+        }
+        double x = numberAsDouble<K>(a), y = numberAsDouble<K>(b);
+        if constexpr (OP == '+')        return Value(x + y);
+        else if constexpr (OP == '-')   return Value(x - y);
+        else if constexpr (OP == '*')   return Value(x * y);
+        else                            return Value(x / y);
+    }
+
+    // Compares Values `A` and `B` that are known to be numbers of kind `K`. Two integers are
+    // compared as such; otherwise as doubles, since any number converts exactly to a double.
+    #define NUMERIC_COMPARE(A, INFIXOP, B, K) \
+        (numbersAreInts<NumberKind::K>(A, B) ? ((A).uncheckedInt() INFIXOP (B).uncheckedInt()) \
+            : (numberAsDouble<NumberKind::K>(A) INFIXOP numberAsDouble<NumberKind::K>(B)))
+
+    // True if Values `A` and `B` are both doubles or both integers.
+    #define SAME_NUMBER_KIND(A, B) \
+        (((A).isDouble() && (B).isDouble()) || ((A).isInt() && (B).isInt()))
+
+
+    // Shortcuts for defining numbers-only variants of BINARY_OP_WORD, LITERAL_OP_WORD and
+    // COMPARE_BRANCH_WORD. The compiler substitutes these when the stack checker proves that the
+    // operands are numbers, so they skip Value's type tests and operate directly on integers or
+    // doubles. (Only for operators whose Value semantics on numbers match the C++ operator.)
+    // `KIND` is a NumberKind: each word has an `Any` variant, for numbers of unknown kinds, and
+    // `Int` and `Double` variants that don't test the kinds at all.
+    // NUMERIC_OP_WORD and NUMERIC_LITERAL_OP_WORD are for arithmetic, via NUMERIC_ARITH;
+    // comparisons use NUMERIC_REL_WORD and NUMERIC_LITERAL_REL_WORD, via NUMERIC_COMPARE.
+    #define NUMERIC_OP_WORD(NAME, FORTHNAME, EFFECT, INFIXOP, KIND) \
+        NATIVE_WORD(NAME, FORTHNAME, EFFECT) { \
+            { Value a = sp[-1], b = TOS; POP(); TOS = NUMERIC_ARITH(a, INFIXOP, b, KIND); }\
+            NEXT(); \
+        }
+
+    #define NUMERIC_LITERAL_OP_WORD(NAME, FORTHNAME, EFFECT, INFIXOP, KIND) \
+        NATIVE_WORD(NAME, FORTHNAME, EFFECT, Word::MagicValParam) { \
+            { \
+                Value lhs = TOS, rhs = (pc++)->literal; \
+                TOS = NUMERIC_ARITH(lhs, INFIXOP, rhs, KIND); \
+            } \
+            NEXT(); \
+        }
+
+    #define NUMERIC_REL_WORD(NAME, FORTHNAME, EFFECT, INFIXOP, KIND) \
         NATIVE_WORD(NAME, FORTHNAME, EFFECT) { \
-            sp[-1] = Value(sp[-1] INFIXOP sp[0]);\
-            --sp;\
+            { \
+                Value a = sp[-1], b = TOS; \
+                POP(); \
+                TOS = Value(NUMERIC_COMPARE(a, INFIXOP, b, KIND)); \
+            } \
+            NEXT(); \
+        }
+
+    #define NUMERIC_LITERAL_REL_WORD(NAME, FORTHNAME, EFFECT, INFIXOP, KIND) \
+        NATIVE_WORD(NAME, FORTHNAME, EFFECT, Word::MagicValParam) { \
+            { \
+                Value lhs = TOS, rhs = (pc++)->literal; \
+                TOS = Value(NUMERIC_COMPARE(lhs, INFIXOP, rhs, KIND)); \
+            } \
+            NEXT(); \
+        }
+
+    #define NUMERIC_COMPARE_BRANCH_WORD(NAME, FORTHNAME, INFIXOP, KIND) \
+        NATIVE_WORD(NAME, FORTHNAME, StackEffect({Num, Num}, {}), Word::MagicIntParam) { \
+            bool cond; \
+            { Value a = sp[-1], b = TOS; cond = NUMERIC_COMPARE(a, INFIXOP, b, KIND); } \
+            POPN(2); \
+            if (!cond) \
+                pc += pc->offset; \
+            ++pc; \
+            NEXT(); \
+        }
+
+
+    // Shortcuts for defining "quickening" binary operators (see Compiler::quickeningEnabled.)
+    // A QUICKENING_OP_WORD acts like BINARY_OP_WORD, but if both operands are numbers of the same
+    // kind it also rewrites its own instruction to QUICKENED, defined with QUICKENED_OP_WORD.
+    // That word computes EXPR -- in terms of Values `a` and `b` -- if both operands are numbers
+    // of the same kind; otherwise it rewrites its instruction to the generic word GENERIC and
+    // acts like it.
+    #define QUICKENING_OP_WORD(NAME, FORTHNAME, EFFECT, INFIXOP, QUICKENED) \
+        NATIVE_WORD(NAME, FORTHNAME, EFFECT, Word::Magic) { \
+            { \
+                Value a = sp[-1], b = TOS; \
+                if (SAME_NUMBER_KIND(a, b)) { \
+                    rewriteOp(pc - 1, QUICKENED.instruction().native); \
+                    ++quickeningStats.quickened; \
+                } \
+                POP(); \
+                TOS = Value(a INFIXOP b); \
+            } \
+            NEXT(); \
+        }
+
+    #define QUICKENED_OP_WORD(NAME, FORTHNAME, EFFECT, INFIXOP, GENERIC, EXPR) \
+        NATIVE_WORD(NAME, FORTHNAME, EFFECT, Word::Magic) { \
+            { \
+                Value a = sp[-1], b = TOS; \
+                POP(); \
+                if (SAME_NUMBER_KIND(a, b)) { \
+                    ++quickeningStats.hits; \
+                    TOS = Value(EXPR); \
+                } else { \
+                    ++quickeningStats.misses; \
+                    rewriteOp(pc - 1, GENERIC.instruction().native); \
+                    TOS = Value(a INFIXOP b); \
+                } \
+            } \
             NEXT(); \
         }
 
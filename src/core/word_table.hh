@@ -0,0 +1,171 @@
+//
+// word_table.hh
+//
+// Copyright (C) 2021 Jens Alfke. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "word.hh"
+#include <array>
+#include <string_view>
+
+
+namespace tails {
+
+    /// Case-insensitive (ASCII) hashing and comparison of word names. Names are stored uppercase,
+    /// but the parser accepts them in any case; folding case here means a lookup needn't make an
+    /// uppercased copy of the name.
+    namespace word_names {
+        constexpr char fold(char c) {
+            return (c >= 'a' && c <= 'z') ? char(c - 'a' + 'A') : c;
+        }
+
+        /// 64-bit FNV-1a of the uppercased name.
+        constexpr uint64_t hash(std::string_view name) {
+            uint64_t h = 0xcbf29ce484222325;
+            for (char c : name)
+                h = (h ^ uint8_t(fold(c))) * 0x100000001b3;
+            return h;
+        }
+
+        /// True if the Word's name equals `name`, ignoring case.
+        constexpr bool equal(const char *wordName, std::string_view name) {
+            for (char c : name) {
+                if (fold(*wordName++) != fold(c))
+                    return false;
+            }
+            return *wordName == 0;
+        }
+    }
+
+
+    /// The precomputed contents of a WordTable; built at compile time by \ref makeWordTable.
+    template <size_t N>
+    struct WordTableData {
+        // There are at least twice as many slots as words, so seeds are quick to find.
+        static constexpr size_t kSlots = [] {
+            size_t n = 8;
+            while (n < 2 * N)
+                n *= 2;
+            return n;
+        }();
+        static constexpr size_t kBuckets = N / 2 + 1;
+
+        std::array<const Word*, kSlots> slots {};
+        std::array<uint16_t, kBuckets>  seeds {};
+    };
+
+
+    /// An immutable perfect-hash table of named Words, built at compile time, so a Vocabulary of
+    /// predefined words costs nothing at startup. A name's hash picks a bucket, whose "seed" is
+    /// mixed into the hash to pick a slot; the seeds were chosen so that no two words share a
+    /// slot, so a lookup probes exactly one slot.
+    class WordTable {
+    public:
+        template <size_t N>
+        constexpr WordTable(const WordTableData<N> &data)
+        :_slots(data.slots.data()), _seeds(data.seeds.data())
+        ,_slotCount(data.kSlots), _bucketCount(data.kBuckets)
+        { }
+
+        /// Looks up a word by name, given its \ref word_names::hash.
+        const Word* lookup(std::string_view name, uint64_t hash) const {
+            const Word *word = _slots[slotFor(hash, _seeds[bucketFor(hash, _bucketCount)],
+                                              _slotCount)];
+            return (word && word_names::equal(word->name(), name)) ? word : nullptr;
+        }
+
+        const Word* lookup(std::string_view name) const {
+            return lookup(name, word_names::hash(name));
+        }
+
+        /// The table's slots, which are either nullptr or a Word.
+        const Word* const* slots() const    {return _slots;}
+        size_t slotCount() const            {return _slotCount;}
+
+        static constexpr size_t bucketFor(uint64_t hash, size_t bucketCount) {
+            return (hash >> 32) % bucketCount;
+        }
+
+        static constexpr size_t slotFor(uint64_t hash, uint16_t seed, size_t slotCount) {
+            uint64_t x = hash ^ (seed * 0x9E3779B97F4A7C15);
+            x ^= x >> 29;
+            x *= 0xBF58476D1CE4E5B9;
+            x ^= x >> 32;
+            return x & (slotCount - 1);
+        }
+
+    private:
+        const Word* const*  _slots;
+        const uint16_t*     _seeds;
+        size_t              _slotCount;
+        size_t              _bucketCount;
+    };
+
+
+    /// Builds the data of a perfect-hash WordTable from an array of words, at compile time.
+    /// Null pointers, and words without names, are skipped; so is a word with the same name as
+    /// an earlier one, as when adding to a Vocabulary.
+    template <size_t N>
+    constexpr WordTableData<N> makeWordTable(const std::array<const Word*, N> &words) {
+        using Data = WordTableData<N>;
+        Data data {};
+        std::array<uint64_t, N> hashes {};
+        std::array<bool, N> skip {};
+        std::array<size_t, Data::kBuckets> bucketSize {};
+        for (size_t i = 0; i < N; ++i) {
+            const Word *word = words[i];
+            skip[i] = !word || !word->name();
+            for (size_t j = 0; j < i && !skip[i]; ++j)
+                skip[i] = !skip[j] && word_names::equal(words[j]->name(), word->name());
+            if (!skip[i]) {
+                hashes[i] = word_names::hash(word->name());
+                ++bucketSize[WordTable::bucketFor(hashes[i], Data::kBuckets)];
+            }
+        }
+
+        // Place the buckets with the most words first, while the table is emptiest. For each,
+        // find the first seed that puts all its words in empty slots:
+        for (size_t size = N; size > 0; --size) {
+            for (size_t b = 0; b < Data::kBuckets; ++b) {
+                if (bucketSize[b] != size)
+                    continue;
+                for (uint32_t seed = 0; ; ++seed) {
+                    if (seed > UINT16_MAX)
+                        throw "makeWordTable: can't find a seed";
+                    std::array<size_t, N> placed {};
+                    size_t nPlaced = 0;
+                    for (size_t i = 0; i < N; ++i) {
+                        if (skip[i] || WordTable::bucketFor(hashes[i], Data::kBuckets) != b)
+                            continue;
+                        size_t slot = WordTable::slotFor(hashes[i], uint16_t(seed), Data::kSlots);
+                        if (data.slots[slot])
+                            break;
+                        data.slots[slot] = words[i];
+                        placed[nPlaced++] = slot;
+                    }
+                    if (nPlaced == size) {
+                        data.seeds[b] = uint16_t(seed);
+                        break;
+                    }
+                    for (size_t p = 0; p < nPlaced; ++p)     // Collision; undo and try again
+                        data.slots[placed[p]] = nullptr;
+                }
+            }
+        }
+        return data;
+    }
+
+}
@@ -7,6 +7,7 @@
 #pragma once
 #include "stack_effect.hh"
 #include <iostream>
+#include <iterator>
 
 namespace tails {
 
@@ -20,7 +21,7 @@ namespace tails {
             out << "∅";
         else {
             static constexpr const char *kNames[] = {"?", "#", "$", "{}", "[]"};
-            for (int i = 0; i <= 5; ++i) {
+            for (int i = 0; i < std::size(kNames); ++i) {
                 if (entry.canBeType(Value::Type(i))) {
                     out << kNames[i];
                 }
@@ -31,7 +31,8 @@ namespace tails::word {
     static bool sAtLeftMargin = true;
 
     NATIVE_WORD(PRINT, ".", "a --"_sfx) {
-        std::cout << *(sp--);
+        { Value top = TOS; std::cout << top; }
+        POP();
         sAtLeftMargin = false;
         NEXT();
     }
@@ -67,9 +68,15 @@ namespace tails::word {
 
     // This null-terminated list is used to register these words in the Vocabulary at startup.
 
-    const Word* const kWords[] = {
+    static constexpr std::array kWordList = {
         &PRINT, &SP, &NL, &NLQ,
-        nullptr
+        (const Word*)nullptr
     };
 
+    const Word* const* const kWords = kWordList.data();
+
+    static constexpr auto kWordTableData = makeWordTable(kWordList);
+
+    const WordTable kWordTable(kWordTableData);
+
 }
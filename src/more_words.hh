@@ -6,6 +6,7 @@
 
 #pragma once
 #include "word.hh"
+#include "word_table.hh"
 
 namespace tails::word {
 
@@ -17,5 +18,8 @@ namespace tails::word {
         NL,     // `NL.` -- print a newline
         NLQ;    // `NL?` -- print a newline only if there are characters on the current line
 
-    extern const Word* const kWords[];
+    extern const Word* const* const kWords;
+
+    /// The words in `kWords`, as a perfect-hash table built at compile time.
+    extern const WordTable kWordTable;
 }
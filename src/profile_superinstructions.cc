@@ -0,0 +1,417 @@
+//
+// profile_superinstructions.cc
+//
+// Copyright (C) 2021 Jens Alfke. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// A tool that runs a workload of Tails source code, counts how often each pair and triple of
+// adjacent primitives is executed, and writes a C++ source file defining superinstructions for
+// the most frequent ones, plus the fusion rules the compiler uses to emit them.
+// It must be built with ENABLE_TRACING, since it counts instructions in the `TRACE` hook.
+// See gen_superinstructions.sh.
+
+#include "compiler.hh"
+#include "core_words.hh"
+#include "gc.hh"
+#include "more_words.hh"
+#include "vocabulary.hh"
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#ifndef ENABLE_TRACING
+#error "profile_superinstructions must be built with ENABLE_TRACING defined"
+#endif
+
+using namespace std;
+using namespace tails;
+using namespace tails::core_words;
+
+
+namespace profiler {
+
+    // A sequence of two or three primitives; the third is nullptr in a pair.
+    using NGram = array<const Word*, 3>;
+
+    static map<NGram, uint64_t> sCounts;
+
+
+    // The most recently executed instructions, most recent first:
+    static const Instruction* sPrevPC[2];
+    static const Word*        sPrevWord[2];
+    static bool               sRunning;     // False while compiling, when constant folding runs words
+
+
+    static const Word* wordFor(const Instruction *pc) {
+        return Compiler::activeVocabularies.lookup(*pc);
+    }
+
+
+    // Called before every instruction executes.
+    static void record(const Instruction *pc) {
+        if (!sRunning)
+            return;
+        const Word *word = wordFor(pc);
+        if (word == &ZERO || word == &ONE)
+            word = &_LITERAL;       // The compiler fuses these as literals
+
+        auto adjacent = [&](int i, const Instruction *next) {
+            return sPrevWord[i] && sPrevPC[i] + 1 + sPrevWord[i]->parameters() == next;
+        };
+        if (adjacent(0, pc)) {
+            ++sCounts[{sPrevWord[0], word, nullptr}];
+            if (adjacent(1, sPrevPC[0]))
+                ++sCounts[{sPrevWord[1], sPrevWord[0], word}];
+        }
+        sPrevPC[1] = sPrevPC[0];     sPrevPC[0] = pc;
+        sPrevWord[1] = sPrevWord[0]; sPrevWord[0] = word;
+    }
+
+
+    // Forgets the previous instructions, so the next one doesn't count as adjacent to them.
+    static void reset() {
+        sPrevWord[0] = sPrevWord[1] = nullptr;
+    }
+
+
+#pragma mark - CODE GENERATION:
+
+
+    // A primitive that can appear in a generated superinstruction, with the C++ code to run it.
+    struct Primitive {
+        const Word *word;
+        const char *cppName;
+        const char *code;
+    };
+
+    #define BINARY(NAME, OP) \
+        {&NAME, #NAME, "{ Value a = sp[-1], b = TOS; POP(); TOS = Value(a " OP " b); }"}
+    #define ZERO_COMPARE(NAME, OP) \
+        {&NAME, #NAME, "{ Value a = TOS; TOS = Value(a " OP " Value(0)); }"}
+
+    static const Primitive kPrimitives[] = {
+        {&_LITERAL, "_LITERAL", "PUSH((pc++)->literal);"},
+        {&DUP,      "DUP",      "PUSH(TOS);"},
+        {&DROP,     "DROP",     "POP();"},
+        {&SWAP,     "SWAP",     "std::swap(TOS, sp[-1]);"},
+        {&OVER,     "OVER",     "PUSH(sp[-1]);"},
+        {&ROT,      "ROT",      "{ auto sp2 = sp[-2]; sp[-2] = sp[-1]; sp[-1] = TOS; TOS = sp2; }"},
+        BINARY(PLUS, "+"),  BINARY(MINUS, "-"), BINARY(MULT, "*"), BINARY(DIV, "/"),
+        BINARY(MOD, "%"),
+        BINARY(EQ, "=="),   BINARY(NE, "!="),   BINARY(GT, ">"),    BINARY(GE, ">="),
+        BINARY(LT, "<"),    BINARY(LE, "<="),
+        ZERO_COMPARE(EQ_ZERO, "=="), ZERO_COMPARE(NE_ZERO, "!="),
+        ZERO_COMPARE(GT_ZERO, ">"),  ZERO_COMPARE(LT_ZERO, "<"),
+        // `0BRANCH` may only come last, since it can change `pc`:
+        {&_ZBRANCH, "_ZBRANCH", "{ bool cond; { Value top = TOS; cond = !!top; } POP(); "
+                                "if (!cond) pc += pc->offset; ++pc; }"},
+    };
+
+    #undef BINARY
+    #undef ZERO_COMPARE
+
+    // C++ names of the built-in superinstructions, which a generated one can extend.
+    static const pair<const Word*, const char*> kBuiltInNames[] = {
+        {&_LIT_PLUS, "_LIT_PLUS"}, {&_LIT_MINUS, "_LIT_MINUS"}, {&_LIT_MULT, "_LIT_MULT"},
+        {&_LIT_DIV, "_LIT_DIV"},   {&_LIT_MOD, "_LIT_MOD"},
+        {&_LIT_EQ, "_LIT_EQ"}, {&_LIT_NE, "_LIT_NE"}, {&_LIT_GT, "_LIT_GT"},
+        {&_LIT_GE, "_LIT_GE"}, {&_LIT_LT, "_LIT_LT"}, {&_LIT_LE, "_LIT_LE"},
+        // (Superinstructions ending in 0BRANCH can't be extended, so they aren't listed.)
+    };
+
+
+    static const Primitive* primitive(const Word *word) {
+        for (auto &p : kPrimitives)
+            if (p.word == word)
+                return &p;
+        return nullptr;
+    }
+
+
+    static const Fusion* builtInFusion(const Word *first, const Word *second) {
+        for (auto f = kFusions; f->fused; ++f)
+            if (f->first == first && f->second == second)
+                return f;
+        return nullptr;
+    }
+
+
+    static string join(const vector<const Word*> &words, const char *separator,
+                       string (*nameOf)(const Word*))
+    {
+        string result;
+        for (auto word : words) {
+            if (!result.empty())
+                result += separator;
+            result += nameOf(word);
+        }
+        return result;
+    }
+
+    static string forthName(const Word *w) {return (w == &_LITERAL) ? "LIT" : w->name();}
+    static string cppName(const Word *w)   {return (w == &_LITERAL) ? "LIT" : primitive(w)->cppName;}
+
+
+    // A superinstruction to be generated.
+    struct Superinstruction {
+        vector<const Word*> parts;      // The primitives it fuses
+        uint64_t            count;      // How many times the sequence was executed
+        string              cppName;
+
+        Superinstruction(vector<const Word*> p, uint64_t c)
+        :parts(move(p)), count(c), cppName("_" + join(parts, "_", profiler::cppName)) { }
+
+        // The C++ name of the superinstruction for all but the last part, which this one extends.
+        string prefixName() const {
+            vector<const Word*> prefix(parts.begin(), parts.end() - 1);
+            if (prefix.size() == 1)
+                return primitive(prefix[0])->cppName;
+            for (auto [word, name] : kBuiltInNames) {
+                if (auto f = builtInFusion(prefix[0], prefix[1]); f && f->fused == word)
+                    return name;
+            }
+            return Superinstruction(prefix, 0).cppName;
+        }
+
+        // The stack effect, computed from the parts', with every type being `Any`.
+        string stackEffect() const {
+            int depth = 0, lowest = 0, highest = 0;
+            for (auto word : parts) {
+                auto effect = word->stackEffect();
+                lowest = min(lowest, depth - effect.inputCount());
+                highest = max(highest, depth + effect.max());
+                depth += effect.net();
+            }
+            int ins = -lowest, outs = depth - lowest;
+            auto anys = [](int n) {
+                string s;
+                for (int i = 0; i < n; ++i)
+                    s += (i ? ", Any" : "Any");
+                return s;
+            };
+            stringstream out;
+            out << "StackEffect({" << anys(ins) << "}, {" << anys(outs) << "}).withMax("
+                << highest << ")";
+            return out.str();
+        }
+
+        const char* flags() const {
+            if (parts.back() == &_ZBRANCH)
+                return "Word::MagicIntParam";
+            else if (find(parts.begin(), parts.end(), &_LITERAL) != parts.end())
+                return "Word::MagicValParam";
+            else
+                return "Word::Magic";
+        }
+
+        void write(ostream &out) const {
+            out << "    // " << join(parts, " ", forthName) << "  (executed " << count << " times)\n"
+                << "    NATIVE_WORD(" << cppName << ", \"_" << join(parts, "_", forthName)
+                << "\", " << stackEffect() << ", " << flags() << ") {\n";
+            for (auto word : parts)
+                out << "        " << primitive(word)->code << "\n";
+            out << "        NEXT();\n"
+                << "    }\n\n";
+        }
+    };
+
+
+    // Returns nullptr if the sequence can be turned into a new superinstruction, else the reason
+    // it can't.
+    static const char* whyNotFusable(const NGram &gram) {
+        int nParams = 0;
+        for (int i = 0; i < 3 && gram[i]; ++i) {
+            if (!primitive(gram[i]))
+                return "can't fuse";
+            if (gram[i] == &_ZBRANCH && i < 2 && gram[i + 1])
+                return "can't fuse";
+            nParams += gram[i]->parameters();
+        }
+        if (nParams > 1)
+            return "too many parameters";
+        if (!gram[2] && builtInFusion(gram[0], gram[1]))
+            return "already built in";
+        return nullptr;
+    }
+
+
+    // Chooses the `maxCount` most profitable sequences, plus the pairs needed to build up the
+    // chosen triples, and writes the C++ source for them to `out`.
+    static void generate(ostream &out, const string &workload, size_t maxCount) {
+        // Rank by instruction dispatches saved:
+        vector<pair<NGram, uint64_t>> ranked(sCounts.begin(), sCounts.end());
+        auto saved = [](const pair<NGram, uint64_t> &entry) {
+            return entry.second * (entry.first[2] ? 2 : 1);
+        };
+        sort(ranked.begin(), ranked.end(), [&](auto &a, auto &b) {return saved(a) > saved(b);});
+
+        cerr << "Most frequently executed sequences (triples are weighted double):\n";
+        vector<Superinstruction> chosen;
+        constexpr size_t kMaxListed = 40;
+        size_t listed = 0;
+        auto isChosen = [&](const vector<const Word*> &parts) {
+            return any_of(chosen.begin(), chosen.end(), [&](auto &s) {return s.parts == parts;});
+        };
+        for (auto &[gram, count] : ranked) {
+            vector<const Word*> parts(gram.begin(), gram[2] ? gram.end() : gram.end() - 1);
+            auto whyNot = whyNotFusable(gram);
+            if (++listed <= kMaxListed) {
+                cerr << "    " << setw(12) << count << "  " << join(parts, " ", forthName);
+                if (whyNot)
+                    cerr << "  (" << whyNot << ")";
+                cerr << "\n";
+            }
+            if (whyNot || isChosen(parts) || chosen.size() >= maxCount)
+                continue;
+            if (parts.size() == 3 && !builtInFusion(parts[0], parts[1])) {
+                // A triple is fused in two steps, so it needs a rule for its first pair too:
+                vector<const Word*> prefix(parts.begin(), parts.end() - 1);
+                if (!isChosen(prefix))
+                    chosen.emplace_back(prefix, sCounts[{parts[0], parts[1], nullptr}]);
+            }
+            chosen.emplace_back(parts, count);
+        }
+        // Pairs must be defined before the triples that refer to them:
+        stable_sort(chosen.begin(), chosen.end(), [](auto &a, auto &b) {
+            return a.parts.size() < b.parts.size();
+        });
+
+        out << "//\n"
+            << "// generated_superinstructions.cc\n"
+            << "//\n"
+            << "// GENERATED by profile_superinstructions from the workload: " << workload << "\n"
+            << "// Don't edit; run gen_superinstructions.sh to regenerate it.\n"
+            << "//\n\n"
+            << "#include \"core_words.hh\"\n"
+            << "#include \"stack_effect.hh\"\n"
+            << "#include <utility>\n\n\n"
+            << "namespace tails::core_words {\n\n"
+            << "    static constexpr TypeSet Any = TypeSet::anyType();\n\n\n";
+        for (auto &s : chosen)
+            s.write(out);
+        out << "\n    const Word* const kGeneratedWords[] = {\n";
+        for (auto &s : chosen)
+            out << "        &" << s.cppName << ",\n";
+        out << "        nullptr\n"
+            << "    };\n\n"
+            << "    const Fusion kGeneratedFusions[] = {\n";
+        for (auto &s : chosen)
+            out << "        {&" << s.prefixName() << ", &" << primitive(s.parts.back())->cppName
+                << ", &" << s.cppName << "},\n";
+        out << "        {nullptr, nullptr, nullptr}\n"
+            << "    };\n\n"
+            << "}\n";
+    }
+
+
+#pragma mark - RUNNING THE WORKLOAD:
+
+
+    // Compiles and runs one line of source code, with an empty stack.
+    static void run(const string &source) {
+        Compiler comp;
+        comp.parse(source);
+        CompiledWord word(move(comp));
+        vector<Value> stack(1 + word.stackEffect().max());
+        core_words::StackLimitScope limit(&stack.back());
+        core_words::LoopStackMark loopMark;
+        reset();
+        sRunning = true;
+        call(&stack[0], word.instruction().word);
+        sRunning = false;
+        reset();
+    }
+
+
+    static bool runFile(const string &path) {
+        ifstream in(path);
+        if (!in) {
+            cerr << "Can't open " << path << "\n";
+            return false;
+        }
+        string line;
+        for (int lineNo = 1; getline(in, line); ++lineNo) {
+            if (line.empty() || line[0] == '#')
+                continue;
+            try {
+                run(line);
+            } catch (const compile_error &x) {
+                cerr << path << ":" << lineNo << ": error: " << x.what() << "\n";
+                return false;
+            }
+            Compiler::activeVocabularies.gcScan();
+            gc::object::sweep();
+        }
+        return true;
+    }
+
+}
+
+
+namespace tails {
+    void TRACE(Value *sp, const Instruction *pc) {
+        profiler::record(pc);
+    }
+}
+
+
+int main(int argc, const char **argv) {
+    size_t maxCount = 8;
+    string outputPath;
+    vector<string> workloads;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc)
+            maxCount = stoul(argv[++i]);
+        else if (arg == "-o" && i + 1 < argc)
+            outputPath = argv[++i];
+        else
+            workloads.push_back(arg);
+    }
+    if (workloads.empty()) {
+        cerr << "Usage: profile_superinstructions [-n COUNT] [-o OUTPUT.cc] WORKLOAD...\n"
+                "Each line of a workload file is compiled and run as Tails source code;\n"
+                "empty lines and lines starting with `#` are ignored.\n";
+        return 1;
+    }
+
+    Vocabulary defaultVocab(word::kWordTable);
+    Compiler::activeVocabularies.push(defaultVocab);
+    Compiler::activeVocabularies.setCurrent(defaultVocab);
+    Compiler::fusionEnabled = false;    // Profile the instructions as they'd be without fusion
+    Compiler::specializationEnabled = false;    // ...and in their generic forms, which fuse
+
+    string names;
+    for (auto &path : workloads) {
+        if (!profiler::runFile(path))
+            return 1;
+        names += (names.empty() ? "" : " ") + path;
+    }
+
+    if (outputPath.empty()) {
+        profiler::generate(cout, names, maxCount);
+    } else {
+        ofstream out(outputPath);
+        profiler::generate(out, names, maxCount);
+        if (!out)
+            return 1;
+        cerr << "Wrote " << outputPath << "\n";
+    }
+    return 0;
+}
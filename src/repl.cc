@@ -17,10 +17,13 @@
 //
 
 #include "compiler.hh"
+#include "core_words.hh"
 #include "gc.hh"
 #include "io.hh"
 #include "more_words.hh"
+#include "stack_pool.hh"
 #include "vocabulary.hh"
+#include "word_cache.hh"
 #include "linenoise.h"
 #include "utf8.h"
 #include <algorithm>
@@ -77,36 +80,45 @@ namespace repl {
 #endif
 
     
+    /// Stacks to run words on, reused from one evaluation to the next.
+    static StackPool sStackPool;
+
+
     /// Top-level function to run a Word.
     /// @return  The top value left on the stack.
     static Stack run(const Word &word, Stack &stack) {
         assert(!word.isNative());           // must be interpreted
         if (word.stackEffect().inputCount() > stack.size())
             throw compile_error("Stack would underflow", nullptr);
+        // Copy the stack to a pooled DataStack, which has room for any word whose max depth is
+        // known, and whose guard page traps a recursive word that overflows it:
         auto depth = stack.size();
-        stack.resize(depth + word.stackEffect().max());
-
-        auto stackBase = &stack[0];
+        DataStack dataStack = sStackPool.acquire(depth + word.stackEffect().max());
+        auto stackBase = dataStack.base();
+        std::copy(stack.begin(), stack.end(), stackBase);
 #ifdef ENABLE_TRACING
         StackBase = stackBase;
 #endif
-        auto stackTop = call(&stack[depth] - 1, word.instruction().word);
-        stack.resize(stackTop - stackBase + 1);
+        core_words::StackLimitScope limit(dataStack.limit());
+        core_words::LoopStackMark loopMark;
+        auto stackTop = call(stackBase + depth - 1, word.instruction().word);
+        stack.assign(stackBase, stackTop + 1);
         return stack;
     }
 
 
+    /// Recently compiled lines, in case they're entered again.
+    static WordCache sWordCache;
+
+
     static void eval(const string &source, Stack &stack) {
-        Compiler comp;
-        comp.setInputStack(&stack.front(), &stack.back());
-        comp.parse(source);
-        CompiledWord compiled(move(comp));
-        run(compiled, stack);
+        run(sWordCache.compile(source, &stack.front(), &stack.back()), stack);
     }
 
 
     static void garbageCollect(Stack &stack) {
         Compiler::activeVocabularies.gcScan();
+        sWordCache.gcScan();
         gc::object::scanStack(&stack.front(), &stack.back());
 #if 1
         gc::object::sweep();
@@ -142,9 +154,10 @@ using namespace repl;
 
 
 int main(int argc, const char **argv) {
-    tails::Vocabulary defaultVocab(tails::word::kWords);
+    tails::Vocabulary defaultVocab(tails::word::kWordTable);
     tails::Compiler::activeVocabularies.push(defaultVocab);
     tails::Compiler::activeVocabularies.setCurrent(defaultVocab);
+    tails::StackPool::installOverflowHandler();
 
     cout << "Tails interpreter!!  Empty line clears stack.  Ctrl-D to exit.\n";
     Stack stack;
@@ -21,12 +21,21 @@
 #include "disassembler.hh"
 #include "gc.hh"
 #include "more_words.hh"
+#include "native_code.hh"
+#include "register_code.hh"
+#include "stack_pool.hh"
 #include "stack_effect_parser.hh"
 #include "vocabulary.hh"
+#include "word_cache.hh"
 #include "io.hh"
 #include <array>
+#include <cmath>
 #include <iomanip>
+#include <limits>
 #include <iostream>
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace tails;
@@ -37,6 +46,10 @@ static Value * StackBase;
 #endif
 
 
+/// Stacks to run words on.
+static StackPool sStackPool;
+
+
 /// Top-level function to run a Word.
 /// @return  The top value left on the stack.
 static Value run(const Word &word) {
@@ -45,12 +58,13 @@ static Value run(const Word &word) {
     assert(word.stackEffect().outputCount() > 0);  // must produce results
     size_t stackSize = word.stackEffect().max();
     assert(stackSize >= word.stackEffect().outputCount());
-    std::vector<Value> stack;
-    stack.resize(stackSize);
-    auto stackBase = &stack.front();
+    DataStack stack = sStackPool.acquire(stackSize);
+    auto stackBase = stack.base();
 #ifdef ENABLE_TRACING
     StackBase = stackBase;
 #endif
+    core_words::StackLimitScope limit(stack.limit());
+    core_words::LoopStackMark loopMark;
     return * call(stackBase - 1, word.instruction().word);
 }
 
@@ -87,10 +101,14 @@ static void printStackEffect(StackEffect f) {
 
 
 static void printDisassembly(const Word *word) {
-    auto dis = Disassembler::disassembleWord(word->instruction().word, true);
+    auto dis = Disassembler::disassembleWord(*word, true);
     for (auto &wordRef : dis) {
         cout << ' ' << (wordRef.word->name() ? wordRef.word->name() : "???");
-        if (wordRef.word->hasIntParams())
+        if (wordRef.word == &core_words::_SHUFFLE)
+            cout << "(" << Disassembler::describeShuffle(wordRef.param.shuffle) << ')';
+        else if (wordRef.word == &core_words::_REGS)
+            cout << "(" << Disassembler::describeRegisters(wordRef.param.registers) << ')';
+        else if (wordRef.word->hasIntParams())
             cout << "+<" << (int)wordRef.param.offset << '>';
         else if (wordRef.word->hasValParams())
             cout << ":<" << wordRef.param.literal << '>';
@@ -150,14 +168,14 @@ static void testStackEffect() {
     ts = "a -- b"_sfx;
     assert(ts.inputCount() == 1);
     assert(ts.outputCount() == 1);
-    assert(ts.inputs()[0].flags() == 0x1F);
-    assert(ts.outputs()[0].flags() == 0x1F);
+    assert(ts.inputs()[0].flags() == 0x3F);
+    assert(ts.outputs()[0].flags() == 0x3F);
 
     ts = "aaa# bbb#? -- ccc$ [d_d]?"_sfx;
     assert(ts.inputCount() == 2);
     assert(ts.outputCount() == 2);
-    assert(ts.inputs()[0].flags() == 0x03);
-    assert(ts.inputs()[1].flags() == 0x02);
+    assert(ts.inputs()[0].flags() == 0x23);
+    assert(ts.inputs()[1].flags() == 0x22);
     assert(ts.outputs()[0].flags() == 0x09);
     assert(ts.outputs()[1].flags() == 0x04);
     assert(!ts.outputs()[0].isInputMatch());
@@ -166,25 +184,628 @@ static void testStackEffect() {
     ts = "apple ball# cat -- ball# cat apple"_sfx;
     assert(ts.inputCount() == 3);
     assert(ts.outputCount() == 3);
-    assert(ts.inputs()[0].flags() == 0x1F);
-    assert(ts.inputs()[1].flags() == 0x02);
-    assert(ts.inputs()[2].flags() == 0x1F);
+    assert(ts.inputs()[0].flags() == 0x3F);
+    assert(ts.inputs()[1].flags() == 0x22);
+    assert(ts.inputs()[2].flags() == 0x3F);
     assert(ts.outputs()[0].isInputMatch());
     assert(ts.outputs()[0].inputMatch() == 2);
     assert(ts.outputs()[1].inputMatch() == 0);
     assert(ts.outputs()[2].inputMatch() == 1);
-    assert(ts.outputs()[0].flags() == 0x7F);
-    assert(ts.outputs()[1].flags() == 0x3F);
-    assert(ts.outputs()[2].flags() == 0x42);
+    assert(ts.outputs()[0].flags() == 0xFF);
+    assert(ts.outputs()[1].flags() == 0x7F);
+    assert(ts.outputs()[2].flags() == 0xA2);
+}
+
+
+static void testVocabulary() {
+    // Every core word is found by its name, in any case:
+    for (const Word *word : Vocabulary::core) {
+        string name = word->name();
+        assert(Vocabulary::core.lookup(name) == word);
+        for (char &c : name)
+            c = char(tolower(c));
+        assert(Vocabulary::core.lookup(name) == word);
+    }
+    assert(Vocabulary::core.lookup("dUp") == &DUP);
+    assert(Vocabulary::core.lookup("DEFINE") == &DEFINE);
+    assert(!Vocabulary::core.lookup("DUPE") && !Vocabulary::core.lookup("DU") && !Vocabulary::core.lookup(""));
+
+    // A vocabulary built on a WordTable can have more words added, and grows to hold them;
+    // adding a word whose name is already present does nothing:
+    Vocabulary vocab(word::kWordTable);
+    vocab.add(core_words::kWords);
+    vocab.add(word::NL);
+    size_t count = 0;
+    for (const Word *word : vocab) {
+        ++count;
+        assert(vocab.lookup(word->name()) == word);
+    }
+    for (auto w = core_words::kWords; *w; ++w)
+        assert(vocab.lookup((*w)->name())->name() == string((*w)->name()));
+    assert(vocab.lookup("nl.") == &word::NL);
+    assert(!vocab.lookup("NL.."));
+    assert(count > 100);
+
+    // Words are found by their instructions too, and the index keeps up as words are added:
+    for (const Word *word : Vocabulary::core)
+        assert(Vocabulary::core.lookup(word->instruction())->instruction() == word->instruction());
+    assert(vocab.lookup(word::NL.instruction()) == &word::NL);
+    assert(!vocab.lookup(Instruction::withOffset(12345)));
+    TEST_PARSER(0,      R"( {(# -- #) 3 *} "indexed" define  0 )");
+    const Word *indexed = Compiler::activeVocabularies.lookup("indexed");
+    assert(Compiler::activeVocabularies.lookup(indexed->instruction()) == indexed);
+}
+
+
+static void testCountedLoops() {
+    auto loopDepth = loopStack - loopStackBase;
+    TEST_PARSER(120,  "1 6 1 DO I * LOOP");
+    TEST_PARSER(20,   "0 10 0 DO I + 2 +LOOP");
+    TEST_PARSER(6,    "0 0 3 DO I + -1 +LOOP");
+    TEST_PARSER(36,   "0 3 0 DO 3 0 DO J 3 * I + + LOOP LOOP");
+    TEST_PARSER(10,   "0 100 0 DO I 5 = IF LEAVE THEN I + LOOP");
+    TEST_PARSER(7,    "7 5 5 DO DROP 0 LOOP");                  // empty loop is skipped
+    TEST_PARSER(3,    "0 3 0 DO 1 + 2 0 DO LEAVE LOOP LOOP");   // LEAVE from inner loop only
+    TEST_PARSER(-6,   "0 0 -3 DO I + LOOP");
+
+    // The index is an integer if both bounds are, else a double:
+    assert(_runParser("0 5 2 DO DROP I LOOP").isInt());
+    assert(_runParser("0 140737488355327 140737488355325 DO DROP I LOOP").isInt());
+    assert(_runParser("0 5.0 2 DO DROP I LOOP").isDouble());
+    TEST_PARSER(4.5,  "0 5 0 DO DROP I 1.5 +LOOP");
+
+    // Loops can nest as deeply as recursion does; the loop stack grows as needed:
+    TEST_PARSER(0,    R"( {(# -- #) DUP 0 > IF 1 0 DO DUP 1 - RECURSE + LOOP THEN} "rloop" define  0 )");
+    TEST_PARSER(1125750, "1500 rloop");
+#ifdef ENABLE_NATIVE_CODEGEN
+    NativeCode::enabled = false;
+    TEST_PARSER(0,    R"( {(# -- #) DUP 0 > IF 1 0 DO DUP 1 - RECURSE + LOOP THEN} "rloop_threaded" define  0 )");
+    NativeCode::enabled = true;
+    TEST_PARSER(1125750, "1500 rloop_threaded");
+#endif
+    assert(loopStack - loopStackBase == loopDepth);
+}
+
+
+// Returns the names of the words in a word's code (skipping any `_JIT` or `_REGS` prefix.)
+static string wordCode(const Word &word) {
+    string code;
+    for (auto &ref : Disassembler::disassembleWord(word, true)) {
+#ifdef ENABLE_NATIVE_CODEGEN
+        if (ref.word == &_JIT)
+            continue;
+#endif
+        if (ref.word == &_REGS)
+            continue;
+        code += (code.empty() ? "" : " ") + string(ref.word->name());
+        if (ref.word->hasValParams() && ref.param.literal.type() == Value::AString)
+            code += ":" + string(ref.param.literal.asString());
+        else if (ref.word == &_SHUFFLE)
+            code += "(" + Disassembler::describeShuffle(ref.param.shuffle) + ")";
+        else if (ref.word->hasWordParams())
+            code += ":" + string(Compiler::activeVocabularies.lookup(ref.param.word)->name());
+    }
+    return code;
+}
+
+
+// Returns the names of the words in a parsed word's code (skipping any `_JIT` or `_REGS` prefix.)
+static string parsedCode(const char *source, optional<StackEffect> effect = nullopt) {
+    Compiler compiler;
+    if (effect)
+        compiler.setStackEffect(*effect);
+    compiler.parse(string(source));
+    CompiledWord parsed(move(compiler));
+    return wordCode(parsed);
+}
+
+
+// True if `code`, as returned by `wordCode` or `parsedCode`, runs or calls the word `name`.
+static bool codeCalls(const string &code, const char *name) {
+    string word = Compiler::activeVocabularies.lookup(name)->name();
+    string padded = " " + code + " ";
+    return padded.find(" " + word + " ") != string::npos
+        || padded.find(":" + word + " ") != string::npos;
+}
+
+
+// `( n# -- n# )` Throws an exception if `n` is negative.
+NATIVE_WORD(THROWNEG, "THROWNEG", "n# -- n#"_sfx) {
+    if (Value top = TOS; top.asDouble() < 0)
+        throw std::runtime_error("negative");
+    NEXT();
+}
+
+
+static void testRegisterCode() {
+    RegisterCode::enabled = true;
+    auto registerCode = [](const char *name) {
+        auto word = static_cast<const CompiledWord*>(Compiler::activeVocabularies.lookup(name));
+        assert(word->registerCode());
+        assert(Compiler::activeVocabularies.lookup(word->instruction()) == word);
+        return word->registerCode();
+    };
+
+    // In `tri` the stack shuffles disappear entirely; the loop is just a compare-and-branch,
+    // two arithmetic instructions and a branch back.
+    TEST_PARSER(0,      R"( {(f# i# -- result#) DUP 1 > IF DUP ROT + SWAP 1 - RECURSE ELSE DROP THEN} "tri_regs" define  0 )");
+    string listing = registerCode("tri_regs")->disassemble();
+    cout << listing;
+    assert(listing.find("MOV") == string::npos && listing.find("XCHG") == string::npos);
+    TEST_PARSER(15,     "1 5 tri_regs");
+    TEST_PARSER(5050,   "1 100 tri_regs");
+
+    // Non-tail recursion, calling its own threaded code:
+    TEST_PARSER(0,      R"( {(# -- #) DUP 1 > IF DUP 1 - RECURSE * ELSE DROP 1 THEN} "factorial_regs" define  0 )");
+    (void)registerCode("factorial_regs");
+    TEST_PARSER(120,    "5 factorial_regs");
+    TEST_PARSER(1,      "1 factorial_regs");
+    TEST_PARSER(0,      R"( {(# -- #) DUP 0 > IF DUP DUP DUP DUP DUP DUP DUP 1 - RECURSE + + + + + + + THEN} "deep_regs" define  0 )");
+    TEST_PARSER(7.0 * 20000 * 20001 / 2, R"( 20000 deep_regs )");     // (continues on new stack segments)
+
+    // An exception thrown partway down a recursion leaves nothing behind for the next call:
+    Compiler::activeVocabularies.current()->add(THROWNEG);
+    TEST_PARSER(0,      R"( {(# -- #) THROWNEG DUP 0 > IF DUP 2 - RECURSE + THEN} "sum2_regs" define  0 )");
+    (void)registerCode("sum2_regs");
+    bool threw = false;
+    try {
+        _runParser("5 sum2_regs");
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+    TEST_PARSER(12,     "6 sum2_regs");
+
+    // Generic arithmetic on strings, and words called on the real stack. (With inlining on, the
+    // call below would be inlined and constant-folded away.)
+    TEST_PARSER(0,      R"( {($ -- #) DUP + DUP + LENGTH} "quadlen_regs" define  0 )");
+    auto quadlen = Compiler::activeVocabularies.lookup("quadlen_regs");
+    assert(codeCalls(wordCode(*quadlen), "+") && codeCalls(wordCode(*quadlen), "LENGTH"));
+    listing = registerCode("quadlen_regs")->disassemble();
+    cout << listing;
+    assert(listing.find("ADD") != string::npos && listing.find("CALL LENGTH") != string::npos);
+    auto inlineBudget = Compiler::inlineBudget;
+    Compiler::inlineBudget = 0;
+    assert(codeCalls(parsedCode(R"( "abc" quadlen_regs )"), "quadlen_regs"));
+    TEST_PARSER(12,     R"( "abc" quadlen_regs )");
+    Compiler::inlineBudget = inlineBudget;
+    TEST_PARSER("abab", R"( "ab" DUP + )");
+
+    // Items out of place where control flow joins are moved (here, rotated) into their slots:
+    TEST_PARSER(0,      R"( {(# # # -- #) ROT DUP 0= IF 7 + THEN SWAP 10 * + SWAP 100 * +} "rotjoin_regs" define  0 )");
+    assert(registerCode("rotjoin_regs")->disassemble().find("XCHG") != string::npos);
+    TEST_PARSER(231,    "1 2 3 rotjoin_regs");
+    TEST_PARSER(237,    "0 2 3 rotjoin_regs");
+    TEST_PARSER(3212,   "1 2 3 SWAP ROT OVER SWAP 10 * + SWAP 100 * + SWAP 1000 * +");
+
+    // Loops, and calls to interpreted words:
+    testCountedLoops();
+    TEST_PARSER(120,    "1 5 BEGIN DUP WHILE SWAP OVER * SWAP 1 - REPEAT DROP");
+    TEST_PARSER(108,    "5 factorial_regs 1 5 tri_regs - 3 +");
+    RegisterCode::enabled = false;
+}
+
+
+static void testNumbers() {
+    TEST_PARSER(31,     "0x1F");
+    TEST_PARSER(255,    "0XfF");
+    TEST_PARSER(-16,    "-0x10");
+    TEST_PARSER(7,      "+7");
+    TEST_PARSER(0.5,    ".5");
+    TEST_PARSER(-2500,  "-2.5e3");
+    TEST_PARSER(17,     "0x10 1 +");
+    TEST_PARSER(0,      "[ 0x10 -1.5 ] LENGTH 2 -");
+
+    // Tokens with non-ASCII bytes are words, not numbers:
+    TEST_PARSER(0,      "{(# -- #) 1 +} \"\xC3\xA9inc\" define  0");
+    TEST_PARSER(2,      "1 \xC3\xA9inc");
+
+    // Not numbers, or not in range:
+    for (const char *bad : {"0x", "0x-5", "--5", "12abc", "1..2", "inf", "1e400", "[ 1 2x ]",
+                            "\xC3\xA9", "-\xC3\xA9", "0x\xC3\xA9", "1\xC3\xA9"}) {
+        bool threw = false;
+        try {
+            parsedCode(bad);
+        } catch (const compile_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+}
+
+
+static void testIntegers() {
+    // Integers are exact up to 48 bits, then they become doubles:
+    assert(Value(3).isInt() && Value(size_t(3)).isInt() && Value(3.0).isDouble());
+    assert(Value(Value::kMaxInt).isInt() && Value(Value::kMaxInt + 1).isDouble());
+    assert(Value(3) == Value(3.0) && Value(3).cmp(Value(3.5)) < 0 && Value(-4) < Value(3));
+    assert(!Value(0) && Value(-1));
+    assert((Value(Value::kMaxInt) + Value(1)) == Value(double(Value::kMaxInt) + 1));
+    assert((Value(Value::kMinInt) - Value(1)).isDouble());
+    assert((Value(1 << 24) * Value(1 << 24)) == Value(double(int64_t(1) << 48)));
+    assert((Value(-7) * Value(6)).isInt() && (Value(-7) % Value(3)) == Value(-1));
+    assert((Value(7.9) % Value(3)) == Value(1) && (Value(7) % Value(0)) == NullValue);
+    assert((Value(1) + Value(0.5)) == Value(1.5));
+
+    // The stack checker tells integers from doubles:
+    TypeSet integer = TypeSet::integer(), floating = TypeSet::floating(), number(Value::ANumber);
+    assert(TypeSet::of(Value(3)) == integer && TypeSet::of(Value(0.5)) == floating);
+    assert(integer < number && integer.canBeType(Value::ANumber) && integer.isInteger());
+    assert(floating < number && floating.canBeType(Value::ANumber) && floating.isFloating());
+    assert((integer | number) == number && (number - integer) == floating);
+    assert((integer | floating) == number && !number.isInteger() && !number.isFloating());
+    assert(integer.promoted() == number && TypeSet(Value::AString).promoted() == Value::AString);
+
+    assert(_runParser("140737488355327").isInt());
+    assert(_runParser("-0x800000000000").isInt());
+    assert(_runParser("140737488355328").isDouble());
+    assert(_runParser("3.0").isDouble());
+    TEST_PARSER(1,              "140737488355327 140737488355326 -");
+
+    // Arithmetic in words whose operands aren't known, so it isn't folded (and in native code,
+    // takes the inline integer fast path):
+    TEST_PARSER(0,              R"( {(a# b# -- c#) +} "iadd" define  {(a# b# -- c#) -} "isub" define  0 )");
+    TEST_PARSER(0,              R"( {(a# -- c#) 1 +} "iinc" define  {(a# b# -- c#) *} "imul" define  0 )");
+    assert(_runParser("-5 3 iadd").isInt());
+    TEST_PARSER(-2,             "-5 3 iadd");
+    TEST_PARSER(-8,             "-5 3 isub");
+    TEST_PARSER(2.5,            "-0.5 3 iadd");
+    TEST_PARSER(140737488355328.0, "140737488355327 1 iadd");
+    TEST_PARSER(140737488355328.0, "140737488355327 iinc");
+    TEST_PARSER(-140737488355329.0, "-140737488355328 1 isub");
+    TEST_PARSER(-42,            "-7 6 imul");
+    TEST_PARSER(1099511627776.0 * 1099511627776.0, "1099511627776 1099511627776 imul");
+    TEST_PARSER(1,              "7 3 MOD");
+
+    // Numbers of unknown kind are compared as integers if both are, else as doubles:
+    Value big(Value::kMaxInt), bigger1(Value::kMaxInt - 1), half(0.5);
+    assert(NUMERIC_COMPARE(bigger1, <, big, Any) && !NUMERIC_COMPARE(big, <=, bigger1, Any));
+    assert(NUMERIC_COMPARE(half, <, big, Any) && NUMERIC_COMPARE(big, >, half, Any));
+    assert(NUMERIC_COMPARE(Value(3), ==, Value(3.0), Any));
+    assert(!NUMERIC_COMPARE(Value(-0.5), >=, Value(0), Any));
+    assert(NUMERIC_ARITH(big, -, bigger1, Any).isInt());
+    assert(NUMERIC_ARITH(big, +, Value(1), Any) == Value(double(Value::kMaxInt) + 1));
+    assert(NUMERIC_ARITH(Value(3), *, half, Any) == Value(1.5));
+
+    // Comparisons and branches:
+    TEST_PARSER(0,              R"( {(a# b# -- c#) < IF 1 ELSE 2 THEN} "iless" define  0 )");
+    TEST_PARSER(0,              R"( {(a# b# -- c#) = IF 1 ELSE 2 THEN} "iequal" define  0 )");
+    TEST_PARSER(0,              R"( {(a# -- c#) 0= IF 1 ELSE 2 THEN} "izero" define  0 )");
+    TEST_PARSER(1,              "-5 3 iless");
+    TEST_PARSER(2,              "3 -5 iless");
+    TEST_PARSER(1,              "-140737488355328 140737488355327 iless");
+    TEST_PARSER(1,              "140737488355326 140737488355327 iless");
+    TEST_PARSER(2,              "140737488355327 140737488355326.0 iless");
+    TEST_PARSER(1,              "2.5 3 iless");
+    TEST_PARSER(1,              "3 3 iequal");
+    TEST_PARSER(1,              "3 3.0 iequal");
+    TEST_PARSER(2,              "3 4 iequal");
+
+    // `=` compares all numbers by value, so it's transitive across integers, doubles and -0:
+    assert(Value(0) == Value(0.0) && Value(0) == Value(-0.0) && Value(0.0) == Value(-0.0));
+    assert(Value(0.0).cmp(Value(-0.0)) == 0 && !Value(0.0).isIdentical(Value(-0.0)));
+    TEST_PARSER(1,              "0.0 -0.0 iequal");
+    TEST_PARSER(1,              "-0.0 0 iequal");
+    TEST_PARSER(1,              "0 -0.0 iequal");
+    TEST_PARSER(2,              "0.5 0 iequal");
+    TEST_PARSER(1,              "0.0 -0.0 =");          // (folded)
+    TEST_PARSER(0,              "-0.0 0 <>");
+    TEST_PARSER(1,              "0 izero");
+    TEST_PARSER(1,              "0.0 izero");
+    TEST_PARSER(2,              "-3 izero");
+    TEST_PARSER(0,              R"( {(a# -- c#) 0< IF 1 ELSE 2 THEN} "inegative" define  0 )");
+    TEST_PARSER(1,              "-3 inegative");
+    TEST_PARSER(2,              "0 inegative");
+    TEST_PARSER(1,              "-0.5 inegative");
+}
+
+
+static void testConstantFolding() {
+    TEST_PARSER(3600000,            "60 60 * 1000 *");
+    assert(parsedCode("60 60 * 1000 *") == "_LITERAL _RETURN");
+    TEST_PARSER("ab",               R"( "a" "b" + )");
+    assert(parsedCode(R"( "a" "b" + )") == "_LITERAL:ab _RETURN");
+    assert(parsedCode("3 DUP * 9 = 2 3 SWAP - 0< NULL DROP") == "_LITERAL _LITERAL _RETURN");
+    TEST_PARSER(12,                 "5 1 2 ROT DUP DUP + OVER - + + SWAP DROP");
+
+    // Branches on literal conditions are removed, along with the code that can't be reached:
+    assert(parsedCode(R"( 1 IF "yes" ELSE "no" THEN )") == "_LITERAL:yes _RETURN");
+    assert(parsedCode(R"( 2 3 > IF "yes" ELSE "no" THEN )") == "_LITERAL:no _RETURN");
+    TEST_PARSER(5,                  "2 0 IF 1 + THEN 3 +");
+
+    // Only literal operands are folded:
+    assert(parsedCode("2 3 * +", "# -- #"_sfx) == "_LITNUM+ _RETURN");
+    assert(parsedCode("1 5 begin dup while swap over * swap 1 - repeat drop").find("0BRANCH")
+                != string::npos);
+
+    // The code is still stack-checked, dead branches included:
+    bool threw = false;
+    try {
+        parsedCode("1 IF 1 ELSE 1 2 THEN");
+    } catch (const compile_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    Compiler::foldingEnabled = false;
+    assert(parsedCode("60 60 * 1000 *") != "_LITERAL _RETURN");
+    Compiler::foldingEnabled = true;
+}
+
+
+// A word made of many conditionals in a row, each leaving a different literal on each path, so
+// the stack checker has to merge the paths at every `THEN`. It should visit each instruction
+// about once, so compile time stays linear in `n`.
+static string chainedConditionals(int n) {
+    string source;
+    for (int i = 0; i < n; ++i)
+        source += " 3 MOD IF 1 ELSE 2 THEN";
+    return source;
+}
+
+
+static void testChainedConditionals() {
+    string define = "{(# -- #)" + chainedConditionals(200) + "} \"chained\" define  0";
+    TEST_PARSER(0,      define.c_str());
+    int expected = 5;
+    for (int i = 0; i < 200; ++i)
+        expected = (expected % 3) ? 1 : 2;
+    TEST_PARSER(expected, "5 chained");
+}
+
+
+static void testStackShuffles() {
+    auto removed = Compiler::peepholeRemoved;
+    assert(parsedCode("SWAP SWAP",      "# # -- # #"_sfx) == "_RETURN");
+    assert(parsedCode("DUP DROP",       "# -- #"_sfx) == "_RETURN");
+    assert(parsedCode("OVER DROP",      "# # -- # #"_sfx) == "_RETURN");
+    assert(parsedCode("ROT ROT ROT",    "# # # -- # # #"_sfx) == "_RETURN");
+    assert(Compiler::peepholeRemoved - removed == 9);
+
+    // What's left of a run becomes a single `_SHUFFLE`, if that saves at least two dispatches:
+    assert(parsedCode("SWAP ROT OVER",  "# # # -- # # # #"_sfx) == "_SHUFFLE(a b c -- c b a b) _RETURN");
+    assert(parsedCode("OVER SWAP DROP", "# # -- # #"_sfx) == "DROP DUP _RETURN");
+    assert(parsedCode("DUP",            "# -- # #"_sfx) == "DUP _RETURN");
+
+    // Literals are part of a run, so one that's dropped disappears:
+    Compiler::foldingEnabled = false;
+    assert(parsedCode(R"( "x" DROP SWAP "y" SWAP DROP )", "# # -- # $"_sfx) == "SWAP DROP _LITERAL:y _RETURN");
+    TEST_PARSER(2,      "1 2 3 ROT ROT ROT - -");
+    Compiler::foldingEnabled = true;
+
+    // A run doesn't extend past a branch destination:
+    string code = parsedCode("DUP IF SWAP THEN SWAP", "# # # -- # # #"_sfx);
+    assert(code.find("SWAP") != code.rfind("SWAP"));
+
+    // An inlined `_SHUFFLE` is stack-checked, and can be combined with more shuffles:
+    static CompiledWord SHUF( []() {
+        Compiler c("SHUF");
+        c.setStackEffect("# # # -- # # # #"_sfx);
+        c.setInline();
+        c.add({SWAP});
+        c.add({ROT});
+        c.add({OVER});
+        return c;
+    }());
+    assert(parsedCode("SHUF DROP", "# # # -- # # #"_sfx) == "_SHUFFLE(a b c -- c b a) _RETURN");
+    TEST_PARSER(3212,   "1 2 3 SHUF SWAP 10 * + SWAP 100 * + SWAP 1000 * +");
+
+    TEST_PARSER(0,      R"( {(# # # -- # # # #) SWAP ROT OVER} "shuf" define  0 )");
+    TEST_PARSER(3212,   "1 2 3 shuf SWAP 10 * + SWAP 100 * + SWAP 1000 * +");
+#ifdef ENABLE_NATIVE_CODEGEN
+    assert(Disassembler(*Compiler::activeVocabularies.lookup("shuf")).next().word
+                == &_JIT);
+    NativeCode::enabled = false;
+    TEST_PARSER(0,      R"( {(# # # -- # # # #) SWAP ROT OVER} "shuf_threaded" define  0 )");
+    NativeCode::enabled = true;
+    TEST_PARSER(3212,   "1 2 3 shuf_threaded SWAP 10 * + SWAP 100 * + SWAP 1000 * +");
+#endif
+}
+
+
+static void testInlining() {
+    auto compile = [](const string &source) {
+        Compiler c;
+        c.setInputStack(nullptr, nullptr);
+        c.parse(source);
+        return CompiledWord(move(c));
+    };
+
+    auto inlined = [](const char *name) {
+        auto word = static_cast<const CompiledWord*>(Compiler::activeVocabularies.lookup(name));
+        return word->inlinedWords();
+    };
+
+    // Small interpreted words are inlined, with their branches pointed at the right places:
+    TEST_PARSER(0,      R"( {(n# -- #) ABS 1 +} "absinc" define  {(a b -- c) MAX 10 MIN} "clamp" define  0 )");
+    assert(inlined("absinc") == vector<const Word*>{&ABS});
+    assert(inlined("clamp") == (vector<const Word*>{&MAX, &MIN}));
+    TEST_PARSER(4,      "-3 absinc");
+    TEST_PARSER(4,      "3 absinc");
+    TEST_PARSER(7,      "3 7 clamp");
+    TEST_PARSER(10,     "30 7 clamp");
+
+    TEST_PARSER(0,      R"( {(n# -- sum#) 0 SWAP BEGIN DUP WHILE DUP ROT + SWAP 1 - REPEAT DROP} "trisum" define  0 )");
+    TEST_PARSER(0,      R"( {(a# b# -- #) trisum SWAP trisum +} "trisum2" define  0 )");
+    auto trisum = Compiler::activeVocabularies.lookup("trisum");
+    assert(inlined("trisum2") == (vector<const Word*>{trisum, trisum}));
+    TEST_PARSER(21,     "3 5 trisum2");
+
+    // Recursive words aren't:
+    TEST_PARSER(0,      R"( {(n# -- f#) DUP 1 > IF DUP 1 - RECURSE * THEN} "rfact" define  0 )");
+    TEST_PARSER(0,      R"( {(n# -- #) rfact 1 +} "rfact1" define  0 )");
+    assert(inlined("rfact1").empty());
+    TEST_PARSER(121,    "5 rfact1");
+
+    // The budget shrinks as the caller grows:
+    auto inlineBudget = Compiler::inlineBudget;
+    Compiler::inlineBudget = 6;
+    assert(compile("-1 ABS").inlinedWords().size() == 1);
+    string longer = "0";
+    for (int i = 0; i < 40; ++i)
+        longer += " 1 +";
+    assert(compile(longer + " ABS").inlinedWords().empty());
+    Compiler::inlineBudget = 0;
+    assert(compile("-1 ABS").inlinedWords().empty());
+    Compiler::inlineBudget = inlineBudget;
+
+    // An inlined word's declared input types are checked, though its body would accept more.
+    // That goes for code whose input types are inferred from its body, like a quotation, too:
+    TEST_PARSER(0,      R"( {(# -- #) DUP DROP} "nid" define  0 )");
+    TEST_PARSER(0,      R"( {(# -- #) nid 1 +} "nid1" define  0 )");
+    auto nid = Compiler::activeVocabularies.lookup("nid");
+    assert(inlined("nid1") == vector<const Word*>{nid});
+    TEST_PARSER(4,      "3 nid1");
+    assert(compile("3 nid").inlinedWords() == vector<const Word*>{nid});
+    TEST_PARSER(5,      "-5 1 {ABS} {1 +} IFELSE");
+    struct {const char *source, *callee;} kMismatches[] = {
+        {R"( {($ -- $) nid} "bad" define  0 )", "NID"},
+        {R"( "str" nid )",                      "NID"},
+        {R"( "str" 1 {nid} {1 +} IFELSE )",     "IFELSE"},     // (the quotation's input is `#`)
+    };
+    for (auto &bad : kMismatches) {
+        string error;
+        try {
+            compile(bad.source);
+        } catch (const compile_error &x) {
+            error = x.what();
+        }
+        assert(error.find(string("Type mismatch passing string to `") + bad.callee + "`") != string::npos);
+    }
+}
+
+
+static void testEarlyReturn() {
+    // A branch to the end of the word becomes a RETURN:
+    assert(parsedCode("IF 1 ELSE 2 THEN", "# -- #"_sfx) == "0BRANCH 1 _RETURN _LITERAL _RETURN");
+
+    TEST_PARSER(0,      R"( {(# -- $) IF "yes" ELSE "no, not at all" THEN} "yesno" define  0 )");
+    garbageCollect();   // (the word's literals after its first RETURN must survive this)
+    TEST_PARSER("yes",  "1 yesno");
+    TEST_PARSER("no, not at all", "0 yesno");
+
+    // An early RETURN in an inlined word branches to the end of its inlined code:
+    TEST_PARSER(0,      R"( {(# -- #) IF 10 ELSE 20 THEN} "pick1020" define  0 )");
+    TEST_PARSER(0,      R"( {(# -- #) pick1020 1 +} "pick1121" define  0 )");
+    auto pick = static_cast<const CompiledWord*>(Compiler::activeVocabularies.lookup("pick1121"));
+    assert(pick->inlinedWords().size() == 1);
+    TEST_PARSER(11,     "1 pick1121");
+    TEST_PARSER(21,     "0 pick1121");
+#ifdef ENABLE_NATIVE_CODEGEN
+    NativeCode::enabled = false;
+    TEST_PARSER(0,      R"( {(# -- #) IF 10 ELSE 20 THEN} "pick1020_threaded" define  0 )");
+    NativeCode::enabled = true;
+    TEST_PARSER(10,     "1 pick1020_threaded");
+    TEST_PARSER(20,     "0 pick1020_threaded");
+#endif
+}
+
+
+static void testStackPool() {
+    StackPool pool(1000);
+    assert(pool.capacity() >= 1000);
+    void *firstBase;
+    {
+        DataStack stack = pool.acquire(500);
+        assert(stack.capacity() == pool.capacity());
+        firstBase = stack.base();
+        stack.base()[-1] = Value(1);                // the slot below the base is addressable
+        stack.base()[stack.capacity() - 1] = Value(2);
+    }
+    assert(pool.available() == 1);
+    {
+        // A released stack is reused; a stack bigger than the pool's capacity is not pooled:
+        DataStack stack = pool.acquire();
+        assert(stack.base() == firstBase);
+        DataStack big = pool.acquire(100000);
+        assert(big.capacity() >= 100000);
+        assert(pool.available() == 0);
+    }
+    assert(pool.available() == 1);
+
+    // Writing past the top of the stack hits the guard page:
+    DataStack stack = pool.acquire();
+    assert(StackPool::isGuardPage(stack.end()));
+    assert(!StackPool::isGuardPage(stack.end() - 1));
+    cout.flush();
+    pid_t child = fork();
+    if (child == 0) {
+        StackPool::installOverflowHandler();
+        *(volatile double*)stack.end() = 3.0;
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    assert(WIFSIGNALED(status));
+    assert(WTERMSIG(status) == SIGSEGV || WTERMSIG(status) == SIGBUS);
+
+#ifndef DEBUG
+    // Getting a stack for a word with an unknown max depth, vs. allocating one as a vector:
+    constexpr int kRuns = 100000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kRuns; ++i) {
+        std::vector<Value> vec;
+        vec.resize(1 + StackEffect::kUnknownMax);
+    }
+    std::chrono::duration<double> vecTime = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kRuns; ++i)
+        (void)sStackPool.acquire(StackEffect::kUnknownMax);
+    std::chrono::duration<double> poolTime = std::chrono::steady_clock::now() - start;
+    cout << "Time to get a stack of " << StackEffect::kUnknownMax << ": vector "
+         << (vecTime.count() / kRuns * 1e9) << " ns, StackPool "
+         << (poolTime.count() / kRuns * 1e9) << " ns\n";
+#endif
+}
+
+
+static void testWordCache() {
+    WordCache cache(2);
+    // Whitespace outside strings doesn't matter, but the input stack's types do:
+    assert(WordCache::keyFor("1  2\t+ ", nullptr, nullptr) == WordCache::keyFor(" 1 2 +", nullptr, nullptr));
+    assert(WordCache::keyFor(R"( "a  b" )", nullptr, nullptr) != WordCache::keyFor(R"( "a b" )", nullptr, nullptr));
+    assert(WordCache::keyFor("1 \xC3\xA9inc", nullptr, nullptr) == WordCache::keyFor("1  \xC3\xA9inc ", nullptr, nullptr));
+    Value num(1), str("x");
+    assert(WordCache::keyFor("DUP", &num, &num) != WordCache::keyFor("DUP", &str, &str));
+
+    const CompiledWord &sum = cache.compile("1 2 +", nullptr, nullptr);
+    assert(run(sum) == 3);
+    assert(&cache.compile(" 1 2  + ", nullptr, nullptr) == &sum);
+    assert(cache.compile("DUP +", &num, &num).stackEffect() == "# -- #"_sfx.withMax(1));
+    assert(cache.compile("DUP +", &str, &str).stackEffect() == "$ -- $"_sfx.withMax(1));  // evicts `sum`
+    assert(cache.size() == 2);
+    assert(cache.stats().hits == 1 && cache.stats().misses == 3 && cache.stats().evictions == 1);
+
+    // Compile errors aren't cached:
+    try {
+        cache.compile("1 +", nullptr, nullptr);
+        assert(false);
+    } catch (const compile_error&) { }
+    assert(cache.size() == 2 && cache.stats().misses == 4);
+
+    // Cached words' literals stay alive until they're evicted:
+    const CompiledWord &lit = cache.compile(R"( "not a short string" )", nullptr, nullptr);
+    Compiler::activeVocabularies.gcScan();
+    cache.gcScan();
+    gc::object::sweep();
+    assert(run(lit) == "not a short string");
+    cache.clear();
+    assert(cache.size() == 0);
 }
 
 
 int main(int argc, char *argv[]) {
-    Vocabulary defaultVocab(word::kWords);
+    Vocabulary defaultVocab(word::kWordTable);
     Compiler::activeVocabularies.push(defaultVocab);
     Compiler::activeVocabularies.setCurrent(defaultVocab);
+#ifdef ENABLE_NATIVE_CODEGEN
+    NativeCode::enabled = true;         // (It's off by default, but the tests should cover it)
+#endif
 
     testStackEffect();
+    testVocabulary();
+    testStackPool();
+    testWordCache();
 
     cout << "Known words:";
     for (auto word : Compiler::activeVocabularies)
@@ -223,21 +844,70 @@ int main(int argc, char *argv[]) {
          SQUARE,
          ABS);
 
+    CompiledWord INCR( []() {
+        Compiler c("INCR");
+        c.setStackEffect("# -- #"_sfx);
+        c.setInline();
+        c.add({1});
+        c.add({PLUS});
+        return c;
+    }());
+
     TEST_PARSER(7,    "3 -4 -");
+    TEST_PARSER(12,   "10 INCR INCR");                  // inlining a superinstruction
+
+    // Generated superinstructions are registered, and are found by their instruction:
+    for (auto f = kGeneratedFusions; f->fused; ++f)
+        assert(Compiler::activeVocabularies.lookup(f->fused->instruction()) == f->fused);
     TEST_PARSER(14,   "4 3 + DUP + ABS");
     TEST_PARSER(9604, "4 3 + SQUARE DUP + SQUARE ABS");
-    TEST_PARSER(2  ,  "2 ABS ABS ABS");                 // testing INTERP2/3/4
+    auto inlineBudget = Compiler::inlineBudget;
+    Compiler::inlineBudget = 0;                         // (so `inc` is called, not inlined)
+    TEST_PARSER(0,    R"( {(# -- #) 1 +} "inc" define  0 )");
+    // Each of INTERP2...INTERP16 and TAILINTERP2...TAILINTERP16, and runs of more than 16 calls,
+    // which take several of them. `inc` isn't idempotent, so skipping or repeating a call shows:
+    for (int n = 2; n <= 20; ++n) {
+        string calls;
+        for (int i = 0; i < n; ++i)
+            calls += " inc";
+        TEST_PARSER(n,    ("0" + calls).c_str());                 // TAILINTERPn
+        TEST_PARSER(n + 1, ("0" + calls + " 1 +").c_str());       // INTERPn
+    }
+    Compiler::inlineBudget = inlineBudget;
     TEST_PARSER(123,  "1 IF 123 ELSE 666 THEN");
     TEST_PARSER(666,  "0 IF 123 ELSE 666 THEN");
 
     TEST_PARSER(120,  "1 5 begin  dup  while  swap over * swap 1 -  repeat  drop");
 
+    testCountedLoops();
+#ifdef ENABLE_NATIVE_CODEGEN
+    NativeCode::enabled = false;
+    testCountedLoops();
+    NativeCode::enabled = true;
+#endif
+
+    testNumbers();
+    testIntegers();
+    testConstantFolding();
+    testStackShuffles();
+    testInlining();
+    testChainedConditionals();
+    testEarlyReturn();
+    testRegisterCode();
+
     garbageCollect();
 
     // Strings:
     TEST_PARSER("hello",            R"( "hello" )");
     TEST_PARSER("truthy",           R"( 1 IF "truthy" ELSE "falsey" THEN )");
+    Compiler::foldingEnabled = false;   // (so these use the superinstructions)
+    TEST_PARSER("less",             R"( 3 4 < IF "less" ELSE "not less" THEN )");  // _<0BRANCH
+    TEST_PARSER("not less",         R"( 4 3 < IF "less" ELSE "not less" THEN )");
+    TEST_PARSER("zero",             R"( 5 5 - 0= IF "zero" ELSE "nonzero" THEN )");  // _0=0BRANCH
+    Compiler::foldingEnabled = true;
+    TEST_PARSER("less",             R"( "abc" "abd" < IF "less" ELSE "not less" THEN )");
     TEST_PARSER("HiThere",          R"( "Hi" "There" + )");
+    TEST_PARSER("HiThere",          R"( "Hi" "There" + "" + )");
     TEST_PARSER(5,                  R"( "hello" LENGTH )");
 
     // Arrays:
@@ -268,12 +938,37 @@ int main(int argc, char *argv[]) {
     TEST_PARSER(0,                  R"( {(# -- #) 3 *} "thrice" define  0 )");
     TEST_PARSER(72,                 R"( 8 thrice Thrice )");
 
+    // Superinstruction literals must be seen by the GC:
+    TEST_PARSER(0,                  R"( {($ -- $) " and a long suffix" +} "suffixed" define  0 )");
+    garbageCollect();
+    TEST_PARSER("x and a long suffix", R"( "x" suffixed )");
+
     // Define a typical recursive factorial function:
     TEST_PARSER(0,                  R"( {(# -- #) DUP 1 > IF DUP 1 - RECURSE * ELSE DROP 1 THEN} "factorial" define  0 )");
     TEST_PARSER(120,                R"( 5 factorial )");
     auto fact = Compiler::activeVocabularies.lookup("factorial");
     assert(fact);
     assert(fact->hasFlag(Word::Recursive));
+    assert(fact->stackEffect().max() == 2);     // not counting the recursive call
+
+    // Deep recursion that outgrows the stack it starts on, so it continues on new segments:
+    TEST_PARSER(0, R"( {(# -- #) DUP 0 > IF DUP DUP DUP DUP DUP DUP DUP 1 - RECURSE + + + + + + + THEN} "deep" define  0 )");
+    TEST_PARSER(7.0 * 20000 * 20001 / 2, R"( 20000 deep )");
+#ifdef ENABLE_NATIVE_CODEGEN
+    NativeCode::enabled = false;
+    TEST_PARSER(0, R"( {(# -- #) DUP 0 > IF DUP DUP DUP DUP DUP DUP DUP 1 - RECURSE + + + + + + + THEN} "deep_threaded" define  0 )");
+    NativeCode::enabled = true;
+    TEST_PARSER(7.0 * 20000 * 20001 / 2, R"( 20000 deep_threaded )");
+#endif
+    // Run without a stack limit, the recursive calls all use new segments:
+    assert(core_words::stackLimit == nullptr);
+    {
+        auto deep = Compiler::activeVocabularies.lookup("deep");
+        vector<Value> stack(1 + deep->stackEffect().max());
+        stack[0] = Value(3);
+        assert(call(&stack[0], deep->instruction().word) == &stack[0]);
+        assert(stack[0] == Value(7 * 3 * 4 / 2));
+    }
 
     // Define a tail-recursive form of factorial:
     //   fact(a, n) -> fact(a * n, n - 1)  when n > 1
@@ -305,9 +1000,76 @@ int main(int argc, char *argv[]) {
     cout << "\n";
     assert(!tri->hasFlag(Word::Recursive));
     assert(tri->stackEffect().max() == 2);
+#ifdef ENABLE_NATIVE_CODEGEN
+    assert(Disassembler(*tri).next().word == &_JIT);
+#endif
+
+    // The stack checker proves `tri`'s operands are numbers, so it gets numbers-only words:
+    auto usesWord = [](const Word *word, const Word &target) {
+        for (auto &ref : Disassembler::disassembleWord(*word, true))
+            if (ref.word == &target)
+                return true;
+        return false;
+    };
+    assert(usesWord(tri, _GT_ZBRANCH_NUM) && usesWord(tri, _LIT_MINUS_NUM));
+    assert(!usesWord(Compiler::activeVocabularies.lookup("suffixed"), _LIT_PLUS_NUM));
+
+    // ...and where it proves they're all integers, or all doubles, the variant for that kind:
+    TEST_PARSER(0,                  R"( {(f -- #) IF 1 ELSE 2 THEN 10 *} "intmul" define  0 )");
+    TEST_PARSER(0,                  R"( {(f -- #) IF 1.5 ELSE 2.5 THEN 10.0 *} "dblmul" define  0 )");
+    TEST_PARSER(0,                  R"( {(f -- #) IF 1.5 ELSE 2 THEN 10 *} "nummul" define  0 )");
+    assert(usesWord(Compiler::activeVocabularies.lookup("intmul"), _LIT_MULT_INT));
+    assert(usesWord(Compiler::activeVocabularies.lookup("dblmul"), _LIT_MULT_DBL));
+    assert(usesWord(Compiler::activeVocabularies.lookup("nummul"), _LIT_MULT_NUM));
+    TEST_PARSER(10,                 R"( 1 intmul )");
+    TEST_PARSER(25,                 R"( 0 dblmul )");
+    TEST_PARSER(15,                 R"( 1 nummul )");
+    assert(_runParser("1 intmul").isInt() && _runParser("0 dblmul").isDouble());
 
     TEST_PARSER(15,                R"( 1 5 tri )");
 
+    // (The GC must not mistake the double 360 for a quote when it scans this word's literals.)
+    TEST_PARSER(0,                  R"( {(n# -- n#) 360 +} "plus360" define  0 )");
+    TEST_PARSER(361,                R"( 1 plus360 )");
+
+    // A loop body's stack growth counts toward the word's max:
+    TEST_PARSER(0,                  R"( {(n# -- sum#) 0 SWAP BEGIN DUP WHILE DUP 10 MOD ROT + SWAP 1 - REPEAT DROP} "digitsum" define  0 )");
+    assert(Compiler::activeVocabularies.lookup("digitsum")->stackEffect().max() == 3);
+    TEST_PARSER(48,                 R"( 12 digitsum )");
+
+    // Quickening: an untyped `+` specializes itself for numbers, then reverts on a string.
+#ifdef ENABLE_NATIVE_CODEGEN
+    NativeCode::enabled = false;        // (native code doesn't use quickening)
+#endif
+    Compiler::quickeningEnabled = true;
+    Compiler::inlineBudget = 0;         // (the words have to be called, to be quickened)
+    auto stats = quickeningStats;
+    TEST_PARSER(0,                  R"( {(x#$ -- x#$) DUP +} "twice" define  {($[ -- #) LENGTH} "len" define  0 )");
+    auto twice = Compiler::activeVocabularies.lookup("twice");
+    assert(usesWord(twice, _Q_PLUS));
+    TEST_PARSER(6,                  R"( 3 twice )");
+    assert(usesWord(twice, _PLUS_QNUM));
+    TEST_PARSER(10,                 R"( 5 twice )");
+    TEST_PARSER("abab",             R"( "ab" twice )");
+    assert(usesWord(twice, PLUS));
+    TEST_PARSER(5,                  R"( "hello" len )");
+    TEST_PARSER(4,                  R"( "four" len )");
+    TEST_PARSER(2,                  R"( [1 2] len )");
+    assert(quickeningStats.quickened - stats.quickened == 2);
+    assert(quickeningStats.hits - stats.hits == 2);
+    assert(quickeningStats.misses - stats.misses == 2);
+    cout << "Quickening: " << quickeningStats.quickened << " quickened, " << quickeningStats.hits
+         << " hits, " << quickeningStats.misses << " misses\n";
+    TEST_PARSER(0,                  R"( {(x#$ y#$ -- b#) =} "same" define  0 )");
+    TEST_PARSER(1,                  R"( 0.0 -0.0 same )");
+    assert(usesWord(Compiler::activeVocabularies.lookup("same"), _EQ_QNUM));
+    TEST_PARSER(1,                  R"( -0.0 0.0 same )");  // (a quickened `=` of doubles)
+    Compiler::quickeningEnabled = false;
+    Compiler::inlineBudget = inlineBudget;
+#ifdef ENABLE_NATIVE_CODEGEN
+    NativeCode::enabled = true;
+#endif
+
 #ifndef DEBUG
     auto start = std::chrono::steady_clock::now();
     auto result = _runParser(R"( 1 100000000 tri )");
@@ -316,10 +1078,234 @@ int main(int argc, char *argv[]) {
     std::chrono::duration<double> diff = end - start;
     cout << "Got " << result << endl;
     cout << "Time to compute tri(1e8): " << diff.count() << " s; " << (diff.count() / 1e8 * 1e9) << " ns / iteration\n";
+
+#ifdef ENABLE_NATIVE_CODEGEN
+    // The same, without native code. (It stays off while the caller is compiled too, since
+    // `tri_threaded` may be inlined into it.)
+    NativeCode::enabled = false;
+    TEST_PARSER(0,                  R"( {(f# i# -- result#) DUP 1 > IF DUP ROT + SWAP 1 - RECURSE ELSE DROP THEN} "tri_threaded" define  0 )");
+    {
+        Compiler caller;
+        caller.parse(string("1 100000000 tri_threaded"));
+        assert(Disassembler(CompiledWord(move(caller))).next().word != &_JIT);
+    }
+    start = std::chrono::steady_clock::now();
+    result = _runParser(R"( 1 100000000 tri_threaded )");
+    assert(result.asDouble() == (1e8 * (1e8 + 1)) / 2);
+    end = std::chrono::steady_clock::now();
+    diff = end - start;
+    NativeCode::enabled = true;
+    cout << "Time to compute tri(1e8) without native code: " << diff.count() << " s; " << (diff.count() / 1e8 * 1e9) << " ns / iteration\n";
+#endif
+
+    // A counted loop, vs. the same loop with BEGIN-WHILE-REPEAT:
+    start = std::chrono::steady_clock::now();
+    result = _runParser(R"( 0 100000000 0 DO I + LOOP )");
+    assert(result.asDouble() == (1e8 * (1e8 - 1)) / 2);
+    end = std::chrono::steady_clock::now();
+    diff = end - start;
+    cout << "Time for 1e8 iterations of DO-LOOP: " << diff.count() << " s; " << (diff.count() / 1e8 * 1e9) << " ns / iteration\n";
+    start = std::chrono::steady_clock::now();
+    result = _runParser(R"( 0 100000000 BEGIN DUP WHILE SWAP OVER + SWAP 1 - REPEAT DROP )");
+    assert(result.asDouble() == (1e8 * (1e8 + 1)) / 2);
+    end = std::chrono::steady_clock::now();
+    diff = end - start;
+    cout << "Time for 1e8 iterations of BEGIN-WHILE-REPEAT: " << diff.count() << " s; " << (diff.count() / 1e8 * 1e9) << " ns / iteration\n";
+
+    // Compile throughput (parsing, stack checking and code generation), without native code
+    // and then with it:
+    constexpr int kCompiles = 100000;
+    const string query = "0 100 0 DO I 3 MOD 0 = IF I + ELSE I 2 * - THEN LOOP DUP 0 < IF ABS THEN 10 MAX";
+    auto timeCompiles = [&](const char *what) {
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kCompiles; ++i) {
+            Compiler comp;
+            comp.parse(query);
+            CompiledWord word(move(comp));
+        }
+        end = std::chrono::steady_clock::now();
+        diff = end - start;
+        cout << "Time to compile “" << query << "”" << what << ": " << (diff.count() / kCompiles * 1e9) << " ns\n";
+    };
+#ifdef ENABLE_NATIVE_CODEGEN
+    NativeCode::enabled = false;
+    timeCompiles(" without native code");
+    NativeCode::enabled = true;
+    timeCompiles(" to native code");
+    NativeCode::enabled = false;
+#else
+    timeCompiles("");
+#endif
+
+    // Looking up words by name through the vocabulary stack, in mixed case, including misses:
+    constexpr int kLookups = 1000000;
+    const char* const kNames[] = {"dup", "SWAP", "Over", "+", "nl.", "Define", "tri", "nosuchword"};
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kLookups; ++i)
+        found += (Compiler::activeVocabularies.lookup(kNames[i % std::size(kNames)]) != nullptr);
+    end = std::chrono::steady_clock::now();
+    diff = end - start;
+    assert(found == kLookups - kLookups / std::size(kNames));
+    cout << "Time to look up a word: " << (diff.count() / kLookups * 1e9) << " ns\n";
+
+    // Disassembling a word that calls others, with 10,000 more words in the vocabulary:
+    {
+        Vocabulary bigVocab;
+        Vocabulary *defaultVocab = Compiler::activeVocabularies.current();
+        Compiler::activeVocabularies.push(bigVocab);
+        Compiler::activeVocabularies.setCurrent(bigVocab);
+        auto savedBudget = Compiler::inlineBudget;
+        Compiler::inlineBudget = 0;
+        vector<unique_ptr<CompiledWord>> words;
+        for (int i = 0; i < 10000; ++i) {
+            Compiler comp("w" + to_string(i));
+            comp.setStackEffect("# -- #"_sfx);
+            comp.parse(string("DUP +"));
+            words.emplace_back(new CompiledWord(move(comp)));
+        }
+        Compiler comp;
+        comp.parse(string("1 w0 w5000 w9999 DUP + 2 *"));
+        CompiledWord caller(move(comp));
+        constexpr int kDisassemblies = 10000;
+        size_t n = 0;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kDisassemblies; ++i)
+            n += Disassembler::disassembleWord(caller).size();
+        end = std::chrono::steady_clock::now();
+        assert(n >= 7 * kDisassemblies);
+        diff = end - start;
+        cout << "Time to disassemble a word among 10,000: "
+             << (diff.count() / kDisassemblies * 1e9) << " ns\n";
+        Compiler::inlineBudget = savedBudget;
+        Compiler::activeVocabularies.pop();
+        Compiler::activeVocabularies.setCurrent(defaultVocab);
+    }
+
+    // Parse throughput, on a large generated source. (This includes compiling it.)
+    string bigSource = "0";
+    for (int i = 0; i < 20000; ++i)
+        bigSource += " " + to_string(i) + " 0x1F + 2.5 * Dup drop + abs";
+    start = std::chrono::steady_clock::now();
+    {
+        Compiler comp;
+        comp.parse(bigSource);
+        CompiledWord word(move(comp));
+    }
+    end = std::chrono::steady_clock::now();
+    diff = end - start;
+    cout << "Time to parse " << (bigSource.size() / 1024) << " KB of source: "
+         << (diff.count() * 1e3) << " ms; " << (bigSource.size() / diff.count() / 1e6) << " MB/s\n";
+
+    constexpr int kChainedCompiles = 1000;
+    const string chained = chainedConditionals(200);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kChainedCompiles; ++i) {
+        Compiler comp;
+        comp.setStackEffect("# -- #"_sfx);
+        comp.parse(chained);
+        CompiledWord word(move(comp));
+    }
+    end = std::chrono::steady_clock::now();
+    diff = end - start;
+    cout << "Time to compile 200 chained conditionals: "
+         << (diff.count() / kChainedCompiles * 1e6) << " µs\n";
+
+    // The cost of single primitives on each type of operand, in threaded code: the time of a loop
+    // that pushes the operands and runs the primitive (dropping its result), minus that of one
+    // that just drops the operands; best of 20 runs. The optimizations that would replace or
+    // remove the primitive are turned off. Both raw times are shown too, and the standard
+    // deviation of the difference across runs; a difference within that is just noise, and may
+    // even be negative.
+    {
+        Compiler::foldingEnabled = Compiler::fusionEnabled = Compiler::peepholeEnabled = false;
+        Compiler::specializationEnabled = false;
+        constexpr int kIterations = 2500000, kRuns = 20;
+        struct Timing {double best, variance;};
+        auto timeLoop = [&](const string &body) {
+            Compiler comp;
+            comp.parse("0 " + to_string(kIterations) + " 0 DO " + body + " LOOP");
+            CompiledWord loop(move(comp));
+            double best = std::numeric_limits<double>::infinity(), sum = 0, sumSquares = 0;
+            for (int i = 0; i < kRuns; ++i) {
+                start = std::chrono::steady_clock::now();
+                run(loop);
+                diff = std::chrono::steady_clock::now() - start;
+                double t = diff.count() / kIterations * 1e9;
+                best = std::min(best, t);
+                sum += t;
+                sumSquares += t * t;
+            }
+            double mean = sum / kRuns;
+            return Timing{best, std::max(sumSquares / kRuns - mean * mean, 0.0)};
+        };
+        struct {const char *what, *a, *b;} kOperands[] = {
+            {"doubles", "1.5", "2.5"}, {"integers", "1", "2"}, {"strings", "\"ab\"", "\"cd\""},
+        };
+        struct {const char *name, *code; bool unary, strings;} kPrimitives[] = {
+            {"0BRANCH", "IF THEN", true, true},
+            {"=",       "= DROP",  false, true},
+            {"<",       "< DROP",  false, true},
+            {"+",       "+ DROP",  false, false},     // (string concatenation would allocate)
+        };
+        for (auto &prim : kPrimitives) {
+            cout << "Time for `" << prim.name << "`:";
+            for (auto &operands : kOperands) {
+                if (operands.what == string("strings") && !prim.strings)
+                    continue;
+                string args = string(operands.a) + (prim.unary ? "" : string(" ") + operands.b);
+                Timing base = timeLoop(args + (prim.unary ? " DROP" : " DROP DROP"));
+                Timing time = timeLoop(args + " " + prim.code);
+                cout << " " << operands.what << " " << (time.best - base.best) << " ns ("
+                     << time.best << " - " << base.best << " ± "
+                     << sqrt(time.variance + base.variance) << ")";
+            }
+            cout << "\n";
+        }
+        Compiler::foldingEnabled = Compiler::fusionEnabled = Compiler::peepholeEnabled = true;
+        Compiler::specializationEnabled = true;
+    }
+
+    // The register-code backend vs. threaded code, on `tri`, recursion, and strings:
+    TEST_PARSER(0,                  R"( {(f# i# -- result#) DUP 1 > IF DUP ROT + SWAP 1 - RECURSE ELSE DROP THEN} "tri_threaded" define  0 )");
+    TEST_PARSER(0,                  R"( {(# -- #) DUP 1 > IF DUP 1 - RECURSE * ELSE DROP 1 THEN} "factorial_threaded" define  0 )");
+    TEST_PARSER(0,                  R"( {($ -- #) DUP + DUP + LENGTH} "quadlen_threaded" define  0 )");
+    struct {const char *what, *threaded, *registers; double iterations;} kRegisterBenchmarks[] = {
+        {"tri(1e7)",           "1 10000000 tri_threaded",
+                               "1 10000000 tri_regs",                                    1e7},
+        {"10 factorial, 1e6 times", "0 1000000 0 DO 10 factorial_threaded + LOOP",
+                               "0 1000000 0 DO 10 factorial_regs + LOOP",               1e6},
+        {"string doubling, 1e6 times", R"( 0 1000000 0 DO "abc" quadlen_threaded + LOOP )",
+                               R"( 0 1000000 0 DO "abc" quadlen_regs + LOOP )",         1e6},
+    };
+    // (Inlining is off, else `quadlen` would be inlined into the loop and constant-folded.)
+    auto savedBudget = Compiler::inlineBudget;
+    Compiler::inlineBudget = 0;
+    assert(codeCalls(parsedCode(kRegisterBenchmarks[2].threaded), "quadlen_threaded"));
+    assert(codeCalls(parsedCode(kRegisterBenchmarks[2].registers), "quadlen_regs"));
+    for (auto &b : kRegisterBenchmarks) {
+        double time[2];
+        Value results[2];
+        for (int regs = 0; regs < 2; ++regs) {
+            RegisterCode::enabled = regs;
+            start = std::chrono::steady_clock::now();
+            results[regs] = _runParser(regs ? b.registers : b.threaded);
+            diff = std::chrono::steady_clock::now() - start;
+            time[regs] = diff.count() / b.iterations * 1e9;
+        }
+        RegisterCode::enabled = false;
+        assert(results[0] == results[1]);
+        cout << "Time for " << b.what << ": threaded " << time[0] << " ns, register code "
+             << time[1] << " ns / iteration\n";
+    }
+    Compiler::inlineBudget = savedBudget;
+#ifdef ENABLE_NATIVE_CODEGEN
+    NativeCode::enabled = true;
+#endif
 #endif
 
     garbageCollect();
-    assert(gc::object::instanceCount() == 0);
+    assert(gc::object::instanceCount() == 2);   // the string literals in `suffixed` and `yesno`
     
     cout << "\nTESTS PASSED❣️❣️❣️\n\n";
 }
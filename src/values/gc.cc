@@ -21,6 +21,7 @@
 #include "value.hh"
 #include "word.hh"
 #include "core_words.hh"
+#include "disassembler.hh"
 
 namespace tails::gc {
     using namespace std;
@@ -49,9 +50,12 @@ namespace tails::gc {
 
     void object::scanWord(const Word *word) {
         if (!word->isNative()) {
-            for (const Instruction *pc = word->instruction().word; *pc != core_words::_RETURN; ++pc) {
-                if (*pc == core_words::_LITERAL)
-                    (++pc)->literal.mark();
+            // Mark the Value parameters of `_LITERAL` and of any superinstruction containing one:
+            Disassembler dis(*word);
+            dis.setLiteral(true);
+            while (dis) {
+                if (auto ref = dis.next(); ref.word->hasValParams())
+                    ref.param.literal.mark();
             }
         }
     }
@@ -25,6 +25,7 @@
 #include <initializer_list>
 #include <limits>
 #include <math.h>
+#include <stdint.h>
 #include <string.h>  // for memcpy()
 
 namespace tails {
@@ -34,9 +35,8 @@ namespace tails {
         size_t size;
     };
 
-    /** A self-describing 8-byte value that can store a double, a pointer, or six bytes of inline
-        data; and can identify which it's holding at any time.
-        (By virtue of storing doubles, it can also store exact integers up to ±2^51.)
+    /** A self-describing 8-byte value that can store a double, a pointer, six bytes of inline
+        data, or a 48-bit signed integer; and can identify which it's holding at any time.
         Uses the so-called "NaN tagging" or "Nan boxing" trick that's used by several dynamic
         language runtimes, such as LuaJIT and both WebKit's and Mozilla's JavaScript VMs.
 
@@ -45,9 +45,10 @@ namespace tails {
         - "Quiet" NaNs with the leading bits 0x7ff8 or 0xfff8 are special:
           - If the sign bit is set, the lower 48 bits are a pointer, which will be extended to
             64 bits. (No current mainstream CPUs use more than 48 bits of address space.)
+          - Otherwise, if both tag bits (below) are set, the lower 48 bits are a signed integer.
           - Otherwise the lower 48 bits are 6 bytes of inline data.
           - Two tag bits are available; you could use them to distinguish between four types of
-            pointers or inline data, for instance. */
+            pointers, or three types of inline data, for instance. */
     template <class TO>
     class NanTagged {
     public:
@@ -67,7 +68,9 @@ namespace tails {
 
         constexpr bool isDouble() const noexcept _pure        {return (_bits & kMagicBits) != kMagicBits;}
         constexpr bool isPointer() const noexcept _pure       {return (_bits & kTypeMask) == kPointerType;}
-        constexpr bool isInline() const noexcept _pure        {return (_bits & kTypeMask) == kInlineType;}
+        constexpr bool isInline() const noexcept _pure        {return (_bits & kTypeMask) == kInlineType
+                                                                      && !isInteger();}
+        constexpr bool isInteger() const noexcept _pure       {return (_bits & kIntTypeMask) == kIntType;}
 
         constexpr bool isNullPointer() const noexcept _pure   {return _bits == kPointerType;}
         
@@ -81,6 +84,14 @@ namespace tails {
         constexpr const TO* asPointer() const noexcept _pure  {return isPointer() ? pointerValue() : nullptr;}
         /// Returns the inline data this stores, or `{nullptr,0}` if it's not inline.
         constexpr slice asInline() const noexcept _pure       {return isInline() ? inlineValue() : slice();}
+        /// Returns the integer this stores, or 0 if it's not holding an integer.
+        constexpr int64_t asInteger() const noexcept _pure    {return isInteger() ? integerValue() : 0;}
+
+        /// The range of integers that can be stored; see \ref setInteger.
+        static constexpr int64_t kMinInteger = -(int64_t(1) << 47);
+        static constexpr int64_t kMaxInteger =  (int64_t(1) << 47) - 1;
+
+        static constexpr bool fitsInteger(int64_t i) noexcept  {return i >= kMinInteger && i <= kMaxInteger;}
 
 
         // Pointer & inline values have two free tag bits:
@@ -119,10 +130,17 @@ namespace tails {
             setInline({inlineBytes.begin(), inlineBytes.size()});
         }
 
+        /// Stores an integer, which must be in the range [kMinInteger, kMaxInteger].
+        void setInteger(int64_t i) noexcept {
+            assert(fitsInteger(i));
+            _bits = kIntType | (uint64_t(i) & kPtrBits);
+        }
+
         void setTag1(bool b) noexcept       {if (b) _bits |= kTagBit1; else _bits &= ~kTagBit1;}
         void setTag2(bool b) noexcept       {if (b) _bits |= kTagBit2; else _bits &= ~kTagBit2;}
 
         void setTags(int t) noexcept {
+            assert(!isInline() || (t & 0x03) != 0x03);  // (that would make it an integer)
             _bits = (_bits & ~(kTagBit1 | kTagBit2)) | (uint64_t(t & 0x03) << 48);
         }
 
@@ -130,6 +148,8 @@ namespace tails {
         NanTagged(void**) { }   // no-op initializer for subclass constructors to call
         const TO* pointerValue() const noexcept _pure  {return (TO*)(_bits & kPtrBits);}
         slice inlineValue() const noexcept _pure {return {&_bytes[kInlineOffset], kInlineCapacity};}
+        // (Shifting the payload to the top and back sign-extends it.)
+        constexpr int64_t integerValue() const noexcept _pure {return int64_t(_bits << 16) >> 16;}
 
     private:
         static constexpr uint64_t kSignBit  = 0x8000000000000000; // Sign bit of a double
@@ -142,6 +162,8 @@ namespace tails {
         static constexpr uint64_t kTypeMask    = kMagicBits | kSignBit; // Bits involved in tagging
         static constexpr uint64_t kPointerType = kMagicBits | kSignBit; // Tag bits in a pointer
         static constexpr uint64_t kInlineType  = kMagicBits;            // Tag bits in an inline
+        static constexpr uint64_t kIntTypeMask = kTypeMask | kTagBit1 | kTagBit2;
+        static constexpr uint64_t kIntType     = kMagicBits | kTagBit1 | kTagBit2; // ...in an integer
 
 
         // In little-endian the 51 free bits are at the start, in big-endian at the end.
@@ -0,0 +1,213 @@
+//
+// stack_pool.cc
+//
+// Copyright (C) 2021 Jens Alfke. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "stack_pool.hh"
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <cassert>
+#include <csignal>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace tails {
+    using namespace std;
+
+
+    // Start addresses of the guard pages of all existing DataStacks, in blocks of slots that are
+    // never freed. Slots are claimed and cleared atomically, so StackPools on different threads
+    // can allocate and free stacks at once, and the overflow handler can read them without a
+    // lock, which a signal handler mustn't take. (A list head that's constant-initialized also
+    // can't be destructed before static StackPools elsewhere.)
+    struct GuardPageBlock {
+        static constexpr size_t kSlots = 64;
+        atomic<void*>   slots[kSlots] = {};
+        GuardPageBlock* next = nullptr;         // (never changes once the block is in the list)
+    };
+    static atomic<GuardPageBlock*> sGuardPages {nullptr};
+
+
+    static void addGuardPage(void *guard) {
+        GuardPageBlock *first = sGuardPages.load(memory_order_acquire);
+        while (true) {
+            for (auto block = first; block; block = block->next) {
+                for (auto &slot : block->slots) {
+                    void *empty = nullptr;
+                    if (!slot.load(memory_order_relaxed)
+                            && slot.compare_exchange_strong(empty, guard))
+                        return;
+                }
+            }
+            // Every slot is taken, so add a block. If another thread just did, look again:
+            auto block = new GuardPageBlock;
+            block->slots[0].store(guard, memory_order_relaxed);
+            block->next = first;
+            if (sGuardPages.compare_exchange_strong(first, block, memory_order_release,
+                                                    memory_order_acquire))
+                return;
+            delete block;
+        }
+    }
+
+
+    static void removeGuardPage(void *guard) {
+        for (auto block = sGuardPages.load(memory_order_acquire); block; block = block->next) {
+            for (auto &slot : block->slots) {
+                if (slot.load(memory_order_relaxed) == guard) {
+                    slot.store(nullptr, memory_order_release);
+                    return;
+                }
+            }
+        }
+        assert(false);
+    }
+
+
+    size_t DataStack::pageSize() {
+        static const size_t sPageSize = size_t(getpagesize());
+        return sPageSize;
+    }
+
+
+    DataStack::~DataStack() {
+        if (_memory)
+            _pool->release(*this);
+    }
+
+
+    // The size of the mapping for a DataStack with at least the given capacity.
+    static size_t mappedSizeFor(size_t capacity) {
+        // Leave room for the slot below the base, and round up to a whole page, plus the guard:
+        size_t pageSize = DataStack::pageSize();
+        return ((capacity + 1) * sizeof(Value) + pageSize - 1) / pageSize * pageSize + pageSize;
+    }
+
+
+    StackPool::StackPool(size_t capacity)
+    :_mappedSize(mappedSizeFor(capacity))
+    {
+        _capacity = (_mappedSize - DataStack::pageSize()) / sizeof(Value) - 1;
+    }
+
+
+    StackPool::~StackPool() {
+        for (void *memory : _free)
+            free(memory, _mappedSize);
+    }
+
+
+    DataStack StackPool::acquire(size_t minCapacity) {
+        if (minCapacity > _capacity) {
+            // Too big for this pool, so allocate one just for this caller:
+            size_t mappedSize = mappedSizeFor(minCapacity);
+            return DataStack(this, allocate(mappedSize), mappedSize);
+        }
+        void *memory;
+        if (_free.empty()) {
+            memory = allocate(_mappedSize);
+        } else {
+            memory = _free.back();
+            _free.pop_back();
+        }
+        return DataStack(this, memory, _mappedSize);
+    }
+
+
+    void StackPool::release(DataStack &stack) {
+        if (stack._mappedSize == _mappedSize)
+            _free.push_back(stack._memory);
+        else
+            free(stack._memory, stack._mappedSize);
+        stack._memory = nullptr;
+    }
+
+
+    void* StackPool::allocate(size_t mappedSize) {
+        // Reserve the whole range, without committing any memory until it's touched:
+        void *memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (memory == MAP_FAILED)
+            throw bad_alloc();
+        void *guard = (char*)memory + mappedSize - DataStack::pageSize();
+        if (mprotect(guard, DataStack::pageSize(), PROT_NONE) != 0) {
+            munmap(memory, mappedSize);
+            throw bad_alloc();
+        }
+        addGuardPage(guard);
+        return memory;
+    }
+
+
+    void StackPool::free(void *memory, size_t mappedSize) {
+        removeGuardPage((char*)memory + mappedSize - DataStack::pageSize());
+        munmap(memory, mappedSize);
+    }
+
+
+    bool StackPool::isGuardPage(const void *addr) {
+        size_t pageSize = DataStack::pageSize();
+        for (auto block = sGuardPages.load(memory_order_acquire); block; block = block->next) {
+            for (auto &slot : block->slots) {
+                void *guard = slot.load(memory_order_acquire);
+                if (guard && addr >= guard && addr < (char*)guard + pageSize)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+
+#pragma mark - OVERFLOW HANDLER:
+
+
+    static struct sigaction sPrevSEGV, sPrevBUS;
+
+
+    static void overflowHandler(int sig, siginfo_t *info, void*) {
+        if (StackPool::isGuardPage(info->si_addr)) {
+            static constexpr char kMessage[] = "Tails: data stack overflow\n";
+            (void)!write(STDERR_FILENO, kMessage, sizeof(kMessage) - 1);
+        }
+        // Restore the previous handler and return. The faulting instruction will then fault
+        // again, and the previous handler (usually the default one that kills the process) runs.
+        sigaction(sig, (sig == SIGSEGV) ? &sPrevSEGV : &sPrevBUS, nullptr);
+    }
+
+
+    void StackPool::installOverflowHandler() {
+        static bool sInstalled = false;
+        if (sInstalled)
+            return;
+        sInstalled = true;
+
+        // Run the handler on its own stack, in case the native stack is exhausted too:
+        static char sAltStack[64 * 1024];
+        stack_t ss = {};
+        ss.ss_sp = sAltStack;
+        ss.ss_size = sizeof(sAltStack);
+        sigaltstack(&ss, nullptr);
+
+        struct sigaction action = {};
+        action.sa_sigaction = &overflowHandler;
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &sPrevSEGV);
+        sigaction(SIGBUS,  &action, &sPrevBUS);
+    }
+
+}
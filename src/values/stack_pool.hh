@@ -0,0 +1,113 @@
+//
+// stack_pool.hh
+//
+// Copyright (C) 2021 Jens Alfke. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "value.hh"
+#include "stack_effect.hh"
+#include <vector>
+
+
+namespace tails {
+    class StackPool;
+
+
+    /// A data stack to run a word on, obtained from a \ref StackPool. It's returned to the pool
+    /// when destructed.
+    ///
+    /// The stack is an mmap'd region followed by an inaccessible guard page, so pushing past its
+    /// capacity faults immediately instead of overwriting other memory. Pages are only committed
+    /// when first touched, so a large capacity costs nothing until it's used.
+    class DataStack {
+    public:
+        DataStack(DataStack &&other)
+        :_pool(other._pool), _memory(other._memory), _mappedSize(other._mappedSize)
+        {other._memory = nullptr;}
+
+        ~DataStack();
+
+        /// The bottom of the stack, i.e. the first item pushed. (A word's initial `sp` should be
+        /// `base() - 1`; `base()[-1]` is addressable, since `call` may access it.)
+        /// The contents are NOT initialized; a reused stack contains its previous values.
+        Value* base() const         {return end() - capacity();}
+
+        /// The number of Values that fit on the stack.
+        size_t capacity() const     {return (_mappedSize - pageSize()) / sizeof(Value) - 1;}
+
+        /// The highest slot of the stack; the value to set `core_words::stackLimit` to.
+        Value* limit() const        {return end() - 1;}
+
+        /// The end of the stack, the start of the guard page.
+        Value* end() const          {return (Value*)((char*)_memory + _mappedSize - pageSize());}
+
+        static size_t pageSize();
+
+    private:
+        friend class StackPool;
+        DataStack(StackPool *pool, void *memory, size_t mappedSize)
+        :_pool(pool), _memory(memory), _mappedSize(mappedSize) { }
+        DataStack(const DataStack&) = delete;
+
+        StackPool* _pool;
+        void*      _memory;
+        size_t     _mappedSize;
+    };
+
+
+    /// Hands out \ref DataStack s of a fixed capacity, and reuses them after they're released,
+    /// so running a word doesn't have to allocate and clear a stack every time.
+    /// Not thread-safe: use a pool per thread.
+    class StackPool {
+    public:
+        /// Enough for any word whose max stack depth is known, plus a generous number of inputs.
+        static constexpr size_t kDefaultCapacity = 2 * StackEffect::kUnknownMax;
+
+        explicit StackPool(size_t capacity = kDefaultCapacity);
+        ~StackPool();
+
+        /// The capacity of the stacks this pool hands out.
+        size_t capacity() const     {return _capacity;}
+
+        /// Returns a stack with room for at least `minCapacity` Values; a pooled one if possible.
+        /// (A stack larger than the pool's capacity is allocated just for this caller, and freed
+        /// when released.)
+        DataStack acquire(size_t minCapacity =0);
+
+        /// The number of released stacks waiting to be reused.
+        size_t available() const    {return _free.size();}
+
+        /// Installs a SIGSEGV/SIGBUS handler that, if the fault is in the guard page of a
+        /// DataStack, writes "data stack overflow" to stderr before the process crashes, so the
+        /// cause of the crash is obvious. Other faults are unaffected.
+        static void installOverflowHandler();
+
+        /// True if `addr` is in the guard page of any existing DataStack, in any pool.
+        /// Takes no locks, so it's safe to call from a signal handler.
+        static bool isGuardPage(const void *addr);
+
+    private:
+        friend class DataStack;
+        static void* allocate(size_t mappedSize);
+        static void free(void *memory, size_t mappedSize);
+        void release(DataStack&);
+
+        size_t             _capacity;
+        size_t             _mappedSize;
+        std::vector<void*> _free;
+    };
+
+}
@@ -31,11 +31,12 @@ namespace tails {
      ### Value data representation:
 
      `Value` is a subclass of `NanTagged` (see nan_tagged.hh), which magically allows numbers,
-     pointers and inline data to be stored in 64 bits. It exposes a `double`, a pointer,
-     two tag bits, and an "inline" flag.
+     pointers and inline data to be stored in 64 bits. It exposes a `double`, a 48-bit integer,
+     a pointer, two tag bits, and an "inline" flag.
 
-     - A number is represented as a regular `double` value. (This includes exact storage of integers
-       up to ±2^51.)
+     - A number is represented as a regular `double` value, or as an integer if it's an integer
+       in the range ±2^47. (Integer arithmetic whose result is out of that range produces a
+       `double`, which can store exact integers up to ±2^53.)
      - A string has `kStringTag`. If up to 6 bytes long it can be stored inline; the length is
        determined by the number of trailing zero bytes. Otherwise it points to a gc::String object.
      - An array has `kArrayTag` and points to a `gc::Array` object. (It's never inline.)
@@ -89,7 +90,7 @@ namespace tails {
 
 
     Value::Type Value::type() const {
-        if (isDouble())
+        if (isDouble() || isInt())
             return ANumber;
         else if (isNullPointer())
             return ANull;
@@ -151,9 +152,11 @@ namespace tails {
 
 
     void Value::mark() const {
+        if (isDouble() || isInt())
+            return;     // (a double's bits can look like any tag, and an integer's tags are 3)
         switch (tags()) {
             case kStringTag:
-                if (!isDouble() && !isInline())
+                if (!isInline())
                     ((gc::String*)asPointer())->mark();
                 break;
             case kArrayTag:
@@ -167,17 +170,13 @@ namespace tails {
     }
 
 
-    Value::operator bool() const {
-        if (isDouble())
-            return asDouble() != 0;
-        else
-            return !isNull();
-    }
+    // The out-of-line parts of `operator==`, `cmp` and `operator+`, for anything but two doubles,
+    // two integers or null. (See value.hh.)
 
-    bool Value::operator== (const Value &v) const {
-        if (NanTagged::operator==(v))
-            return true;
+    bool Value::equalsSlow(Value v) const {
         Type myType = type();
+        if (myType == ANumber && (isInt() || v.isInt()))
+            return asNumber() == v.asNumber();          // (an integer can equal a double)
         if (myType == ANull || myType == ANumber || v.type() != myType)
             return false;
         else if (myType == AString)
@@ -189,7 +188,7 @@ namespace tails {
     }
 
 
-    int Value::cmp(Value v) const {
+    int Value::cmpSlow(Value v) const {
         Type myType = type(), vType = v.type();
         if (myType != vType)
             return int(myType) - int(vType);
@@ -197,7 +196,7 @@ namespace tails {
             case ANull:
                 return 0;
             case ANumber:
-                return _cmp(asDouble(), v.asDouble());
+                return _cmp(asDouble(), v.asDouble());  // (an integer and a double)
             case AString:
                 return asString().compare(v.asString());
             case AnArray: {
@@ -226,8 +225,8 @@ namespace tails {
     }
 
 
-    Value Value::operator+ (Value v) const {
-        if (isDouble() || v.isDouble()) {
+    Value Value::addSlow(Value v) const {
+        if (isNumber() || v.isNumber()) {
             // Addition:
             return Value(asDouble() + v.asDouble());
         } else if (isString() && v.isString()) {
@@ -258,13 +257,21 @@ namespace tails {
 
     // Numeric-only operations don't need type checking. If either value is non-numeric, then
     // `asDouble` returns a NaN by definition, and the Value constructor changes that to `null`.
+    // Integer arithmetic is exact: the difference of two 48-bit integers can't overflow an
+    // `int64_t`, and the `int64_t` Value constructor makes a `double` if it doesn't fit.
 
     Value Value::operator- (Value v) const {
+        if (isInt() && v.isInt())
+            return Value(integerValue() - v.integerValue());
         return Value(asDouble() - v.asDouble());
     }
 
 
     Value Value::operator* (Value v) const {
+        if (isInt() && v.isInt()) {
+            if (int64_t product; !__builtin_mul_overflow(integerValue(), v.integerValue(), &product))
+                return Value(product);
+        }
         return Value(asDouble() * v.asDouble());
     }
 
@@ -275,9 +282,10 @@ namespace tails {
 
 
     Value Value::operator% (Value v) const {
-        // Modulo only operates on integers, and the denominator can't be zero:
-        if (isDouble() && v.isDouble()) {
-            if (int denom = v.asInt(); denom != 0)
+        // Modulo only operates on integers (a `double` is truncated), and the denominator can't
+        // be zero:
+        if (isNumber() && v.isNumber()) {
+            if (int64_t denom = v.asInt(); denom != 0)
                 return Value(asInt() % denom);
         }
         return NullValue;
@@ -300,7 +308,8 @@ namespace tails {
     std::ostream& operator<< (std::ostream &out, Value value) {
         switch (value.type()) {
             case Value::ANull:   return out << "null";
-            case Value::ANumber: return out << value.asDouble();
+            case Value::ANumber: return value.isInt() ? (out << value.asInt())
+                                                      : (out << value.asDouble());
             case Value::AString: return out << std::quoted(value.asString());
             case Value::AnArray: return out << *value.asArray();
             case Value::AQuote:  return out << "{(" << value.asQuote()->stackEffect() << ")}";
@@ -19,6 +19,7 @@
 #pragma once
 #include "platform.hh"
 #include "nan_tagged.hh"
+#include "utils.hh"
 #include <stddef.h>
 #include <stdint.h>
 #include <string_view>
@@ -35,14 +36,24 @@ namespace tails {
     /// This is a more complex implementation that can store numbers, strings, arrays, and
     /// "quotations" (anonymous words, aka lambdas.) This all still fits in 64 bits thanks to the
     /// magic of NaN Tagging.
+    ///
+    /// A number is either a `double` or a 48-bit integer. Both have type `ANumber`, and they
+    /// compare numerically, so `3` equals `3.0`. Integer arithmetic stays exact, until a result
+    /// doesn't fit in 48 bits; then it's a `double`.
     class Value : private NanTagged<void> {
     public:
         constexpr Value()          :NanTagged(nullptr) { }
         constexpr Value(nullptr_t) :Value() { }
 
         constexpr Value(double n)  :NanTagged(n) { }
-        constexpr Value(int n)     :Value(double(n)) { }
-        constexpr Value(size_t n)  :Value(double(n)) { }
+        Value(int n)               :NanTagged((void**)0) {setInteger(n);}
+        Value(int64_t n)           :NanTagged((void**)0) {setNumber(n);}
+        Value(size_t n)            :NanTagged((void**)0) {
+            if (n <= size_t(kMaxInteger))
+                setInteger(int64_t(n));
+            else
+                setDouble(double(n));
+        }
 
         Value(const char* str);
         Value(const char* str, size_t len);
@@ -52,6 +63,9 @@ namespace tails {
 
         explicit Value(CompiledWord*);
 
+        /// The range of integers that are stored as integers; others are stored as `double`s.
+        static constexpr int64_t kMinInt = kMinInteger, kMaxInt = kMaxInteger;
+
         enum Type {
             ANull,
             ANumber,
@@ -65,26 +79,82 @@ namespace tails {
 
         constexpr bool isNull() const       {return NanTagged::isNullPointer();}
         constexpr bool isDouble() const     {return NanTagged::isDouble();}
+        constexpr bool isInt() const        {return NanTagged::isInteger();}
+        constexpr bool isNumber() const     {return isDouble() || isInt();}
         constexpr bool isString() const     {return (asPointer() || isInline()) && tags() == kStringTag;}
         constexpr bool isArray() const      {return asPointer() && tags() == kArrayTag;}
         constexpr bool isQuote() const      {return asPointer() && tags() == kQuoteTag;}
 
-        constexpr double asNumber() const   {return NanTagged::asDouble();}
-        constexpr double asDouble() const   {return NanTagged::asDouble();}
-        constexpr int    asInt() const      {return int(asDoubleOrZero());}
+        /// A number's value as a `double`; or NaN if it's not a number.
+        constexpr double asNumber() const   {return isInt() ? double(integerValue())
+                                                            : NanTagged::asDouble();}
+        constexpr double asDouble() const   {return asNumber();}
+        /// A number's value as an integer (truncating a `double`); or 0 if it's not a number.
+        constexpr int64_t asInt() const     {return isInt() ? integerValue()
+                                                            : int64_t(asDoubleOrZero());}
+        /// An integer's or a double's value, without checking that it's that kind of number.
+        /// Only for Values that are known to be, like the operands of the compiler's
+        /// integer-only and double-only words.
+        constexpr int64_t uncheckedInt() const      {return integerValue();}
+        constexpr double uncheckedDouble() const    {return NanTagged::asDouble();}
+
         std::string_view asString() const;
         std::vector<Value>* asArray() const;
         const Word*      asQuote() const;
 
+        // The hot operations below -- truthiness, equality, comparison and `+` -- are inline, so
+        // the primitives that use them don't make a function call when the operands are two
+        // doubles, two integers, or null. Other types go to a cold out-of-line function.
+
         /// 'Truthiness' -- any Value except 0 and null is considered truthy.
-        explicit operator bool() const;
-        /// Equality comparison
-        bool operator== (const Value &v) const;
+        explicit operator bool() const {
+            if (isDouble())
+                return NanTagged::asDouble() != 0;
+            else if (isInt())
+                return integerValue() != 0;
+            else
+                return !isNull();
+        }
+
+        /// Equality comparison. Numbers are equal if their values are, whether they're integers or
+        /// doubles, so `0`, `0.0` and `-0.0` are all equal. (There's no NaN to worry about, since
+        /// a NaN stored in a Value becomes null.)
+        bool operator== (const Value &v) const {
+            if (isIdentical(v))
+                return true;
+            else if (isDouble() && v.isDouble())
+                return NanTagged::asDouble() == v.NanTagged::asDouble();    // (0.0 == -0.0)
+            else if ((isInt() && v.isInt()) || isNull() || v.isNull())
+                return false;   // (integers are equal only if they're identical)
+            else
+                return equalsSlow(v);
+        }
+
+        /// True if the two Values have the same representation. For numbers this is the same as
+        /// `==`, except that 0.0 and -0.0 aren't identical; for strings and arrays it's identity.
+        bool isIdentical(Value v) const             {return NanTagged::operator==(v);}
+
         /// 3-way comparison, like the C++20 `<=>` operator.
-        int cmp(Value v) const;
+        int cmp(Value v) const {
+            if (isDouble() && v.isDouble())
+                return _cmp(NanTagged::asDouble(), v.NanTagged::asDouble());
+            else if (isInt() && v.isInt())
+                return _cmp(integerValue(), v.integerValue());
+            else if (isNull() && v.isNull())
+                return 0;
+            else
+                return cmpSlow(v);
+        }
 
         // Arithmetic operators. `+` is overloaded to concatenate strings and arrays.
-        Value operator+ (Value v) const;
+        Value operator+ (Value v) const {
+            if (isDouble() && v.isDouble())
+                return Value(NanTagged::asDouble() + v.NanTagged::asDouble());
+            else if (isInt() && v.isInt())
+                return Value(integerValue() + v.integerValue());  // (can't overflow an int64)
+            else
+                return addSlow(v);
+        }
         Value operator- (Value v) const;
         Value operator* (Value v) const;
         Value operator/ (Value v) const;
@@ -97,7 +167,18 @@ namespace tails {
         void mark() const;
 
     private:
-        enum { kStringTag = 0, kArrayTag = 1, kQuoteTag = 2, };
+        enum { kStringTag = 0, kArrayTag = 1, kQuoteTag = 2, };  // (Tag 3 is an integer)
+
+        void setNumber(int64_t n) {
+            if (fitsInteger(n))
+                setInteger(n);
+            else
+                setDouble(double(n));
+        }
+
+        COLD bool equalsSlow(Value) const;
+        COLD int cmpSlow(Value) const;
+        COLD Value addSlow(Value) const;
 
         char* allocString(size_t len);
     };